@@ -1,204 +1,1476 @@
 #include "cpu.h"
+#include <string.h>
+#include <stdlib.h>
 
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CPU_USE_SSE2
+#endif
 
+//AVX2 is compiled per function and used only when the running CPU has it
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#include <immintrin.h>
+#define CPU_USE_AVX2
+#define CPU_TARGET_AVX2
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#define CPU_USE_AVX2
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+//serial fallback for compilers without OpenMP
+inline int omp_get_max_threads() { return 1; }
+inline int omp_get_thread_num() { return 0; }
+inline int omp_get_num_threads() { return 1; }
+#endif
 
 #define MIN_BRIGHTNESS 0
 #define MAX_BRIGHTNESS 255
 
-#define MAX(a,b)    (((a) > (b)) ? (a) : (b))
-#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+#define MAX(a,b)    (((a) > (b)) ? (a) : (b))
+#define MIN(a,b)    (((a) < (b)) ? (a) : (b))
+
+#define HISTOGRAM_BANKS 4 //number of interleaved bin arrays used by the unrolled histogram
+#define HISTOGRAM_BLOCK 16 //number of pixels processed in one unrolled step
+#define CACHE_LINE_SIZE 64
+
+void histogram(cl_uchar* inputImage, cl_uint* histogram, int width, int height)
+{
+	for (int i = 0; i < HISTOGRAM_SIZE; i++)
+	{
+		histogram[i] = 0;
+	}
+
+	for (int i = 0; i < (width*height); i++)
+	{
+		histogram[inputImage[i]]++;
+	}
+}
+
+/*! Adds gray values of count pixels to the histogram.
+ *  Consecutive pixels are counted to different banks, so the increments do not depend on each other.
+ */
+static void histogramAccumulate(const cl_uchar* inputImage, int count, cl_uint* histogram)
+{
+	cl_uint banks[HISTOGRAM_BANKS][HISTOGRAM_SIZE];
+	memset(banks, 0, sizeof(banks));
+
+	int i = 0;
+
+	for (; i + HISTOGRAM_BLOCK <= count; i += HISTOGRAM_BLOCK)
+	{
+		//16 gray values are loaded at once and split to four 32-bit words
+		cl_uint words[4];
+#ifdef CPU_USE_SSE2
+		__m128i block = _mm_loadu_si128((const __m128i*) (inputImage + i));
+		words[0] = _mm_cvtsi128_si32(block);
+		words[1] = _mm_cvtsi128_si32(_mm_srli_si128(block, 4));
+		words[2] = _mm_cvtsi128_si32(_mm_srli_si128(block, 8));
+		words[3] = _mm_cvtsi128_si32(_mm_srli_si128(block, 12));
+#else
+		memcpy(words, inputImage + i, sizeof(words));
+#endif
+
+		for (int j = 0; j < 4; j++)
+		{
+			banks[0][words[j] & 0xFF]++;
+			banks[1][(words[j] >> 8) & 0xFF]++;
+			banks[2][(words[j] >> 16) & 0xFF]++;
+			banks[3][words[j] >> 24]++;
+		}
+	}
+
+	//remaining pixels
+	for (; i < count; i++)
+	{
+		banks[i % HISTOGRAM_BANKS][inputImage[i]]++;
+	}
+
+	//merging the banks
+	for (int j = 0; j < HISTOGRAM_SIZE; j++)
+	{
+		histogram[j] += banks[0][j] + banks[1][j] + banks[2][j] + banks[3][j];
+	}
+}
+
+void histogramUnrolled(cl_uchar* inputImage, cl_uint* histogram, int width, int height)
+{
+	memset(histogram, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	histogramAccumulate(inputImage, width * height, histogram);
+}
+
+void histogramParallel(cl_uchar* inputImage, cl_uint* histogram, int width, int height, int numThreads)
+{
+	if (numThreads < 1)
+		numThreads = 1;
+
+	//private histograms of all threads in one block, every one of them starts on a cache line
+	char* privateBlock = (char*) malloc(numThreads * HISTOGRAM_SIZE * sizeof(cl_uint) + CACHE_LINE_SIZE);
+
+	if (privateBlock == NULL)
+	{
+		histogramUnrolled(inputImage, histogram, width, height);
+		return;
+	}
+
+	cl_uint* privateHistograms = (cl_uint*) (((size_t) privateBlock + CACHE_LINE_SIZE - 1) & ~((size_t) CACHE_LINE_SIZE - 1));
+	memset(privateHistograms, 0, numThreads * HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	int numberOfPixels = width * height;
+
+	#pragma omp parallel num_threads(numThreads)
+	{
+		int thread = omp_get_thread_num();
+		int threads = omp_get_num_threads();
+
+		//every thread gets a continuous part of the image, parts start on a block boundary
+		int blocks = (numberOfPixels + HISTOGRAM_BLOCK - 1) / HISTOGRAM_BLOCK;
+		int first = MIN(((long long) blocks * thread / threads) * HISTOGRAM_BLOCK, numberOfPixels);
+		int last = MIN(((long long) blocks * (thread + 1) / threads) * HISTOGRAM_BLOCK, numberOfPixels);
+
+		histogramAccumulate(inputImage + first, last - first, privateHistograms + thread * HISTOGRAM_SIZE);
+
+		//tree merge, in every step each remaining thread adds the histogram of its neighbour
+		for (int stride = 1; stride < threads; stride *= 2)
+		{
+			#pragma omp barrier
+
+			if (thread % (2 * stride) == 0 && thread + stride < threads)
+			{
+				cl_uint* target = privateHistograms + thread * HISTOGRAM_SIZE;
+				cl_uint* source = privateHistograms + (thread + stride) * HISTOGRAM_SIZE;
+
+				for (int i = 0; i < HISTOGRAM_SIZE; i++)
+				{
+					target[i] += source[i];
+				}
+			}
+		}
+	}
+
+	memcpy(histogram, privateHistograms, HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	free(privateBlock);
+}
+
+void histogramRGBL(cl_uchar4* inputImage, cl_uint* histogram, int width, int height)
+{
+	memset(histogram, 0, HISTOGRAM_CHANNELS * HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	cl_uint* redHistogram = histogram;
+	cl_uint* greenHistogram = histogram + HISTOGRAM_SIZE;
+	cl_uint* blueHistogram = histogram + 2 * HISTOGRAM_SIZE;
+	cl_uint* lumaHistogram = histogram + 3 * HISTOGRAM_SIZE;
+
+	for (int i = 0; i < (width*height); i++)
+	{
+		cl_uchar4 pixel = inputImage[i];
+
+		redHistogram[pixel.s[0]]++;
+		greenHistogram[pixel.s[1]]++;
+		blueHistogram[pixel.s[2]]++;
+		lumaHistogram[luma(pixel.s[0], pixel.s[1], pixel.s[2])]++;
+	}
+}
+
+cl_uint histogramROI(const cl_uchar* inputImage, int pitch, roi_t roi, const cl_uchar* mask, cl_uint* histogram)
+{
+	//interleaved banks like in histogramAccumulate, cleared once for the whole rectangle
+	cl_uint banks[HISTOGRAM_BANKS][HISTOGRAM_SIZE];
+	memset(banks, 0, sizeof(banks));
+
+	cl_uint count = 0;
+
+	for (int y = roi.y; y < roi.y + roi.height; y++)
+	{
+		const cl_uchar* row = inputImage + (size_t) y * pitch + roi.x;
+
+		if (mask == NULL)
+		{
+			for (int x = 0; x < roi.width; x++)
+			{
+				banks[x % HISTOGRAM_BANKS][row[x]]++;
+			}
+
+			count += roi.width;
+		}
+		else
+		{
+			const cl_uchar* maskRow = mask + (size_t) y * pitch + roi.x;
+
+			for (int x = 0; x < roi.width; x++)
+			{
+				cl_uint counted = (maskRow[x] != 0);
+				banks[x % HISTOGRAM_BANKS][row[x]] += counted;
+				count += counted;
+			}
+		}
+	}
+
+	for (int j = 0; j < HISTOGRAM_SIZE; j++)
+	{
+		histogram[j] = banks[0][j] + banks[1][j] + banks[2][j] + banks[3][j];
+	}
+
+	return count;
+}
+
+int tileHistogramInit(tileHistogram_t* tiles, int width, int height, int tileSize)
+{
+	tiles->width = width;
+	tiles->height = height;
+	tiles->tileSize = tileSize;
+	tiles->tilesX = (width + tileSize - 1) / tileSize;
+	tiles->tilesY = (height + tileSize - 1) / tileSize;
+	tiles->valid = false;
+
+	int numTiles = tiles->tilesX * tiles->tilesY;
+
+	tiles->tileHistograms = (cl_uint*) calloc((size_t) numTiles * HISTOGRAM_SIZE, sizeof(cl_uint));
+	tiles->checksums = (cl_uint*) calloc(numTiles, sizeof(cl_uint));
+	memset(tiles->histogram, 0, sizeof(tiles->histogram));
+
+	if (tiles->tileHistograms == NULL || tiles->checksums == NULL)
+	{
+		tileHistogramFree(tiles);
+		return -1;
+	}
+
+	return 0;
+}
+
+int tileHistogramUpdate(tileHistogram_t* tiles, const cl_uchar* inputImage)
+{
+	int numTiles = tiles->tilesX * tiles->tilesY;
+	int changedTiles = 0;
+
+	#pragma omp parallel reduction(+:changedTiles)
+	{
+		//changes of the histogram found by this thread, counts wrap around like the uint histogram
+		cl_uint delta[HISTOGRAM_SIZE];
+		cl_uint newHistogram[HISTOGRAM_SIZE];
+		memset(delta, 0, sizeof(delta));
+
+		#pragma omp for schedule(dynamic)
+		for (int tile = 0; tile < numTiles; tile++)
+		{
+			int x0 = (tile % tiles->tilesX) * tiles->tileSize;
+			int y0 = (tile / tiles->tilesX) * tiles->tileSize;
+			int tileWidth = MIN(tiles->tileSize, tiles->width - x0);
+			int tileHeight = MIN(tiles->tileSize, tiles->height - y0);
+
+			//the checksum reads the tile without scattered writes, the histogram is counted only if it changed
+			cl_uint checksum = 0;
+			for (int y = 0; y < tileHeight; y++)
+			{
+				const cl_uchar* row = inputImage + (size_t) (y0 + y) * tiles->width + x0;
+
+				for (int x = 0; x < tileWidth; x++)
+				{
+					checksum += tileChecksumTerm(y * tiles->tileSize + x, row[x]);
+				}
+			}
+
+			if (tiles->valid && checksum == tiles->checksums[tile])
+				continue;
+
+			memset(newHistogram, 0, sizeof(newHistogram));
+
+			for (int y = 0; y < tileHeight; y++)
+			{
+				const cl_uchar* row = inputImage + (size_t) (y0 + y) * tiles->width + x0;
+
+				for (int x = 0; x < tileWidth; x++)
+				{
+					newHistogram[row[x]]++;
+				}
+			}
+
+			//old counts of the tile are subtracted and the new ones added
+			cl_uint* tileHistogram = tiles->tileHistograms + (size_t) tile * HISTOGRAM_SIZE;
+			for (int i = 0; i < HISTOGRAM_SIZE; i++)
+			{
+				delta[i] += newHistogram[i] - tileHistogram[i];
+				tileHistogram[i] = newHistogram[i];
+			}
+
+			tiles->checksums[tile] = checksum;
+			changedTiles++;
+		}
+
+		#pragma omp critical
+		{
+			for (int i = 0; i < HISTOGRAM_SIZE; i++)
+			{
+				tiles->histogram[i] += delta[i];
+			}
+		}
+	}
+
+	tiles->valid = true;
+
+	return changedTiles;
+}
+
+void tileHistogramFree(tileHistogram_t* tiles)
+{
+	free(tiles->tileHistograms);
+	free(tiles->checksums);
+	tiles->tileHistograms = NULL;
+	tiles->checksums = NULL;
+}
+
+int binShift(int bitDepth, cl_uint numBins)
+{
+	int binBits = 0;
+	while ((1u << binBits) < numBins)
+		binBits++;
+
+	return bitDepth - binBits;
+}
+
+void histogramWideAccumulate(const cl_ushort* samples, size_t count, cl_uint* histogram, int shift)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		histogram[samples[i] >> shift]++;
+	}
+}
+
+void histogramWide(const cl_ushort* inputImage, cl_uint* histogram, int width, int height, int bitDepth, cl_uint numBins)
+{
+	memset(histogram, 0, numBins * sizeof(cl_uint));
+
+	histogramWideAccumulate(inputImage, (size_t) width * height, histogram, binShift(bitDepth, numBins));
+}
+
+void equalizeWideLUT(const cl_uint* histogram, int bitDepth, cl_uint numBins, cl_ushort* newValues)
+{
+	cl_ulong maxValue = (1u << bitDepth) - 1;
+
+	cl_ulong total = 0;
+	for (cl_uint i = 0; i < numBins; i++)
+	{
+		total += histogram[i];
+	}
+
+	//new value of a bin is its cumulative histogram value scaled to the full range
+	cl_ulong cumulative = 0;
+	for (cl_uint i = 0; i < numBins; i++)
+	{
+		cumulative += histogram[i];
+		newValues[i] = (cl_ushort) (cumulative * maxValue / total);
+	}
+}
+
+cl_uint otsuWideLUT(const cl_uint* histogram, int bitDepth, cl_uint numBins, cl_ushort* newValues)
+{
+	cl_ushort maxValue = (cl_ushort) ((1u << bitDepth) - 1);
+
+	cl_ulong total = 0;
+	cl_ulong sum = 0;
+	for (cl_uint i = 0; i < numBins; i++)
+	{
+		total += histogram[i];
+		sum += (cl_ulong) i * histogram[i];
+	}
+
+	//background and foreground statistics are kept exact, only the variance is in float like in thresholdWide
+	cl_ulong wB = 0;
+	cl_ulong sumB = 0;
+	float varMax = 0;
+	cl_uint threshold = 0;
+
+	for (cl_uint i = 0; i < numBins; i++)
+	{
+		wB += histogram[i];
+		sumB += (cl_ulong) i * histogram[i];
+
+		if (wB == 0)
+			continue;
+
+		cl_ulong wF = total - wB;
+		if (wF == 0)
+			break;
+
+		float mB = (float) sumB / (float) wB;
+		float mF = (float) (sum - sumB) / (float) wF;
+		float varBetween = (float) wB * (float) wF * (mB - mF) * (mB - mF);
+
+		if (varBetween > varMax)
+		{
+			varMax = varBetween;
+			threshold = i;
+		}
+	}
+
+	for (cl_uint i = 0; i < numBins; i++)
+	{
+		newValues[i] = (i > threshold) ? maxValue : 0;
+	}
+
+	return threshold;
+}
+
+void applyWideLUT(const cl_ushort* inputImage, cl_ushort* outputImage, size_t count, const cl_ushort* newValues, int shift)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		outputImage[i] = newValues[inputImage[i] >> shift];
+	}
+}
+
+void equalizeWide(const cl_ushort* inputImage, cl_ushort* outputImage, const cl_uint* histogram, int width, int height, int bitDepth, cl_uint numBins)
+{
+	cl_ushort* newValues = (cl_ushort*) malloc(numBins * sizeof(cl_ushort));
+	if (newValues == NULL)
+		return;
+
+	equalizeWideLUT(histogram, bitDepth, numBins, newValues);
+	applyWideLUT(inputImage, outputImage, (size_t) width * height, newValues, binShift(bitDepth, numBins));
+
+	free(newValues);
+}
+
+cl_uint otsuWide(const cl_ushort* inputImage, cl_ushort* outputImage, const cl_uint* histogram, int width, int height, int bitDepth, cl_uint numBins)
+{
+	cl_ushort* newValues = (cl_ushort*) malloc(numBins * sizeof(cl_ushort));
+	if (newValues == NULL)
+		return 0;
+
+	cl_uint threshold = otsuWideLUT(histogram, bitDepth, numBins, newValues);
+	applyWideLUT(inputImage, outputImage, (size_t) width * height, newValues, binShift(bitDepth, numBins));
+
+	free(newValues);
+
+	return threshold;
+}
+
+int cpuThreadCount()
+{
+	return omp_get_max_threads();
+}
+
+void equalizeLUT(const cl_uint* histogram, cl_uchar* newValues)
+{
+	//computing the cumulative histogram
+	cl_ulong cumulative[HISTOGRAM_SIZE];
+	cumulative[0] = histogram[0];
+	for (int i = 1; i < HISTOGRAM_SIZE; i++)
+	{
+		cumulative[i] = cumulative[i-1] + histogram[i];
+	}
+
+	//number of counted pixels is the last value in the cumulative histogram, it differs from the image size if only a part of the image was counted
+	cl_ulong numberOfPixels = cumulative[HISTOGRAM_SIZE-1];
+	if (numberOfPixels == 0)
+		numberOfPixels = 1;
+
+	//computing the new pixel values in integers, the same as equalize1 in kernels.cl
+	for (int i = 0; i < HISTOGRAM_SIZE; i++)
+	{
+		cl_ulong newValue = cumulative[i] * HISTOGRAM_SIZE / numberOfPixels;
+		newValues[i] = (cl_uchar) ((newValue < MAX_BRIGHTNESS) ? newValue : MAX_BRIGHTNESS);
+	}
+}
+
+void cumulativeHistogram(const cl_uint* histogram, cl_uint* cumulative)
+{
+	cumulative[0] = histogram[0];
+	for (cl_uint i = 1; i < HISTOGRAM_SIZE; i++)
+	{
+		cumulative[i] = cumulative[i-1] + histogram[i];
+	}
+}
+
+void matchLUT(const cl_uint* histogram, const cl_uint* referenceCumulative, cl_uchar* newValues)
+{
+	cl_uint cumulative[HISTOGRAM_SIZE];
+	cumulativeHistogram(histogram, cumulative);
+
+	cl_ulong sourceTotal = (cumulative[HISTOGRAM_SIZE-1] > 0) ? cumulative[HISTOGRAM_SIZE-1] : 1;
+	cl_ulong referenceTotal = referenceCumulative[HISTOGRAM_SIZE-1];
+
+	//the smallest reference level with at least the same share of pixels, levels only grow with the source level
+	cl_uint level = 0;
+	for (cl_uint i = 0; i < HISTOGRAM_SIZE; i++)
+	{
+		cl_ulong target = (cl_ulong) cumulative[i] * referenceTotal;
+		while (level < HISTOGRAM_SIZE - 1 && (cl_ulong) referenceCumulative[level] * sourceTotal < target)
+		{
+			level++;
+		}
+		newValues[i] = (cl_uchar) level;
+	}
+}
+
+static void applyLUTScalar(const cl_uchar* inputImage, cl_uchar* outputImage, size_t count, const cl_uchar* newValues)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		outputImage[i] = newValues[inputImage[i]];
+	}
+}
+
+#ifdef CPU_USE_AVX2
+static bool cpuHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	//the system has to save the ymm registers too
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+/*! vpshufb looks up 16 entries per lane, so the table is split into 16 rows of 16 values.
+ *  Adding 0x70 with saturation keeps the low nibble and sets the high bit (zero result)
+ *  for every row but the one the pixel belongs to, the pixels are moved down by a row each step.
+ */
+CPU_TARGET_AVX2 static void applyLUTAVX2(const cl_uchar* inputImage, cl_uchar* outputImage, size_t count, const cl_uchar* newValues)
+{
+	__m256i rows[HISTOGRAM_SIZE / 16];
+	for (int row = 0; row < HISTOGRAM_SIZE / 16; row++)
+	{
+		rows[row] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) (newValues + row * 16)));
+	}
+
+	const __m256i offset = _mm256_set1_epi8(0x70);
+	const __m256i rowSize = _mm256_set1_epi8(16);
+
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256i pixels = _mm256_loadu_si256((const __m256i*) (inputImage + i));
+		__m256i result = _mm256_setzero_si256();
+		for (int row = 0; row < HISTOGRAM_SIZE / 16; row++)
+		{
+			result = _mm256_or_si256(result, _mm256_shuffle_epi8(rows[row], _mm256_adds_epu8(pixels, offset)));
+			pixels = _mm256_sub_epi8(pixels, rowSize);
+		}
+		_mm256_storeu_si256((__m256i*) (outputImage + i), result);
+	}
+
+	applyLUTScalar(inputImage + i, outputImage + i, count - i, newValues);
+}
+#endif
+
+void applyLUT(const cl_uchar* inputImage, cl_uchar* outputImage, size_t count, const cl_uchar* newValues)
+{
+	void (*apply)(const cl_uchar*, cl_uchar*, size_t, const cl_uchar*) = applyLUTScalar;
+#ifdef CPU_USE_AVX2
+	if (cpuHasAVX2())
+		apply = applyLUTAVX2;
+#endif
+
+	//every thread gets one contiguous part, aligned to whole cache lines
+	#pragma omp parallel
+	{
+		int threads = omp_get_num_threads();
+		size_t part = ((count + threads - 1) / threads + 63) & ~(size_t) 63;
+		size_t begin = part * omp_get_thread_num();
+		if (begin < count)
+		{
+			size_t end = (begin + part < count) ? begin + part : count;
+			apply(inputImage + begin, outputImage + begin, end - begin, newValues);
+		}
+	}
+}
+
+void matchHistogram(const cl_uchar* inputImage, cl_uchar* outputImage, const cl_uint* histogram, const cl_uint* referenceCumulative, int width, int height)
+{
+	cl_uchar newValues[HISTOGRAM_SIZE];
+
+	matchLUT(histogram, referenceCumulative, newValues);
+	applyLUT(inputImage, outputImage, (size_t) width * height, newValues);
+}
+
+void equalize(cl_uchar* inputImage, cl_uchar* outputImage, cl_uint* histogram, int width, int height)
+{
+	cl_uchar newValues[HISTOGRAM_SIZE]; //each value represents a new pixel value for a pixel value given by its index
+
+	equalizeLUT(histogram, newValues);
+
+	//assigning new values to pixels of the output image
+	applyLUT(inputImage, outputImage, (size_t) width * height, newValues);
+}
+
+void equalizeColor(const cl_uchar4* inputImage, cl_uchar4* outputImage, const cl_uint* histogram, int width, int height)
+{
+	cl_uchar newValues[HISTOGRAM_SIZE];
+	equalizeLUT(histogram, newValues);
+
+	int numberOfPixels = width * height;
+
+	#pragma omp parallel for
+	for (int i = 0; i < numberOfPixels; i++)
+	{
+		cl_uchar red = inputImage[i].s[0];
+		cl_uchar green = inputImage[i].s[1];
+		cl_uchar blue = inputImage[i].s[2];
+
+		int newLuma = newValues[luma(red, green, blue)] << 16;
+		int blueDifference = chromaBlue(red, green, blue) - 128;
+		int redDifference = chromaRed(red, green, blue) - 128;
+
+		outputImage[i].s[0] = fixedToChannel(newLuma + 91881 * redDifference + 32768);
+		outputImage[i].s[1] = fixedToChannel(newLuma - 22554 * blueDifference - 46802 * redDifference + 32768);
+		outputImage[i].s[2] = fixedToChannel(newLuma + 116130 * blueDifference + 32768);
+		outputImage[i].s[3] = inputImage[i].s[3];
+	}
+}
+
+void claheClip(cl_uint* histogram, cl_uint pixels, cl_uint clipLimit)
+{
+	cl_uint limit = (cl_uint) ((cl_ulong) pixels * clipLimit / (CLAHE_CLIP_SCALE * HISTOGRAM_SIZE));
+	if (limit < 1)
+		limit = 1;
+
+	cl_uint excess = 0;
+	for (cl_uint i = 0; i < HISTOGRAM_SIZE; i++)
+	{
+		if (histogram[i] > limit)
+		{
+			excess += histogram[i] - limit;
+			histogram[i] = limit;
+		}
+	}
+
+	//every bin gets the same share, the remainder goes to the first bins
+	cl_uint share = excess / HISTOGRAM_SIZE;
+	cl_uint remainder = excess % HISTOGRAM_SIZE;
+	for (cl_uint i = 0; i < HISTOGRAM_SIZE; i++)
+	{
+		histogram[i] += share + (i < remainder);
+	}
+}
+
+int clahe(const cl_uchar* inputImage, cl_uchar* outputImage, int width, int height, int tileSize, cl_uint clipLimit)
+{
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+
+	//new values of every tile
+	cl_uchar* newValues = (cl_uchar*) malloc((size_t) tilesX * tilesY * HISTOGRAM_SIZE);
+	if (newValues == NULL)
+		return -1;
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int tile = 0; tile < tilesX * tilesY; tile++)
+	{
+		roi_t rect;
+		rect.x = (tile % tilesX) * tileSize;
+		rect.y = (tile / tilesX) * tileSize;
+		rect.width = (rect.x + tileSize <= width) ? tileSize : width - rect.x;
+		rect.height = (rect.y + tileSize <= height) ? tileSize : height - rect.y;
+
+		cl_uint tileHistogram[HISTOGRAM_SIZE];
+		cl_uint pixels = histogramROI(inputImage, width, rect, NULL, tileHistogram);
+
+		claheClip(tileHistogram, pixels, clipLimit);
+		equalizeLUT(tileHistogram, newValues + (size_t) tile * HISTOGRAM_SIZE);
+	}
+
+	cl_uint area = tileSize * tileSize;
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		int top, bottom, weightY;
+		claheNeighbours(y, tileSize, tilesY, &top, &bottom, &weightY);
+
+		const cl_uchar* topRow = newValues + (size_t) top * tilesX * HISTOGRAM_SIZE;
+		const cl_uchar* bottomRow = newValues + (size_t) bottom * tilesX * HISTOGRAM_SIZE;
+
+		for (int x = 0; x < width; x++)
+		{
+			int left, right, weightX;
+			claheNeighbours(x, tileSize, tilesX, &left, &right, &weightX);
+
+			cl_uchar value = inputImage[(size_t) y * width + x];
+			cl_uint topValue = (tileSize - weightX) * topRow[left * HISTOGRAM_SIZE + value] + weightX * topRow[right * HISTOGRAM_SIZE + value];
+			cl_uint bottomValue = (tileSize - weightX) * bottomRow[left * HISTOGRAM_SIZE + value] + weightX * bottomRow[right * HISTOGRAM_SIZE + value];
+
+			outputImage[(size_t) y * width + x] = (cl_uchar) (((tileSize - weightY) * topValue + weightY * bottomValue + area / 2) / area);
+		}
+	}
+
+	free(newValues);
+
+	return 0;
+}
+
+/*! Between-class variance of the Otsu method, the same as otsuVariance() in kernels.cl
+ *  when the device divides floats correctly rounded, see setupCL.
+ */
+static float otsuVariance(cl_ulong wB, cl_ulong sumB, cl_ulong total, cl_ulong sum)
+{
+	cl_ulong wF = total - wB;
+	if (wB == 0 || wF == 0)
+		return 0;
+
+	float mB = (float) sumB / (float) wB;
+	float mF = (float) (sum - sumB) / (float) wF;
+	return (float) wB * (float) wF * (mB - mF) * (mB - mF);
+}
 
-void histogram(cl_uchar4* inputImage, cl_uint* histogram, int width, int height)
+cl_uint otsuThreshold(const cl_uint* histogram)
 {
-	for (int i = 0; i < HISTOGRAM_SIZE; i++)
+	cl_ulong total = 0;
+	cl_ulong sum = 0;
+	for (cl_uint i = 0; i < HISTOGRAM_SIZE; i++)
 	{
-		histogram[i] = 0;
+		total += histogram[i];
+		sum += (cl_ulong) i * histogram[i];
 	}
 
-	for (int i = 0; i < (width*height); i++)
+	cl_ulong wB = 0;
+	cl_ulong sumB = 0;
+	float varMax = 0;
+	cl_uint threshold = 0;
+
+	for (cl_uint i = 0; i < HISTOGRAM_SIZE; i++)
 	{
-		histogram[inputImage[i].s[0]]++;
+		wB += histogram[i];
+		sumB += (cl_ulong) i * histogram[i];
+
+		float varBetween = otsuVariance(wB, sumB, total, sum);
+		if (varBetween > varMax)
+		{
+			varMax = varBetween;
+			threshold = i + 1; //pixels of the best bin still belong to the background
+		}
 	}
+
+	return threshold;
 }
 
-void equalize(cl_uchar4* inputImage, cl_uchar4* outputImage, cl_uint* histogram, float numberOfPixels)
+void otsu(cl_uchar* inputImage, cl_uchar* outputImage, cl_uint* histogram, int width, int height)
 {
-	int newValues[HISTOGRAM_SIZE]; //each value represents a new pixel value for a pixel value given by its index
+	cl_uint threshold = otsuThreshold(histogram);
 
-	//computing the cumulative histogram
-	newValues[0] = histogram[0];
-    for (int i = 1; i < HISTOGRAM_SIZE; i++)
+	cl_uchar newValues[HISTOGRAM_SIZE];
+	for (cl_uint i = 0; i < HISTOGRAM_SIZE; i++)
 	{
-	    newValues[i] = newValues[i-1] + histogram[i];
+		newValues[i] = (i > threshold) ? MAX_BRIGHTNESS : MIN_BRIGHTNESS;
 	}
 
-	//float numberOfPixels = width * height;//newValues[HISTOGRAM_SIZE-1]; //number of pixels in the input image is the last value in the cumulative histogram
+	//assigning new values to pixels of the output image
+	applyLUT(inputImage, outputImage, (size_t) width * height, newValues);
+}
+
+/*! Packs one row of pixels to words of a binary mask, pixels above the threshold become set bits.
+ */
+static void thresholdRowPacked(const cl_uchar* row, cl_uint* maskRow, int width, cl_uint threshold)
+{
+	cl_uchar limit = (cl_uchar) MIN(threshold, (cl_uint) MAX_BRIGHTNESS); //no pixel is above the brightest value
+	int x = 0;
+
+#ifdef CPU_USE_SSE2
+	//bytes are compared as signed, so both sides are shifted by 128, the sign bits of 32 pixels form a word
+	__m128i bias = _mm_set1_epi8((char) 0x80);
+	__m128i limits = _mm_xor_si128(_mm_set1_epi8((char) limit), bias);
 
-	//computing the new pixel values
-	for (int i = 0; i < HISTOGRAM_SIZE; i++)
+	for (; x + (int) MASK_WORD_PIXELS <= width; x += MASK_WORD_PIXELS)
 	{
-	    newValues[i] *=  HISTOGRAM_SIZE / numberOfPixels;
+		__m128i low = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (row + x)), bias);
+		__m128i high = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (row + x + 16)), bias);
+		cl_uint lowBits = (cl_uint) _mm_movemask_epi8(_mm_cmpgt_epi8(low, limits));
+		cl_uint highBits = (cl_uint) _mm_movemask_epi8(_mm_cmpgt_epi8(high, limits));
+		maskRow[x / MASK_WORD_PIXELS] = lowBits | (highBits << 16);
 	}
+#endif
 
-	//assigning new values to pixels of the output image
-	for (int i = 0; i < numberOfPixels; i++)
+	for (; x < width; x += MASK_WORD_PIXELS)
+	{
+		int end = MIN(x + (int) MASK_WORD_PIXELS, width);
+		cl_uint word = 0;
+		for (int i = x; i < end; i++)
+		{
+			if (row[i] > limit)
+				word |= 1u << (i - x);
+		}
+		maskRow[x / MASK_WORD_PIXELS] = word;
+	}
+}
+
+void otsuPacked(const cl_uchar* inputImage, cl_uint* outputMask, const cl_uint* histogram, int width, int height)
+{
+	cl_uint threshold = otsuThreshold(histogram);
+	int pitch = maskPitch(width);
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		thresholdRowPacked(inputImage + (size_t) y * width, outputMask + (size_t) y * pitch, width, threshold);
+	}
+}
+
+void unpackMask(const cl_uint* mask, cl_uchar* outputImage, int width, int height)
+{
+	int pitch = maskPitch(width);
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
 	{
-		int newValue = newValues[inputImage[i].s[0]]; //get new value for current pixel
-		memset(outputImage[i].s, newValue, 4); //write the new value to the output image
+		const cl_uint* maskRow = mask + (size_t) y * pitch;
+		cl_uchar* row = outputImage + (size_t) y * width;
+
+		for (int x = 0; x < width; x++)
+		{
+			row[x] = ((maskRow[x / MASK_WORD_PIXELS] >> (x % MASK_WORD_PIXELS)) & 1) ? MAX_BRIGHTNESS : MIN_BRIGHTNESS;
+		}
 	}
 }
 
-void otsu(cl_uchar4* inputImage, cl_uchar4* outputImage, cl_uint* histogram, int width, int height)
+/*! Histogram, new values and output of every image of a batch, the images are processed in parallel.
+ */
+static void processBatch(const cl_uchar* images, const cl_uint4* table, int count, cl_uchar* outputImages, cl_uint* histograms, bool threshold)
 {
-   unsigned long total = 0;
-   unsigned long sum = 0;
-   float sumB = 0, varMax = 0, varBetween;
-   long wB = 0,  wF = 0, threshold = 0;
-   float mB, mF;  
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < count; i++)
+	{
+		const cl_uchar* inputImage = images + table[i].s[0];
+		size_t pixels = (size_t) table[i].s[1] * table[i].s[2];
+		cl_uint* histogram = histograms + (size_t) i * HISTOGRAM_SIZE;
 
-   for (int i = 0 ; i < HISTOGRAM_SIZE; i++) {
-      sum += i * histogram[i];
-      total += histogram[i];
-   }
+		memset(histogram, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+		histogramAccumulate(inputImage, (int) pixels, histogram);
 
+		cl_uchar newValues[HISTOGRAM_SIZE];
+		if (threshold)
+		{
+			cl_uint value = otsuThreshold(histogram);
+			for (cl_uint j = 0; j < HISTOGRAM_SIZE; j++)
+			{
+				newValues[j] = (j > value) ? MAX_BRIGHTNESS : MIN_BRIGHTNESS;
+			}
+		}
+		else
+		{
+			equalizeLUT(histogram, newValues);
+		}
 
-   for (int i = 0 ; i < HISTOGRAM_SIZE; i++) {
+		//the images are small, one thread applies the whole image
+		applyLUTScalar(inputImage, outputImages + table[i].s[0], pixels, newValues);
+	}
+}
 
-      wB += histogram[i];             // Weight Background
-      
-	  if (wB == 0) 
-		  continue;
+void equalizeBatch(const cl_uchar* images, const cl_uint4* table, int count, cl_uchar* outputImages, cl_uint* histograms)
+{
+	processBatch(images, table, count, outputImages, histograms, false);
+}
 
-      wF = total - wB;           // Weight Foreground
-      if (wF == 0) 
-		  break;
+void otsuBatch(const cl_uchar* images, const cl_uint4* table, int count, cl_uchar* outputImages, cl_uint* histograms)
+{
+	processBatch(images, table, count, outputImages, histograms, true);
+}
 
-      sumB += (float) (i * histogram[i]);
+/*! Between-class variance term of the class of bins from first to last - 1 of the multi-level Otsu method,
+ *  the same as otsuClassVariance() in kernels.cl.
+ */
+static float otsuClassVariance(const cl_ulong* counts, const cl_ulong* moments, cl_uint first, cl_uint last, float mean)
+{
+	cl_ulong w = counts[last] - counts[first];
+	if (w == 0)
+		return 0;
 
-      mB = sumB / wB;            // Mean Background 
-      mF = (sum - sumB) / wF;    // Mean Foreground
+	float classMean = (float) (moments[last] - moments[first]) / (float) w;
+	return (float) w * (classMean - mean) * (classMean - mean);
+}
 
-      // Calculate Between Class Variance 
-      varBetween = (float)wB * (float)wF * (mB - mF) * (mB - mF);
+/*! Best tuple of class boundaries for a fixed boundary of the lowest class, the same as otsuMultiSearch() in kernels.cl.
+ *  Boundaries are the first bins of the classes above the lowest one, on a tie the lowest tuple wins.
+ */
+static float otsuMultiSearch(const cl_ulong* counts, const cl_ulong* moments, float mean, cl_uint first, int classes, cl_uint* bounds)
+{
+	float lower = otsuClassVariance(counts, moments, 0, first, mean);
+	float bestVariance = -1;
+	bounds[0] = first;
 
-      // Check if new maximum found 
-      if (varBetween > varMax) {
-         varMax = varBetween;
-         threshold = i+1;
-      }
-   }
+	if (classes == 2)
+		return lower + otsuClassVariance(counts, moments, first, HISTOGRAM_SIZE, mean);
 
-	//assigning new values to pixels of the output image
-	for (int i = 0; i < (width*height); i++)
+	for (cl_uint second = first + 1; second <= HISTOGRAM_SIZE - (classes - 2); second++)
 	{
-		if(inputImage[i].s[0] > threshold)
+		float middle = lower + otsuClassVariance(counts, moments, first, second, mean);
+
+		if (classes == 3)
 		{
-			memset(outputImage[i].s, MAX_BRIGHTNESS, 4); 
-		} else {
-			memset(outputImage[i].s, MIN_BRIGHTNESS, 4); 
+			float variance = middle + otsuClassVariance(counts, moments, second, HISTOGRAM_SIZE, mean);
+			if (variance > bestVariance)
+			{
+				bestVariance = variance;
+				bounds[1] = second;
+			}
+			continue;
 		}
+
+		for (cl_uint third = second + 1; third < HISTOGRAM_SIZE; third++)
+		{
+			float variance = middle + otsuClassVariance(counts, moments, second, third, mean) + otsuClassVariance(counts, moments, third, HISTOGRAM_SIZE, mean);
+			if (variance > bestVariance)
+			{
+				bestVariance = variance;
+				bounds[1] = second;
+				bounds[2] = third;
+			}
+		}
+	}
+
+	return bestVariance;
+}
+
+void otsuMultiThresholds(const cl_uint* histogram, int classes, cl_uint* thresholds)
+{
+	//number of pixels and sum of the gray levels below every bin
+	cl_ulong counts[HISTOGRAM_SIZE + 1];
+	cl_ulong moments[HISTOGRAM_SIZE + 1];
+	counts[0] = 0;
+	moments[0] = 0;
+	for (cl_uint i = 0; i < HISTOGRAM_SIZE; i++)
+	{
+		counts[i + 1] = counts[i] + histogram[i];
+		moments[i + 1] = moments[i] + (cl_ulong) i * histogram[i];
+	}
+
+	float mean = (counts[HISTOGRAM_SIZE] > 0) ? (float) moments[HISTOGRAM_SIZE] / (float) counts[HISTOGRAM_SIZE] : 0;
+
+	//best tuple for every boundary of the lowest class
+	int lastFirst = HISTOGRAM_SIZE - (classes - 1);
+	float bestVariance[HISTOGRAM_SIZE];
+	cl_uint bestBounds[HISTOGRAM_SIZE][OTSU_MAX_CLASSES - 1];
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int first = 1; first <= lastFirst; first++)
+	{
+		bestVariance[first] = otsuMultiSearch(counts, moments, mean, first, classes, bestBounds[first]);
+	}
+
+	//the largest variance wins, the lower boundary on a tie
+	int best = 1;
+	for (int first = 2; first <= lastFirst; first++)
+	{
+		if (bestVariance[first] > bestVariance[best])
+			best = first;
+	}
+
+	//a class ends one bin below the next boundary
+	for (int j = 0; j < classes - 1; j++)
+	{
+		thresholds[j] = bestBounds[best][j] - 1;
+	}
+}
+
+void otsuMulti(cl_uchar* inputImage, cl_uchar* outputImage, const cl_uint* histogram, int width, int height, int classes, cl_uint* thresholds)
+{
+	otsuMultiThresholds(histogram, classes, thresholds);
+
+	//the same levels as of the thresholding kernel
+	cl_uchar newValues[HISTOGRAM_SIZE];
+	for (cl_uint i = 0; i < HISTOGRAM_SIZE; i++)
+	{
+		cl_uint level = 0;
+		for (int j = 0; j < classes - 1; j++)
+			level += (i > thresholds[j]) ? 1 : 0;
+
+		newValues[i] = (cl_uchar) (level * MAX_BRIGHTNESS / (classes - 1));
 	}
 
+	applyLUT(inputImage, outputImage, (size_t) width * height, newValues);
+}
+
+
+/*! Iteratively finds the threshold of a window histogram of the segmentation, starting from the given threshold.
+ */
+static int segmentationThreshold(const cl_uint* subHist, int threshold)
+{
+    int mean1 = 0;
+    int mean2 = 0;
+    int newTh = 128;
+    int sum = 0;
+    int count = 0;
+
+    for (int iter = 0; iter < 15; iter++)
+    {
+        for (int i = 0; i < HISTOGRAM_SIZE; i++)
+        {
+            if (i <= threshold)
+            {
+                //lower part
+                count += subHist[i];
+                sum += subHist[i] * i;
+            
+                if (i == threshold)
+                {
+                    //last
+                    if (count == 0)
+                        mean1 = threshold;
+                    else
+                        mean1 = sum / count;
+                    sum = count = 0;
+                }
+            }
+            else
+            {
+                //upper part                        
+                count += subHist[i];
+                sum += subHist[i] * i;
+            }
+        }
+        if (count == 0)
+            mean2 = threshold;
+        else
+            mean2 = sum / count;
+        sum = count = 0;
+
+        newTh = (mean1 + mean2) / 2;
+
+        if (abs(newTh - threshold) < 3)
+            break;
+
+        threshold = newTh;
+    }
+    threshold = newTh;
+
+    if (threshold < SEG_TH_BORDERS)
+        threshold = SEG_TH_BORDERS;
+    
+    if (threshold > 255 - SEG_TH_BORDERS)
+        threshold = 255 - SEG_TH_BORDERS;
+
+    return threshold;
+}
 
-  //printf("tresh %d\n", threshold);
+/*! Adds one image row to the column histograms of the segmentation window, or removes it for a negative change.
+ */
+static void segmentationColumnsUpdate(cl_uint* columnHists, const cl_uchar* row, int width, cl_uint change)
+{
+    for (int x = 0; x < width; x++)
+    {
+        columnHists[(size_t) x * HISTOGRAM_SIZE + row[x]] += change;
+    }
 }
 
+/*! Moves the window histogram of the segmentation by one column, adds the entering and removes the leaving column,
+ *  either of them may be NULL at the image border.
+ */
+static void segmentationWindowMove(cl_uint* subHist, const cl_uint* entering, const cl_uint* leaving)
+{
+    if (entering != NULL && leaving != NULL)
+    {
+        for (int i = 0; i < HISTOGRAM_SIZE; i++)
+            subHist[i] += entering[i] - leaving[i];
+    }
+    else if (entering != NULL)
+    {
+        for (int i = 0; i < HISTOGRAM_SIZE; i++)
+            subHist[i] += entering[i];
+    }
+    else if (leaving != NULL)
+    {
+        for (int i = 0; i < HISTOGRAM_SIZE; i++)
+            subHist[i] -= leaving[i];
+    }
+}
 
-void segmentation(cl_uchar4* inputImage, cl_uchar4* outputImage, int width, int height)
+/*! Segmentation to black and white pixels or to a packed binary mask, the other output is NULL.
+ *  The window histogram slides along the row by adding and removing histograms of whole columns of the window,
+ *  the column histograms slide down with the rows, so the cost per pixel does not depend on the window size.
+ *  The window is clipped to the image and the threshold is carried from pixel to pixel as before.
+ */
+static int segmentationPixels(const cl_uchar* inputImage, cl_uchar* outputImage, cl_uint* outputMask, int width, int height)
 {
-    int subHist[HISTOGRAM_SIZE];
+    cl_uint subHist[HISTOGRAM_SIZE];
     int threshold = HISTOGRAM_SIZE / 2;
+    int pitch = maskPitch(width);
+
+    //histogram of every column over the rows of the window
+    cl_uint* columnHists = (cl_uint*) calloc((size_t) width * HISTOGRAM_SIZE, sizeof(cl_uint));
+    if (columnHists == NULL)
+        return -1;
+
+    for (int y = 0; y < MIN(SEG_SUB_DIAMETER, height); y++)
+    {
+        segmentationColumnsUpdate(columnHists, inputImage + (size_t) y * width, width, 1);
+    }
 
     for (int y = 0; y < height; y++)
     {
+        cl_uint word = 0;
+
+        //the window rows move down by one
+        if (y + SEG_SUB_DIAMETER < height)
+            segmentationColumnsUpdate(columnHists, inputImage + (size_t) (y + SEG_SUB_DIAMETER) * width, width, 1);
+        if (y - SEG_SUB_DIAMETER - 1 >= 0)
+            segmentationColumnsUpdate(columnHists, inputImage + (size_t) (y - SEG_SUB_DIAMETER - 1) * width, width, (cl_uint) -1);
+
+        //window of the first pixel of the row
+        memset(subHist, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+        for (int x = 0; x < MIN(SEG_SUB_DIAMETER, width); x++)
+        {
+            segmentationWindowMove(subHist, columnHists + (size_t) x * HISTOGRAM_SIZE, NULL);
+        }
+
         for (int x = 0; x < width; x++)
         {
-            //for every pixel compute histogram of sub-image
+            int entering = x + SEG_SUB_DIAMETER;
+            int leaving = x - SEG_SUB_DIAMETER - 1;
+            segmentationWindowMove(subHist,
+                (entering < width) ? columnHists + (size_t) entering * HISTOGRAM_SIZE : NULL,
+                (leaving >= 0) ? columnHists + (size_t) leaving * HISTOGRAM_SIZE : NULL);
+
+            threshold = segmentationThreshold(subHist, threshold);
 
-            memset(subHist, 0, HISTOGRAM_SIZE * sizeof(int));
+            bool foreground = inputImage[y * width + x] > threshold;
 
-            for (int yy = -SEG_SUB_DIAMETER; yy <= SEG_SUB_DIAMETER; yy++)
+            if (outputMask != NULL)
             {
-                int subPosY = y + yy;
-                //check bounds
-                if (subPosY < 0 || subPosY >= height)
-                    continue;
+                //the word is stored when it is full or the row ends
+                if (foreground)
+                    word |= 1u << (x % MASK_WORD_PIXELS);
 
-                for (int xx = -SEG_SUB_DIAMETER; xx <= SEG_SUB_DIAMETER; xx++)
+                if (x % MASK_WORD_PIXELS == MASK_WORD_PIXELS - 1 || x == width - 1)
                 {
-                    int subPosX = x + xx;
-                    //check bounds
-                    if (subPosX < 0 || subPosX >= width)
-                        continue;
-
-                    subHist[inputImage[subPosY * width + subPosX].s[0]]++;
+                    outputMask[y * pitch + x / MASK_WORD_PIXELS] = word;
+                    word = 0;
                 }
             }
-            
-            //i have histogram
+            else
+            {
+                outputImage[y * width + x] = foreground ? MAX_BRIGHTNESS : MIN_BRIGHTNESS;
+            }
+        }
+    }
 
-            int mean1 = 0;
-            int mean2 = 0;
-            int newTh = 128;
-            int sum = 0;
-            int count = 0;
+    free(columnHists);
 
-            for (int iter = 0; iter < 15; iter++)
-            {
-                for (int i = 0; i < HISTOGRAM_SIZE; i++)
-                {
-                    if (i <= threshold)
-                    {
-                        //lower part
-                        count += subHist[i];
-                        sum += subHist[i] * i;
-                    
-                        if (i == threshold)
-                        {
-                            //last
-                            if (count == 0)
-                                mean1 = threshold;
-                            else
-                                mean1 = sum / count;
-                            sum = count = 0;
-                        }
-                    }
-                    else
-                    {
-                        //upper part                        
-                        count += subHist[i];
-                        sum += subHist[i] * i;
-                    }
-                }
-                if (count == 0)
-                    mean2 = threshold;
-                else
-                    mean2 = sum / count;
-                sum = count = 0;
+    return 0;
+}
+
+int segmentation(cl_uchar* inputImage, cl_uchar* outputImage, int width, int height)
+{
+    return segmentationPixels(inputImage, outputImage, NULL, width, height);
+}
+
+int segmentationPacked(const cl_uchar* inputImage, cl_uint* outputMask, int width, int height)
+{
+    return segmentationPixels(inputImage, NULL, outputMask, width, height);
+}
 
-                newTh = (mean1 + mean2) / 2;
+int segmentationGrid(const cl_uchar* inputImage, cl_uchar* outputImage, int width, int height, int stride)
+{
+    int gridWidth = segGridSize(width, stride);
+    int gridHeight = segGridSize(height, stride);
 
-                if (abs(newTh - threshold) < 3)
-                    break;
+    cl_uchar* thresholds = (cl_uchar*) malloc((size_t) gridWidth * gridHeight);
+    if (thresholds == NULL)
+        return -1;
 
-                threshold = newTh;
-            }
-            threshold = newTh;
+    //the windows of neighbouring nodes overlap, so the window slides along a row of nodes,
+    //removing the columns left behind and adding the new ones
+    #pragma omp parallel for schedule(dynamic)
+    for (int gy = 0; gy < gridHeight; gy++)
+    {
+        cl_uint subHist[HISTOGRAM_SIZE];
+        int y0 = MAX(gy * stride - SEG_SUB_DIAMETER, 0);
+        int y1 = MIN(gy * stride + SEG_SUB_DIAMETER, height - 1);
 
-            if (threshold < SEG_TH_BORDERS)
-                threshold = SEG_TH_BORDERS;
-            
-            if (threshold > 255 - SEG_TH_BORDERS)
-                threshold = 255 - SEG_TH_BORDERS;
+        //window of the previous node, empty before the first one
+        int x0 = 0;
+        int x1 = -1;
+        memset(subHist, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
 
-            if (inputImage[y * width + x].s[0] <= threshold)
-            {
-                memset(outputImage[y * width + x].s, MIN_BRIGHTNESS, 4); 
-            }
-            else
+        for (int gx = 0; gx < gridWidth; gx++)
+        {
+            int newX0 = MAX(gx * stride - SEG_SUB_DIAMETER, 0);
+            int newX1 = MIN(gx * stride + SEG_SUB_DIAMETER, width - 1);
+
+            for (int y = y0; y <= y1; y++)
             {
-                memset(outputImage[y * width + x].s, MAX_BRIGHTNESS, 4); 
+                const cl_uchar* row = inputImage + (size_t) y * width;
+
+                for (int x = x0; x <= MIN(newX0 - 1, x1); x++)
+                    subHist[row[x]]--;
+                for (int x = MAX(x1 + 1, newX0); x <= newX1; x++)
+                    subHist[row[x]]++;
             }
+
+            x0 = newX0;
+            x1 = newX1;
+
+            thresholds[gy * gridWidth + gx] = (cl_uchar) segmentationThreshold(subHist, HISTOGRAM_SIZE / 2);
+        }
+    }
+
+    //the interpolated threshold is kept scaled by stride * stride, so the comparison is exact
+    #pragma omp parallel for
+    for (int y = 0; y < height; y++)
+    {
+        int gy = y / stride;
+        int fy = y - gy * stride;
+        const cl_uchar* top = thresholds + gy * gridWidth;
+        const cl_uchar* bottom = top + gridWidth;
+
+        for (int x = 0; x < width; x++)
+        {
+            int gx = x / stride;
+            int fx = x - gx * stride;
+
+            int upper = top[gx] * (stride - fx) + top[gx + 1] * fx;
+            int lower = bottom[gx] * (stride - fx) + bottom[gx + 1] * fx;
+            int threshold = upper * (stride - fy) + lower * fy;
+
+            bool foreground = inputImage[(size_t) y * width + x] * stride * stride > threshold;
+            outputImage[(size_t) y * width + x] = foreground ? MAX_BRIGHTNESS : MIN_BRIGHTNESS;
         }
     }
-}
\ No newline at end of file
+
+    free(thresholds);
+
+    return 0;
+}
+
+int integralHistogramBuild(integralHistogram_t* integral, const cl_uchar* inputImage, int pitch, roi_t area, int numBins)
+{
+	integral->width = area.width;
+	integral->height = area.height;
+	integral->numBins = numBins;
+	integral->binShift = binShift(8, numBins);
+
+	size_t rowValues = (size_t) (area.width + 1) * numBins;
+
+	integral->values = (cl_uint*) malloc(rowValues * (area.height + 1) * sizeof(cl_uint));
+	if (integral->values == NULL)
+		return -1;
+
+	memset(integral->values, 0, rowValues * sizeof(cl_uint));
+
+	cl_uint* rowHistogram = (cl_uint*) malloc(numBins * sizeof(cl_uint));
+	if (rowHistogram == NULL)
+	{
+		integralHistogramFree(integral);
+		return -1;
+	}
+
+	for (int y = 0; y < area.height; y++)
+	{
+		const cl_uchar* row = inputImage + (size_t) (area.y + y) * pitch + area.x;
+		const cl_uint* above = integral->values + (size_t) y * rowValues;
+		cl_uint* current = integral->values + (size_t) (y + 1) * rowValues;
+
+		//value at (x, y + 1) is the value above plus the histogram of the row up to x
+		memset(rowHistogram, 0, numBins * sizeof(cl_uint));
+		memset(current, 0, numBins * sizeof(cl_uint));
+
+		for (int x = 0; x < area.width; x++)
+		{
+			rowHistogram[row[x] >> integral->binShift]++;
+
+			const cl_uint* aboveCell = above + (size_t) (x + 1) * numBins;
+			cl_uint* cell = current + (size_t) (x + 1) * numBins;
+
+			for (int b = 0; b < numBins; b++)
+			{
+				cell[b] = aboveCell[b] + rowHistogram[b];
+			}
+		}
+	}
+
+	free(rowHistogram);
+
+	return 0;
+}
+
+void integralHistogramQuery(const integralHistogram_t* integral, roi_t rect, cl_uint* histogram)
+{
+	int numBins = integral->numBins;
+	size_t rowValues = (size_t) (integral->width + 1) * numBins;
+
+	const cl_uint* topLeft = integral->values + (size_t) rect.y * rowValues + (size_t) rect.x * numBins;
+	const cl_uint* topRight = topLeft + (size_t) rect.width * numBins;
+	const cl_uint* bottomLeft = topLeft + (size_t) rect.height * rowValues;
+	const cl_uint* bottomRight = bottomLeft + (size_t) rect.width * numBins;
+
+	for (int b = 0; b < numBins; b++)
+	{
+		histogram[b] = bottomRight[b] - bottomLeft[b] - topRight[b] + topLeft[b];
+	}
+}
+
+void integralHistogramFree(integralHistogram_t* integral)
+{
+	free(integral->values);
+	integral->values = NULL;
+}
+
+/*! Threshold of a window of the integral segmentation from its histogram of numBins bins,
+ *  coarse bins are counted at their middle gray value.
+ */
+static int segmentationIntegralThreshold(const cl_uint* windowHist, cl_uint* subHist, int numBins, int shift, int threshold)
+{
+	if (numBins == HISTOGRAM_SIZE)
+		return segmentationThreshold(windowHist, threshold);
+
+	for (int b = 0; b < numBins; b++)
+	{
+		subHist[(b << shift) + ((1 << shift) >> 1)] = windowHist[b];
+	}
+
+	return segmentationThreshold(subHist, threshold);
+}
+
+/*! Adds the running histograms of one image row to the sliding integral row, or removes them for a negative change.
+ */
+static void segmentationIntegralRow(cl_uint* window, const cl_uchar* row, int width, int numBins, int shift, cl_uint change)
+{
+	cl_uint rowHistogram[HISTOGRAM_SIZE];
+	memset(rowHistogram, 0, numBins * sizeof(cl_uint));
+
+	for (int x = 0; x < width; x++)
+	{
+		rowHistogram[row[x] >> shift] += change;
+
+		cl_uint* cell = window + (size_t) (x + 1) * numBins;
+		for (int b = 0; b < numBins; b++)
+		{
+			cell[b] += rowHistogram[b];
+		}
+	}
+}
+
+/*! Integral segmentation of images too wide for a band of the window height.
+ *  Only one row of the integral histogram is kept, it counts the pixels of the window rows left of every column
+ *  and slides down with the rows, the entering row is added and the leaving row removed.
+ */
+static int segmentationIntegralSliding(const cl_uchar* inputImage, cl_uchar* outputImage, int width, int height, int numBins)
+{
+	cl_uint* window = (cl_uint*) calloc((size_t) (width + 1) * numBins, sizeof(cl_uint));
+	if (window == NULL)
+		return -1;
+
+	cl_uint windowHist[HISTOGRAM_SIZE];
+	cl_uint subHist[HISTOGRAM_SIZE];
+	int threshold = HISTOGRAM_SIZE / 2;
+
+	int shift = binShift(8, numBins);
+	memset(subHist, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	for (int y = 0; y < MIN(SEG_SUB_DIAMETER, height); y++)
+	{
+		segmentationIntegralRow(window, inputImage + (size_t) y * width, width, numBins, shift, 1);
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		if (y + SEG_SUB_DIAMETER < height)
+			segmentationIntegralRow(window, inputImage + (size_t) (y + SEG_SUB_DIAMETER) * width, width, numBins, shift, 1);
+		if (y - SEG_SUB_DIAMETER - 1 >= 0)
+			segmentationIntegralRow(window, inputImage + (size_t) (y - SEG_SUB_DIAMETER - 1) * width, width, numBins, shift, (cl_uint) -1);
+
+		for (int x = 0; x < width; x++)
+		{
+			//window clipped to the image
+			const cl_uint* left = window + (size_t) MAX(0, x - SEG_SUB_DIAMETER) * numBins;
+			const cl_uint* right = window + (size_t) MIN(width, x + SEG_SUB_DIAMETER + 1) * numBins;
+
+			for (int b = 0; b < numBins; b++)
+			{
+				windowHist[b] = right[b] - left[b];
+			}
+
+			threshold = segmentationIntegralThreshold(windowHist, subHist, numBins, shift, threshold);
+
+			outputImage[y * width + x] = (inputImage[y * width + x] <= threshold) ? MIN_BRIGHTNESS : MAX_BRIGHTNESS;
+		}
+	}
+
+	free(window);
+
+	return 0;
+}
+
+int segmentationIntegral(cl_uchar* inputImage, cl_uchar* outputImage, int width, int height, int numBins, size_t maxMemory)
+{
+	//every band is indexed together with the rows of the windows above and below it
+	size_t rowSize = (size_t) (width + 1) * numBins * sizeof(cl_uint);
+	if (rowSize > maxMemory)
+		return -1;
+
+	//bands lower than the window would index every row many times over, one sliding row is cheaper then
+	size_t indexedRows = maxMemory / rowSize;
+	if (indexedRows < 1 + 4 * SEG_SUB_DIAMETER + 1)
+		return segmentationIntegralSliding(inputImage, outputImage, width, height, numBins);
+
+	int bandHeight = (int) MIN(indexedRows - 1 - 2 * SEG_SUB_DIAMETER, (size_t) height);
+
+	cl_uint windowHist[HISTOGRAM_SIZE];
+	cl_uint subHist[HISTOGRAM_SIZE];
+	int threshold = HISTOGRAM_SIZE / 2;
+
+	int shift = binShift(8, numBins);
+	memset(subHist, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	for (int y0 = 0; y0 < height; y0 += bandHeight)
+	{
+		int y1 = MIN(y0 + bandHeight, height);
+
+		roi_t area;
+		area.x = 0;
+		area.y = MAX(0, y0 - SEG_SUB_DIAMETER);
+		area.width = width;
+		area.height = MIN(height, y1 + SEG_SUB_DIAMETER) - area.y;
+
+		integralHistogram_t integral;
+		if (integralHistogramBuild(&integral, inputImage, width, area, numBins) != 0)
+			return -1;
+
+		for (int y = y0; y < y1; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				//window clipped to the image, relative to the band
+				roi_t window;
+				window.x = MAX(0, x - SEG_SUB_DIAMETER);
+				window.y = MAX(0, y - SEG_SUB_DIAMETER);
+				window.width = MIN(width, x + SEG_SUB_DIAMETER + 1) - window.x;
+				window.height = MIN(height, y + SEG_SUB_DIAMETER + 1) - window.y;
+				window.y -= area.y;
+
+				integralHistogramQuery(&integral, window, windowHist);
+
+				threshold = segmentationIntegralThreshold(windowHist, subHist, numBins, shift, threshold);
+
+				if (inputImage[y * width + x] <= threshold)
+				{
+					outputImage[y * width + x] = MIN_BRIGHTNESS; 
+				}
+				else
+				{
+					outputImage[y * width + x] = MAX_BRIGHTNESS; 
+				}
+			}
+		}
+
+		integralHistogramFree(&integral);
+	}
+
+	return 0;
+}
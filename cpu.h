@@ -5,19 +5,508 @@
 #include <vector>
 
 const cl_uint HISTOGRAM_SIZE = 256; 
+const cl_uint HISTOGRAM_CHANNELS = 4; //red, green, blue and luma
+const cl_uint WIDE_MAX_BINS = 65536; //largest bin count of the wide histogram
+const cl_uint CLAHE_CLIP_SCALE = 256; //clip limit of clahe is given in 1/256 of the mean bin height
+const cl_uint OTSU_MAX_CLASSES = 4; //most classes of the multi-level otsu
+const cl_uint MASK_WORD_PIXELS = 32; //pixels in one word of a packed binary mask
+const cl_uint BATCH_TILE_PIXELS = 4096; //pixels of an image of a batch applied by one work-group, the same as in kernels.cl
 
 #define SEG_SUB_DIAMETER 15
 #define SEG_TH_BORDERS 20
+#define SEG_TILE_WIDTH 32 //columns of a tile of the segmentation kernels, one work item per column, the same as in kernels.cl
+#define SEG_TILE_ROWS 32 //rows of a tile of the segmentation kernels, the same as in kernels.cl
+#define SEG_GRID_MAX_STRIDE 16 //largest stride of the approximate segmentation, only the window of a last node no pixel is interpolated from can be empty
+
+/*! Rectangle of an image in pixels.
+ */
+struct roi_t {
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+/*! Histograms of square tiles of a sequence of frames, kept between frames together with a checksum of every tile.
+ */
+struct tileHistogram_t {
+	int width; //frame width
+	int height; //frame height
+	int tileSize; //tile width and height, tiles at the right and bottom border may be smaller
+	int tilesX; //number of tiles in a row
+	int tilesY; //number of tiles in a column
+	cl_uint* tileHistograms; //HISTOGRAM_SIZE values for every tile, row by row
+	cl_uint* checksums; //checksum of every tile of the last frame
+	bool valid; //false until the first frame was counted
+	cl_uint histogram[HISTOGRAM_SIZE]; //histogram of the whole last frame
+};
+
+/*! Integral histogram of a rectangle of an image, histogram of any rectangle inside it is given by four values per bin.
+ *  Value of bin b at (x, y) counts pixels above and to the left of (x, y), the area has one more row and column of zeros.
+ */
+struct integralHistogram_t {
+	int width; //width of the indexed area
+	int height; //height of the indexed area
+	int numBins; //number of bins, a power of two up to HISTOGRAM_SIZE
+	int binShift; //gray value v falls to bin v >> binShift
+	cl_uint* values; //numBins values for every one of (width + 1) * (height + 1) positions
+};
+
+/*! Checksum term of one pixel of a tile, the same as tileChecksumTerm() in kernels.cl.
+ *  Terms of all pixels are added, so a tile can be summed in any order.
+ */
+inline cl_uint tileChecksumTerm(cl_uint indexInTile, cl_uchar value)
+{
+	cl_uint x = (indexInTile << 8) | value;
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+/*! Luma of an rgb pixel, BT.601 weights in 16-bit fixed point, the same as luma() in kernels.cl.
+ */
+inline cl_uchar luma(cl_uchar red, cl_uchar green, cl_uchar blue)
+{
+	return (cl_uchar) ((19595 * red + 38470 * green + 7471 * blue) >> 16);
+}
+
+/*! Number of words of one row of a packed binary mask, the same as maskPitch() in kernels.cl.
+ *  Rows start at whole words, pixel x of a row is the bit x % 32 of the word x / 32 and a set bit is a white pixel.
+ */
+inline int maskPitch(int width)
+{
+	return (width + MASK_WORD_PIXELS - 1) / MASK_WORD_PIXELS;
+}
+
+/*! Number of grid nodes of the approximate segmentation along a side of size pixels, the same as segGridSize() in kernels.cl.
+ *  Node i is at pixel i * stride, the last node lies at or behind the last pixel, so every pixel is between two nodes.
+ */
+inline int segGridSize(int size, int stride)
+{
+	return (size - 1) / stride + 2;
+}
+
+/*! Blue-difference chroma of an rgb pixel, YCbCr of JPEG in 16-bit fixed point, the same as chromaBlue() in kernels.cl.
+ */
+inline cl_uchar chromaBlue(cl_uchar red, cl_uchar green, cl_uchar blue)
+{
+	return (cl_uchar) ((-11059 * red - 21709 * green + 32768 * blue + (128 << 16)) >> 16);
+}
+
+/*! Red-difference chroma of an rgb pixel, YCbCr of JPEG in 16-bit fixed point, the same as chromaRed() in kernels.cl.
+ */
+inline cl_uchar chromaRed(cl_uchar red, cl_uchar green, cl_uchar blue)
+{
+	return (cl_uchar) ((32768 * red - 27439 * green - 5329 * blue + (128 << 16)) >> 16);
+}
+
+/*! Colour channel from a value in 16-bit fixed point, clamped to 0 - 255, the same as fixedToChannel() in kernels.cl.
+ */
+inline cl_uchar fixedToChannel(int value)
+{
+	return (value < 0) ? 0 : (value >= (255 << 16)) ? 255 : (cl_uchar) (value >> 16);
+}
+
+/*! Two neighbouring tiles of clahe along one axis and the weight of the second one, the same as claheNeighbours() in kernels.cl.
+ *  Positions before the center of the first tile and after the center of the last tile use only that tile.
+ *
+ * \param[in] position x or y of the pixel
+ * \param[in] tileSize tile width and height
+ * \param[in] tiles number of tiles along the axis
+ * \param[out] first index of the first tile
+ * \param[out] second index of the second tile
+ * \param[out] weight weight of the second tile, 0 to tileSize - 1, the first one has tileSize - weight
+ */
+inline void claheNeighbours(int position, int tileSize, int tiles, int* first, int* second, int* weight)
+{
+	int offset = position - tileSize / 2;
+
+	if (offset < 0 || offset / tileSize >= tiles - 1)
+	{
+		*first = *second = (offset < 0) ? 0 : tiles - 1;
+		*weight = 0;
+		return;
+	}
+
+	*first = offset / tileSize;
+	*second = *first + 1;
+	*weight = offset % tileSize;
+}
 
 /*! Performs histogram equalization of the input image.
  *
- * \param[in] inputImage input image in grayscale format with 255 levels of gray
- * \param[out] outputImage an equalized input image in grayscale format with 255 levels of gray
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage an equalized input image, one 8-bit gray value per pixel
  * \param[in] histogram histogram of the input image, 255 values
  */
-void histogram(cl_uchar4* inputImage, cl_uint* histogram, int width, int height);
-void equalize(cl_uchar4* inputImage, cl_uchar4* outputImage, cl_uint* histogram, float numberOfPixels);
-void otsu(cl_uchar4* inputImage, cl_uchar4* outputImage, cl_uint* histogram, int width, int height);
-void segmentation(cl_uchar4* inputImage, cl_uchar4* outputImage, int width, int height);
+void histogram(cl_uchar* inputImage, cl_uint* histogram, int width, int height);
+
+/*! Computes histogram of the input image using several interleaved bin arrays, which are merged at the end.
+ *  Pixels are processed in unrolled blocks of 16, so repeated gray levels do not wait for each other.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] histogram resulting histogram, 256 values
+ * \param[in] width input image width
+ * \param[in] height input image height
+ */
+void histogramUnrolled(cl_uchar* inputImage, cl_uint* histogram, int width, int height);
+
+/*! Computes histogram of the input image on several threads.
+ *  Every thread counts its part of the image into a private histogram aligned to a cache line,
+ *  private histograms are then merged pairwise in log2(numThreads) steps.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] histogram resulting histogram, 256 values
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[in] numThreads number of threads to use
+ */
+void histogramParallel(cl_uchar* inputImage, cl_uint* histogram, int width, int height, int numThreads);
+
+/*! Computes red, green, blue and luma histograms of the input image, every pixel is read once.
+ *
+ * \param[in] inputImage input image in rgba format
+ * \param[out] histogram resulting histograms, HISTOGRAM_CHANNELS blocks of 256 values in order red, green, blue, luma
+ * \param[in] width input image width
+ * \param[in] height input image height
+ */
+void histogramRGBL(cl_uchar4* inputImage, cl_uint* histogram, int width, int height);
+
+/*! Computes histogram of a rectangle of the input image, optionally only of the pixels with nonzero mask.
+ *  Rows of the image may be longer than the image width, so a rectangle of a larger buffer is counted without a copy.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[in] pitch number of pixels between the starts of two rows of the image
+ * \param[in] roi counted rectangle, has to lie inside the image
+ * \param[in] mask one 8-bit value per pixel with the same pitch as the image, NULL to count all pixels of the rectangle
+ * \param[out] histogram resulting histogram, 256 values
+ * \return number of counted pixels
+ */
+cl_uint histogramROI(const cl_uchar* inputImage, int pitch, roi_t roi, const cl_uchar* mask, cl_uint* histogram);
+
+/*! Prepares incremental histograms of frames of the given size.
+ *
+ * \param[out] tiles tile histograms to initialize
+ * \param[in] width frame width
+ * \param[in] height frame height
+ * \param[in] tileSize tile width and height, 1 to 256
+ * \return 0 on success, -1 if the memory can not be allocated
+ */
+int tileHistogramInit(tileHistogram_t* tiles, int width, int height, int tileSize);
+
+/*! Updates the histogram of the whole frame from a new frame.
+ *  Only tiles with a changed checksum are counted again, their old counts are subtracted from the histogram and the new ones added.
+ *
+ * \param[in,out] tiles tile histograms of the previous frame
+ * \param[in] inputImage new frame, one 8-bit gray value per pixel
+ * \return number of tiles counted again
+ */
+int tileHistogramUpdate(tileHistogram_t* tiles, const cl_uchar* inputImage);
+
+/*! Frees memory of the tile histograms.
+ */
+void tileHistogramFree(tileHistogram_t* tiles);
+
+/*! Builds the integral histogram of a rectangle of the input image.
+ *
+ * \param[out] integral integral histogram, freed by integralHistogramFree
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[in] pitch number of pixels between the starts of two rows of the image
+ * \param[in] area indexed rectangle of the image
+ * \param[in] numBins number of bins, a power of two up to 256, fewer bins need less memory
+ * \return 0 on success, -1 if the memory can not be allocated
+ */
+int integralHistogramBuild(integralHistogram_t* integral, const cl_uchar* inputImage, int pitch, roi_t area, int numBins);
+
+/*! Computes histogram of a rectangle from the integral histogram.
+ *
+ * \param[in] integral integral histogram
+ * \param[in] rect rectangle relative to the indexed area, has to lie inside it
+ * \param[out] histogram resulting histogram, numBins values
+ */
+void integralHistogramQuery(const integralHistogram_t* integral, roi_t rect, cl_uint* histogram);
+
+/*! Frees memory of the integral histogram.
+ */
+void integralHistogramFree(integralHistogram_t* integral);
+
+/*! Image segmentation by adaptive histogram thresholding, window histograms are taken from integral histograms.
+ *  The image is indexed in horizontal bands, so the integral histogram does not need more than maxMemory bytes.
+ *  When a band of the window height does not fit, a single row of the integral histogram over the window rows
+ *  slides down the image instead. With 256 bins the output is the same as of segmentation(),
+ *  with fewer bins every bin is counted at its middle gray value.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage segmented image
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[in] numBins number of bins of the integral histogram, a power of two up to 256
+ * \param[in] maxMemory memory for the integral histogram in bytes
+ * \return 0 on success, -1 if the memory can not be allocated or one row of the integral histogram needs more than maxMemory
+ */
+int segmentationIntegral(cl_uchar* inputImage, cl_uchar* outputImage, int width, int height, int numBins, size_t maxMemory);
+
+/*! Computes histogram of an image with samples of up to 16 bits.
+ *  Sample v falls to bin v >> (bitDepth - log2(numBins)).
+ *
+ * \param[in] inputImage input image, one sample per pixel
+ * \param[out] histogram resulting histogram, numBins values
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[in] bitDepth number of bits per sample, 1 to 16
+ * \param[in] numBins number of bins, a power of two not larger than 2^bitDepth
+ */
+void histogramWide(const cl_ushort* inputImage, cl_uint* histogram, int width, int height, int bitDepth, cl_uint numBins);
+
+/*! Adds samples of up to 16 bits to the histogram, used for images processed in parts.
+ *
+ * \param[in] samples input samples
+ * \param[in] count number of samples
+ * \param[in,out] histogram histogram to add to
+ * \param[in] shift shift of a sample to its bin, see binShift()
+ */
+void histogramWideAccumulate(const cl_ushort* samples, size_t count, cl_uint* histogram, int shift);
+
+/*! Computes the new sample value of every bin for the histogram equalization, used by equalizeWide().
+ *
+ * \param[in] histogram histogram of the input image, numBins values
+ * \param[in] bitDepth number of bits per sample
+ * \param[in] numBins number of bins of the histogram
+ * \param[out] newValues new sample value for every bin
+ */
+void equalizeWideLUT(const cl_uint* histogram, int bitDepth, cl_uint numBins, cl_ushort* newValues);
+
+/*! Computes the Otsu threshold and the new sample value of every bin, used by otsuWide().
+ *
+ * \param[in] histogram histogram of the input image, numBins values
+ * \param[in] bitDepth number of bits per sample
+ * \param[in] numBins number of bins of the histogram
+ * \param[out] newValues 2^bitDepth - 1 for the bins above the threshold bin, 0 for the others
+ * \return the threshold bin
+ */
+cl_uint otsuWideLUT(const cl_uint* histogram, int bitDepth, cl_uint numBins, cl_ushort* newValues);
+
+/*! Replaces every sample by the new value of its bin.
+ *
+ * \param[in] inputImage input samples
+ * \param[out] outputImage output samples
+ * \param[in] count number of samples
+ * \param[in] newValues new sample value for every bin
+ * \param[in] shift shift of a sample to its bin, see binShift()
+ */
+void applyWideLUT(const cl_ushort* inputImage, cl_ushort* outputImage, size_t count, const cl_ushort* newValues, int shift);
+
+/*! Performs histogram equalization of an image with samples of up to 16 bits, all samples of one bin get the same value.
+ *
+ * \param[in] inputImage input image, one sample per pixel
+ * \param[out] outputImage equalized image with the same bit depth
+ * \param[in] histogram histogram of the input image, numBins values
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[in] bitDepth number of bits per sample
+ * \param[in] numBins number of bins of the histogram
+ */
+void equalizeWide(const cl_ushort* inputImage, cl_ushort* outputImage, const cl_uint* histogram, int width, int height, int bitDepth, cl_uint numBins);
+
+/*! Otsu thresholding of an image with samples of up to 16 bits.
+ *  Samples in the bins above the threshold bin become 2^bitDepth - 1, others 0.
+ *
+ * \param[in] inputImage input image, one sample per pixel
+ * \param[out] outputImage thresholded image with the same bit depth
+ * \param[in] histogram histogram of the input image, numBins values
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[in] bitDepth number of bits per sample
+ * \param[in] numBins number of bins of the histogram
+ * \return the threshold bin
+ */
+cl_uint otsuWide(const cl_ushort* inputImage, cl_ushort* outputImage, const cl_uint* histogram, int width, int height, int bitDepth, cl_uint numBins);
+
+/*! Returns log2(numBins) subtracted from bitDepth, shift of a sample to its bin.
+ */
+int binShift(int bitDepth, cl_uint numBins);
+
+/*! Returns the number of threads available to the CPU implementations.
+ */
+int cpuThreadCount();
+
+/*! Computes the new pixel value of every gray level for the histogram equalization, used by equalize().
+ *  Integer arithmetic, bit-exact with equalize1 in kernels.cl.
+ *
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[out] newValues new pixel value for every gray level, 256 values
+ */
+void equalizeLUT(const cl_uint* histogram, cl_uchar* newValues);
+
+/*! Computes the cumulative histogram.
+ *
+ * \param[in] histogram histogram, 256 values
+ * \param[out] cumulative sums of the histogram up to every bin, 256 values
+ */
+void cumulativeHistogram(const cl_uint* histogram, cl_uint* cumulative);
+
+/*! Computes the new pixel value of every gray level for the histogram matching, used by matchHistogram().
+ *  A gray level gets the smallest reference level with at least the same share of pixels up to it, the same as match1 in kernels.cl.
+ *
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[in] referenceCumulative cumulative histogram of the reference image, see cumulativeHistogram(), it must not be empty
+ * \param[out] newValues new pixel value for every gray level, 256 values
+ */
+void matchLUT(const cl_uint* histogram, const cl_uint* referenceCumulative, cl_uchar* newValues);
+
+/*! Replaces every pixel by its new value, split among the threads.
+ *  Uses AVX2 byte shuffles when the CPU supports them.
+ *
+ * \param[in] inputImage input pixels, one 8-bit gray value per pixel
+ * \param[out] outputImage output pixels
+ * \param[in] count number of pixels
+ * \param[in] newValues new pixel value for every gray level, 256 values
+ */
+void applyLUT(const cl_uchar* inputImage, cl_uchar* outputImage, size_t count, const cl_uchar* newValues);
+void equalize(cl_uchar* inputImage, cl_uchar* outputImage, cl_uint* histogram, int width, int height);
+
+/*! Histogram matching (specification), the input image gets the histogram of the reference image as close as possible.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage matched image, one 8-bit gray value per pixel
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[in] referenceCumulative cumulative histogram of the reference image, computed once for all matched images
+ * \param[in] width input image width
+ * \param[in] height input image height
+ */
+void matchHistogram(const cl_uchar* inputImage, cl_uchar* outputImage, const cl_uint* histogram, const cl_uint* referenceCumulative, int width, int height);
+
+/*! Histogram equalization of a colour image which keeps its chroma.
+ *  Every pixel is converted to YCbCr, only the luma gets the new value and the pixel is converted back in the same pass.
+ *
+ * \param[in] inputImage input image in rgba format
+ * \param[out] outputImage equalized image in rgba format, alpha is kept
+ * \param[in] histogram histogram of the luma of the input image, see luma(), 256 values
+ * \param[in] width input image width
+ * \param[in] height input image height
+ */
+void equalizeColor(const cl_uchar4* inputImage, cl_uchar4* outputImage, const cl_uint* histogram, int width, int height);
+
+/*! Clips a tile histogram of clahe and spreads the clipped pixels evenly over all bins, the same as claheTiles in kernels.cl.
+ *
+ * \param[in,out] histogram tile histogram, 256 values
+ * \param[in] pixels number of pixels of the tile
+ * \param[in] clipLimit largest bin height in 1/CLAHE_CLIP_SCALE of the mean bin height, at least 1 pixel
+ */
+void claheClip(cl_uint* histogram, cl_uint pixels, cl_uint clipLimit);
+
+/*! Contrast-limited adaptive histogram equalization.
+ *  Every tile is equalized by its clipped histogram, pixels get a bilinear interpolation of the new values of the four nearest tiles.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage equalized image, one 8-bit gray value per pixel
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[in] tileSize tile width and height, at most 1024
+ * \param[in] clipLimit largest bin height in 1/CLAHE_CLIP_SCALE of the mean bin height
+ * \return 0 on success, -1 if memory could not be allocated
+ */
+int clahe(const cl_uchar* inputImage, cl_uchar* outputImage, int width, int height, int tileSize, cl_uint clipLimit);
+
+/*! Computes the Otsu threshold of a histogram, the same as the threshold kernel in kernels.cl.
+ *  Statistics of the classes are exact, only the between-class variance is in float.
+ *
+ * \param[in] histogram histogram of the input image, 256 values
+ * \return threshold, pixels above it are the foreground
+ */
+cl_uint otsuThreshold(const cl_uint* histogram);
+void otsu(cl_uchar* inputImage, cl_uchar* outputImage, cl_uint* histogram, int width, int height);
+
+/*! Otsu thresholding to a packed binary mask, the same pixels are set as are white in the output of otsu().
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputMask packed mask, maskPitch(width) words per row
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[in] width input image width
+ * \param[in] height input image height
+ */
+void otsuPacked(const cl_uchar* inputImage, cl_uint* outputMask, const cl_uint* histogram, int width, int height);
+
+/*! Computes the thresholds of the multi-level Otsu method, the same as the thresholdMulti kernel in kernels.cl.
+ *  Class statistics come from cumulative count and moment tables, so every tuple of thresholds costs O(1).
+ *
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[in] classes number of classes, from 2 to OTSU_MAX_CLASSES
+ * \param[out] thresholds classes - 1 increasing thresholds, class j ends with the bin thresholds[j]
+ */
+void otsuMultiThresholds(const cl_uint* histogram, int classes, cl_uint* thresholds);
+
+/*! Multi-level Otsu, every pixel gets the level of its class, spread evenly from black to white.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage labelled image, one 8-bit gray value per pixel
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[in] classes number of classes, from 2 to OTSU_MAX_CLASSES
+ * \param[out] thresholds classes - 1 thresholds found by otsuMultiThresholds()
+ */
+void otsuMulti(cl_uchar* inputImage, cl_uchar* outputImage, const cl_uint* histogram, int width, int height, int classes, cl_uint* thresholds);
+
+/*! Segmentation by adaptive histogram thresholding in a window of 2 * SEG_SUB_DIAMETER + 1 pixels around every pixel.
+ *  The window histogram slides over the image, the cost per pixel does not depend on the window size.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage segmented image, one 8-bit gray value per pixel
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \return 0 on success, -1 if memory could not be allocated
+ */
+int segmentation(cl_uchar* inputImage, cl_uchar* outputImage, int width, int height);
+
+/*! Segmentation to a packed binary mask, the same pixels are set as are white in the output of segmentation().
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputMask packed mask, maskPitch(width) words per row
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \return 0 on success, -1 if memory could not be allocated
+ */
+int segmentationPacked(const cl_uchar* inputImage, cl_uint* outputMask, int width, int height);
+
+/*! Approximate segmentation, thresholds are found only in the windows of a grid of nodes every stride pixels
+ *  and the threshold of every pixel is bilinearly interpolated from the four nodes around it.
+ *  Every node starts from the threshold 128, the same as the segmentation kernel.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage segmented image, one 8-bit gray value per pixel
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[in] stride distance of the grid nodes in pixels, from 1 to SEG_GRID_MAX_STRIDE
+ * \return 0 on success, -1 if memory could not be allocated
+ */
+int segmentationGrid(const cl_uchar* inputImage, cl_uchar* outputImage, int width, int height, int stride);
+
+/*! Unpacks a packed binary mask to black and white pixels, for display and export only.
+ *
+ * \param[in] mask packed mask, maskPitch(width) words per row
+ * \param[out] outputImage one 8-bit gray value per pixel
+ * \param[in] width image width
+ * \param[in] height image height
+ */
+void unpackMask(const cl_uint* mask, cl_uchar* outputImage, int width, int height);
+
+/*! Equalization of a batch of images packed one after another into one buffer, the same as the batch kernels in kernels.cl.
+ *  Every entry of the table holds the offset of the first pixel, the width and the height of one image.
+ *
+ * \param[in] images gray values of all images, one 8-bit value per pixel
+ * \param[in] table offset, width and height of every image
+ * \param[in] count number of images
+ * \param[out] outputImages equalized images at the offsets of the input images
+ * \param[out] histograms 256 values for every image
+ */
+void equalizeBatch(const cl_uchar* images, const cl_uint4* table, int count, cl_uchar* outputImages, cl_uint* histograms);
+
+/*! Otsu thresholding of a batch of images packed into one buffer, the same as equalizeBatch() with the threshold of every image.
+ */
+void otsuBatch(const cl_uchar* images, const cl_uint4* table, int count, cl_uchar* outputImages, cl_uint* histograms);
 
 #endif
\ No newline at end of file
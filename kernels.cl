@@ -3,17 +3,76 @@
 
 __constant uint HISTOGRAM_SIZE = 256;
 __constant uint SIZE_OF_BLOCK = 16;
+__constant uint HISTOGRAM_COPIES = 8; //number of local histogram copies in histogram3
+__constant uint HISTOGRAM_CHANNELS = 4; //red, green, blue and luma
+__constant uint WIDE_LOCAL_BINS = 4096; //number of bins of histogramWide counted in local memory at once
+__constant uint WIDE_BUCKETS = 256; //buckets of the high bits of the bin of histogramWide with more than WIDE_LOCAL_BINS bins
+__constant uint WIDE_PIXELS_PER_ITEM = 4; //samples of one chunk of histogramWide read by every work item
+__constant uint WIDE_SLOT_NONE = 0xFFFFFFFF; //bucket without any sample yet
+__constant uint WIDE_SLOT_NEW = 0xFFFFFFFE; //bucket with samples in the current chunk, waiting for a slot
+__constant uint WIDE_SLOT_GLOBAL = 0xFFFFFFFD; //bucket counted straight to global memory, all slots were taken
+__constant uint CLAHE_CLIP_SCALE = 256; //clip limit of clahe is given in 1/256 of the mean bin height
+#define OTSU_MAX_CLASSES 4 //most classes of the multi-level otsu, the same as in cpu.h
+#define MASK_WORD_PIXELS 32 //pixels in one word of a packed binary mask, the same as in cpu.h
+#define SEG_SUB_DIAMETER 15 //the segmentation window has 2 * SEG_SUB_DIAMETER + 1 pixels per side, the same as in cpu.h
+#define SEG_TH_BORDERS 20 //the same as in cpu.h
+#define SEG_TILE_WIDTH 32 //columns of a segmentation tile, one work item per column, the same as in cpu.h
+#define SEG_TILE_ROWS 32 //rows of a segmentation tile, the same as in cpu.h
+#define SEG_APRON_WIDTH (SEG_TILE_WIDTH + 2 * SEG_SUB_DIAMETER)
+#define SEG_APRON_ROWS (SEG_TILE_ROWS + 2 * SEG_SUB_DIAMETER)
+#define BATCH_TILE_PIXELS 4096 //pixels of an image of a batch applied by one work-group, the same as in cpu.h
 
-/*! Computes histogram of the input image in grayscale format with 255 levels of gray.
+/*! Luma of an rgb pixel, BT.601 weights in 16-bit fixed point, the same as luma() in cpu.h.
+ */
+uchar luma(uchar4 pixel)
+{
+	return (19595 * pixel.x + 38470 * pixel.y + 7471 * pixel.z) >> 16;
+}
+
+/*! Blue-difference chroma of an rgb pixel, YCbCr of JPEG in 16-bit fixed point, the same as chromaBlue() in cpu.h.
+ */
+int chromaBlue(uchar4 pixel)
+{
+	return (-11059 * pixel.x - 21709 * pixel.y + 32768 * pixel.z + (128 << 16)) >> 16;
+}
+
+/*! Red-difference chroma of an rgb pixel, YCbCr of JPEG in 16-bit fixed point, the same as chromaRed() in cpu.h.
+ */
+int chromaRed(uchar4 pixel)
+{
+	return (32768 * pixel.x - 27439 * pixel.y - 5329 * pixel.z + (128 << 16)) >> 16;
+}
+
+/*! Colour channel from a value in 16-bit fixed point, clamped to 0 - 255, the same as fixedToChannel() in cpu.h.
+ */
+uchar fixedToChannel(int value)
+{
+	return (uchar) (clamp(value, 0, 255 << 16) >> 16);
+}
+
+/*! Checksum term of one pixel of a tile, the same as tileChecksumTerm() in cpu.h.
+ */
+uint tileChecksumTerm(uint indexInTile, uchar value)
+{
+	uint x = (indexInTile << 8) | value;
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+/*! Computes histogram of the input image, one 8-bit gray value per pixel.
  *
- * \param[in] inputImage input image in grayscale format with 255 levels of gray
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
  * \param[in] width input image width
  * \param[in] height input image height
  * \param[out] histogram resulting histogram, an array of 255 integer values
  * \param[in] cache used for histogram values of a workgroup
  */
  
- __kernel void histogram1( __global uchar4* inputImage, uint width, uint height, __global uint* histogram, __local uint* cache)
+ __kernel void histogram1( __global uchar* inputImage, uint width, uint height, __global uint* histogram, __local uint* cache)
 {
     //two dimensional matrix of work items
 	int globalX = get_global_id(0);
@@ -44,7 +103,7 @@ __constant uint SIZE_OF_BLOCK = 16;
 
 	if (globalX < width && globalY < height) //check if we are out of bounds
 	{
-	    int value = inputImage[globalY * width + globalX].x; //current pixel value
+	    int value = inputImage[globalY * width + globalX]; //current pixel value
 
 		atomic_inc(&cache[value]); //updating cache
 		//cache[value]++;
@@ -64,310 +123,1835 @@ __constant uint SIZE_OF_BLOCK = 16;
 	} 
 }
 
-__kernel void histogram2a(__global uchar4* inputImage, __local uchar* sharedArray, __global uint* subHistograms, uint width, uint height)
+/*! Sets all values of the histogram to zero, one work item per value.
+ *
+ * \param[out] histogram histogram to be cleared
+ * \param[in] numBins number of values in the histogram
+ */
+__kernel void clearHistogram(__global uint* histogram, uint numBins)
 {
-	size_t localId = get_local_id(0);
-    size_t globalId = get_global_id(0);
-    size_t groupId = get_group_id(0);
-    size_t groupSize = get_local_size(0);
+	uint globalX = get_global_id(0);
 
-    
+	if (globalX < numBins)
+	{
+		histogram[globalX] = 0;
+	}
+}
 
-    for(int i = 0; i < HISTOGRAM_SIZE; ++i)
-        sharedArray[localId * HISTOGRAM_SIZE + i] = 0;
+/*! Computes histogram of the input image, the histogram has to be cleared by clearHistogram first.
+ *  The number of work groups is derived from the number of compute units, so every work item loops over the image
+ *  with the stride of the whole grid, four pixels at a time. Work items of a group count to several copies of the local histogram,
+ *  which are then added to the global histogram by all local workers together.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[out] histogram resulting histogram, an array of 256 integer values
+ * \param[in] cache used for HISTOGRAM_COPIES local histograms of a workgroup
+ */
+__kernel void histogram3(__global uchar* inputImage, uint width, uint height, __global uint* histogram, __local uint* cache)
+{
+	uint globalId = get_global_id(0);
+	uint globalSize = get_global_size(0);
+	uint localId = get_local_id(0);
+	uint localSize = get_local_size(0);
 
-    barrier(CLK_LOCAL_MEM_FENCE);
-    
-    for(int i = 0; i < HISTOGRAM_SIZE; ++i)
-    {
-        if (globalId < ((width * height) / HISTOGRAM_SIZE))
-        {
-            uint value = inputImage[globalId * HISTOGRAM_SIZE + i].x;
-            sharedArray[localId * HISTOGRAM_SIZE + value]++;
-        }
-    }
-    
-    barrier(CLK_LOCAL_MEM_FENCE); 
-    
-    for(int i = 0; i < HISTOGRAM_SIZE / groupSize; ++i)
-    {
-        uint binCount = 0;
-        for(int j = 0; j < groupSize; ++j)
-            binCount += sharedArray[j * HISTOGRAM_SIZE + i * groupSize + localId];
-            
-        subHistograms[groupId * HISTOGRAM_SIZE + i * groupSize + localId] = binCount;
-    }
-	
-	return;
+	uint numberOfPixels = width * height;
+	uint numberOfQuads = numberOfPixels / 4;
+
+	//all local workers initialize cache data
+	for (uint i = localId; i < HISTOGRAM_COPIES * HISTOGRAM_SIZE; i += localSize)
+	{
+		cache[i] = 0;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	__local uint* copy = cache + (localId % HISTOGRAM_COPIES) * HISTOGRAM_SIZE; //local histogram of this worker
+
+	for (uint i = globalId; i < numberOfQuads; i += globalSize)
+	{
+		uchar4 values = vload4(i, inputImage);
+
+		atomic_inc(&copy[values.x]);
+		atomic_inc(&copy[values.y]);
+		atomic_inc(&copy[values.z]);
+		atomic_inc(&copy[values.w]);
+	}
+
+	//remaining pixels
+	if (numberOfQuads * 4 + globalId < numberOfPixels)
+	{
+		atomic_inc(&copy[inputImage[numberOfQuads * 4 + globalId]]);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//all local workers add the results from cache to global memory
+	for (uint i = localId; i < HISTOGRAM_SIZE; i += localSize)
+	{
+		uint binCount = 0;
+
+		for (uint j = 0; j < HISTOGRAM_COPIES; j++)
+		{
+			binCount += cache[j * HISTOGRAM_SIZE + i];
+		}
+
+		if (binCount > 0)
+		{
+			atomic_add(&histogram[i], binCount);
+		}
+	}
 }
 
-__kernel void histogram2b(__global uint* subHistograms, __global uint* histogram, uint numSubHistograms)
+/*! Computes red, green, blue and luma histograms of the input image in one pass, the histogram has to be cleared by clearHistogram first.
+ *  Work items loop over the image with the stride of the whole grid like in histogram3, every pixel is read once.
+ *
+ * \param[in] inputImage input image in rgba format
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[out] histogram resulting histograms, HISTOGRAM_CHANNELS blocks of 256 values in order red, green, blue, luma
+ * \param[in] cache used for the histograms of a workgroup
+ */
+__kernel void histogramRGBL(__global uchar4* inputImage, uint width, uint height, __global uint* histogram, __local uint* cache)
 {
-    int globalX = get_global_id(0);
+	uint globalId = get_global_id(0);
+	uint globalSize = get_global_size(0);
+	uint localId = get_local_id(0);
+	uint localSize = get_local_size(0);
 
-    for(int i = 0; i < numSubHistograms; i++)
-    {
-	    histogram[globalX] += subHistograms[i * HISTOGRAM_SIZE + globalX];
+	uint numberOfPixels = width * height;
+
+	for (uint i = localId; i < HISTOGRAM_CHANNELS * HISTOGRAM_SIZE; i += localSize)
+	{
+		cache[i] = 0;
 	}
-}
 
+	barrier(CLK_LOCAL_MEM_FENCE);
 
+	for (uint i = globalId; i < numberOfPixels; i += globalSize)
+	{
+		uchar4 pixel = inputImage[i];
 
+		atomic_inc(&cache[pixel.x]);
+		atomic_inc(&cache[HISTOGRAM_SIZE + pixel.y]);
+		atomic_inc(&cache[2 * HISTOGRAM_SIZE + pixel.z]);
+		atomic_inc(&cache[3 * HISTOGRAM_SIZE + luma(pixel)]);
+	}
 
-/*! First part of the histogram equalization, determines a new pixel value for each possible pixel value in the input image.
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = localId; i < HISTOGRAM_CHANNELS * HISTOGRAM_SIZE; i += localSize)
+	{
+		if (cache[i] > 0)
+		{
+			atomic_add(&histogram[i], cache[i]);
+		}
+	}
+}
+
+/*! Computes histogram of the luma of a colour image, the histogram has to be cleared by clearHistogram first.
+ *  Work items loop over the image with the stride of the whole grid like in histogramRGBL.
  *
- * \param[in] histogram histogram of the input image, 255 values
- * \param[out] newValues an array of 255 values, each value represents a new pixel value for a pixel value given by its index
+ * \param[in] inputImage input image in rgba format
+ * \param[in] numberOfPixels number of pixels of the input image
+ * \param[out] histogram resulting histogram, 256 values
+ * \param[in] cache used for the histogram of a workgroup
  */
-__kernel void equalize1(__global uint* histogram, __global uint* newValues)
+__kernel void histogramLuma(__global uchar4* inputImage, uint numberOfPixels, __global uint* histogram, __local uint* cache)
 {
-    //one dimensional matrix of work items
-	uint globalX = get_global_id(0);
-	uint localX = get_local_id(0);
-	
-	//first worker computes the cumulative histogram
-	if (globalX == 0 && localX == 0)
+	uint globalId = get_global_id(0);
+	uint globalSize = get_global_size(0);
+	uint localId = get_local_id(0);
+	uint localSize = get_local_size(0);
+
+	for (uint i = localId; i < HISTOGRAM_SIZE; i += localSize)
 	{
-	    newValues[0] = histogram[0];
-	    for (int i = 1; i < HISTOGRAM_SIZE; i++)
-	    {
-	        newValues[i] = newValues[i-1] + histogram[i];
-	    }
+		cache[i] = 0;
 	}
-	
-	//wait for the first worker to finish
-	barrier(CLK_GLOBAL_MEM_FENCE);
-	
-	float numberOfPixels = newValues[HISTOGRAM_SIZE-1]; //number of pixels in the input image is the last value in the cumulative histogram
-	newValues[globalX] *= HISTOGRAM_SIZE / numberOfPixels; //computing final output
 
-	return;
-}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = globalId; i < numberOfPixels; i += globalSize)
+	{
+		atomic_inc(&cache[luma(inputImage[i])]);
+	}
 
+	barrier(CLK_LOCAL_MEM_FENCE);
 
+	for (uint i = localId; i < HISTOGRAM_SIZE; i += localSize)
+	{
+		if (cache[i] > 0)
+		{
+			atomic_add(&histogram[i], cache[i]);
+		}
+	}
+}
 
-/*! Second part of the histogram equalization, creates an output image from the input image using the output from the first part.
+/*! Computes histogram of a rectangle of the input image, the histogram has to be cleared by clearHistogram first.
+ *  Work items of a row read consecutive pixels of the rectangle and loop over its rows with the stride of the grid,
+ *  pixels with zero mask are skipped. Rows of the image may be longer than the image width.
  *
- * \param[in] inputImage input image in grayscale format with 255 levels of gray
- * \param[out] outputImage an equalized input image in grayscale format with 255 levels of gray
- * \param[in] newValues an array of 255 values, each value represents a new pixel value for a pixel value given by its index
- * \param[in] width width of the input image
- * \param[in] height height of the input image
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[in] pitch number of pixels between the starts of two rows of the image
+ * \param[in] roiX left column of the rectangle
+ * \param[in] roiY top row of the rectangle
+ * \param[in] roiWidth width of the rectangle
+ * \param[in] roiHeight height of the rectangle
+ * \param[in] mask one 8-bit value per pixel with the same pitch as the image, NULL to count all pixels of the rectangle
+ * \param[out] histogram resulting histogram, an array of 256 integer values
+ * \param[in] cache used for histogram values of a workgroup
  */
-__kernel void equalize2(__global uchar4* inputImage, __global uchar4* outputImage, __global uint* newValues, uint width, uint height)
+__kernel void histogramROI(__global uchar* inputImage, uint pitch, uint roiX, uint roiY, uint roiWidth, uint roiHeight,
+						   __global uchar* mask, __global uint* histogram, __local uint* cache)
 {
-    //two dimensional matrix of work items
-    uint globalX = get_global_id(0);
-	uint globalY = get_global_id(1);
-	
-	if (globalX < width && globalY < height) //chceck if we are out of bounds
+	uint globalX = get_global_id(0);
+	uint localId = get_local_id(1) * get_local_size(0) + get_local_id(0);
+	uint localSize = get_local_size(0) * get_local_size(1);
+
+	for (uint i = localId; i < HISTOGRAM_SIZE; i += localSize)
 	{
-        uchar newValue = newValues[inputImage[globalY * width + globalX].x]; //get new value for current pixel
-		outputImage[globalY * width + globalX] = (newValue, newValue, newValue, newValue); //write the new value to the output image
+		cache[i] = 0;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (globalX < roiWidth)
+	{
+		for (uint y = get_global_id(1); y < roiHeight; y += get_global_size(1))
+		{
+			uint index = (roiY + y) * pitch + roiX + globalX;
+
+			if (mask == 0 || mask[index] != 0)
+			{
+				atomic_inc(&cache[inputImage[index]]);
+			}
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = localId; i < HISTOGRAM_SIZE; i += localSize)
+	{
+		if (cache[i] > 0)
+		{
+			atomic_add(&histogram[i], cache[i]);
+		}
 	}
-	
-	return;
 }
 
-__kernel void threshold(__constant uint* histogram, __global ulong* sumHistogram)
+/*! Updates the histogram of a frame from the tile histograms of the previous frame, one work group per tile.
+ *  The group sums the checksum of its tile and counts the tile again only if the checksum changed,
+ *  into a single local histogram of 256 bins with atomics, no per-work-item copies are kept.
+ *  The difference of the new and old tile histogram is then added to the histogram.
+ *  Tile histograms and the histogram have to be cleared by clearHistogram before the first frame.
+ *
+ * \param[in] inputImage new frame, one 8-bit gray value per pixel
+ * \param[in] width frame width
+ * \param[in] height frame height
+ * \param[in] tileSize tile width and height
+ * \param[in] forceUpdate nonzero to count all tiles, used for the first frame
+ * \param[in,out] checksums checksum of every tile of the last frame
+ * \param[in,out] tileHistograms 256 values for every tile of the last frame
+ * \param[in,out] histogram histogram of the last frame, 256 values
+ * \param[out] changedTiles incremented for every tile counted again
+ * \param[in] cache local memory for the histogram of the tile, 256 values
+ * \param[in] partialChecksums local memory for the checksums of all work items
+ */
+__kernel void tileHistogramUpdate(__global uchar* inputImage, uint width, uint height, uint tileSize, uint forceUpdate,
+								  __global uint* checksums, __global uint* tileHistograms, __global uint* histogram, __global uint* changedTiles,
+								  __local uint* cache, __local uint* partialChecksums)
 {
-	int gid = get_local_id(0);
-
-    local ulong sum[16];
-    sum[gid] = 0;
-	local ulong total[16];
-	total[gid] = 0;
+	uint localX = get_local_id(0);
+	uint localY = get_local_id(1);
+	uint sizeX = get_local_size(0);
+	uint sizeY = get_local_size(1);
+	uint localId = localY * sizeX + localX;
+	uint localSize = sizeX * sizeY;
 
-	float sumB = 0, varMax = 0, varBetween;
-	long wB = 0,  wF = 0, threshold = 0;
-	float mB, mF; 
+	uint tile = get_group_id(1) * get_num_groups(0) + get_group_id(0);
+	uint x0 = get_group_id(0) * tileSize;
+	uint y0 = get_group_id(1) * tileSize;
+	uint tileWidth = min(tileSize, width - x0);
+	uint tileHeight = min(tileSize, height - y0);
 
-    int i;
+	//read before the first barrier, the first worker overwrites it at the end
+	uint oldChecksum = checksums[tile];
 
-	for(i = gid*SIZE_OF_BLOCK; i < (gid*SIZE_OF_BLOCK)+SIZE_OF_BLOCK; i++)
+	uint checksum = 0;
+	for (uint y = localY; y < tileHeight; y += sizeY)
 	{
-		sum[gid] += i * histogram[i];
-		total[gid] += histogram[i];
+		for (uint x = localX; x < tileWidth; x += sizeX)
+		{
+			checksum += tileChecksumTerm(y * tileSize + x, inputImage[(y0 + y) * width + x0 + x]);
+		}
 	}
+
+	partialChecksums[localId] = checksum;
+
 	barrier(CLK_LOCAL_MEM_FENCE);
 
-	if(gid == 0){
-        for(i = 1; i < SIZE_OF_BLOCK; i++){
-            sum[0] += sum[i];
-			total[0] += total[i];
-        }
+	//local size is a power of two
+	for (uint stride = localSize / 2; stride > 0; stride /= 2)
+	{
+		if (localId < stride)
+		{
+			partialChecksums[localId] += partialChecksums[localId + stride];
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	checksum = partialChecksums[0];
 
-		for (i = 0 ; i < 256; i++) {
+	//the same decision for the whole group
+	if (!forceUpdate && checksum == oldChecksum)
+		return;
 
-			wB += histogram[i];             // Weight Background
-      
-			if (wB == 0) 
-				continue;
+	for (uint i = localId; i < HISTOGRAM_SIZE; i += localSize)
+	{
+		cache[i] = 0;
+	}
 
-			wF = total[0] - wB;           // Weight Foreground
-			if (wF == 0) 
-				break;
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-			sumB += (i * histogram[i]);
+	for (uint y = localY; y < tileHeight; y += sizeY)
+	{
+		for (uint x = localX; x < tileWidth; x += sizeX)
+		{
+			atomic_inc(&cache[inputImage[(y0 + y) * width + x0 + x]]);
+		}
+	}
 
-			mB = sumB / wB;            // Mean Background 
-			mF = (sum[0] - sumB) / wF;    // Mean Foreground
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-			// Calculate Between Class Variance 
-			varBetween = wB * wF * (mB - mF) * (mB - mF);
+	__global uint* tileHistogram = tileHistograms + tile * HISTOGRAM_SIZE;
 
-			// Check if new maximum found 
-			if (varBetween > varMax) {
-				varMax = varBetween;
-				threshold = i+1;
-			}
+	for (uint i = localId; i < HISTOGRAM_SIZE; i += localSize)
+	{
+		uint count = cache[i];
+		uint oldCount = tileHistogram[i];
+
+		if (count != oldCount)
+		{
+			atomic_add(&histogram[i], count - oldCount); //wraps around for a decrease
+			tileHistogram[i] = count;
 		}
-		sumHistogram[0] = threshold;
 	}
-	
+
+	if (localId == 0)
+	{
+		checksums[tile] = checksum;
+		atomic_inc(changedTiles);
+	}
+}
+
+/*! First part of the two-pass histogram, computes one sub-histogram for every work group.
+ *  Every work group counts a continuous part of pixelsPerGroup pixels, consecutive work items read consecutive pixels.
+ *  The last group may get fewer pixels, so any image size is handled.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[in] sharedArray local histogram of the work group, 256 values
+ * \param[out] subHistograms resulting sub-histograms, 256 values for every work group
+ * \param[in] width input image width
+ * \param[in] height input image height
+ * \param[in] pixelsPerGroup number of pixels counted by one work group
+ */
+__kernel void histogram2a(__global uchar* inputImage, __local uint* sharedArray, __global uint* subHistograms, uint width, uint height, uint pixelsPerGroup)
+{
+	uint localId = get_local_id(0);
+    uint groupId = get_group_id(0);
+    uint groupSize = get_local_size(0);
+
+	uint numberOfPixels = width * height;
+	uint first = groupId * pixelsPerGroup;
+	uint last = min(first + pixelsPerGroup, numberOfPixels);
+
+    for (uint i = localId; i < HISTOGRAM_SIZE; i += groupSize)
+        sharedArray[i] = 0;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint i = first + localId; i < last; i += groupSize)
+    {
+        atomic_inc(&sharedArray[inputImage[i]]);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint i = localId; i < HISTOGRAM_SIZE; i += groupSize)
+        subHistograms[groupId * HISTOGRAM_SIZE + i] = sharedArray[i];
 
 	return;
 }
 
-__kernel void thresholding(__global uchar4* inputImage, __global uchar4* outputImage, __global uint* threshold, uint width, uint height)
+/*! One pass of the tree reduction of partial histograms, every work group merges rowsPerGroup partial histograms to one.
+ *  Work items of a group sum a part of the rows for one bin each, the sums are then reduced in local memory.
+ *  The pass is repeated by the host until one histogram remains, so any number of partial histograms can be merged.
+ *
+ * \param[in] partialHistograms numPartial histograms, numBins values each
+ * \param[out] histograms resulting histograms, one for every work group in the second dimension
+ * \param[in] numPartial number of partial histograms
+ * \param[in] numBins number of values in every histogram
+ * \param[in] rowsPerGroup number of partial histograms merged by one work group
+ * \param[in] partialSums local memory for the sums of all work items
+ */
+__kernel void reduceHistograms(__global uint* partialHistograms, __global uint* histograms, uint numPartial, uint numBins, uint rowsPerGroup, __local uint* partialSums)
 {
-    uint globalX = get_global_id(0);
-	uint globalY = get_global_id(1);
-	
-	if (globalX < width && globalY < height)
+	uint bin = get_global_id(0);
+	uint localX = get_local_id(0);
+	uint localY = get_local_id(1);
+	uint groupY = get_group_id(1);
+	uint sizeX = get_local_size(0);
+	uint sizeY = get_local_size(1);
+
+	uint first = groupY * rowsPerGroup;
+	uint last = min(first + rowsPerGroup, numPartial);
+
+	uint sum = 0;
+
+	if (bin < numBins)
 	{
-		if(inputImage[globalY * width + globalX].x > threshold[0]){
-			outputImage[globalY * width + globalX] = (255, 255, 255, 255);
-		} else {
-			outputImage[globalY * width + globalX] = (0, 0, 0, 0); 
+		for (uint row = first + localY; row < last; row += sizeY)
+		{
+			sum += partialHistograms[row * numBins + bin];
 		}
 	}
 
-	return;
+	partialSums[localY * sizeX + localX] = sum;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//tree reduction over the rows of the work group, local size in the second dimension is a power of two
+	for (uint stride = sizeY / 2; stride > 0; stride /= 2)
+	{
+		if (localY < stride)
+		{
+			partialSums[localY * sizeX + localX] += partialSums[(localY + stride) * sizeX + localX];
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (localY == 0 && bin < numBins)
+	{
+		histograms[groupY * numBins + bin] = partialSums[localX];
+	}
 }
 
-/*! Image Segmentation by Adaptive Histogram Thresholding
+
+
+/*! Computes histogram of an image with samples of up to 16 bits, the histogram has to be cleared by clearHistogram first.
+ *  Sample v falls to bin v >> binShift. Up to WIDE_LOCAL_BINS bins are counted in local memory like in histogram3.
+ *  Larger histograms are counted in two levels in one pass over the image. The samples are read in chunks,
+ *  the buckets of the high bits of their bins are marked in local memory, and every newly marked bucket gets a slot
+ *  for its fine bins in the cache while there are free slots. Samples of the buckets with a slot are counted in local memory,
+ *  the others straight in global memory with atomics, and the slots are added to the histogram at the end.
  *
- * \param[in] inputImage input image in grayscale format with 255 levels of gray
- * \param[out] outputImage an equalized input image in grayscale format with 255 levels of gray
- * \param[in] width width of the input image
- * \param[in] height height of the input image
+ * \param[in] inputImage input image, one 16-bit sample per pixel
+ * \param[in] numberOfPixels number of pixels of the input image
+ * \param[in] binShift number of low bits of a sample dropped to get its bin
+ * \param[in] numBins number of bins of the histogram, a power of two
+ * \param[out] histogram resulting histogram, numBins values
+ * \param[in] cache local memory for min(numBins, WIDE_LOCAL_BINS) values
  */
-__kernel void segmentation(__global uchar4* inputImage, __global uchar4* outputImage, uint width, uint height)
+__kernel void histogramWide(__global ushort* inputImage, uint numberOfPixels, uint binShift, uint numBins, __global uint* histogram, __local uint* cache)
 {
-    uint globalX = get_global_id(0);
-	uint globalY = get_global_id(1);
-	
-    //local histogram for every pixel (subimage)
-    int subHist[255];
-
-    int threshold;
-    int yy;
-    int xx;
-    int iter;
-    int i;
-    
-    //initial threshold 
-    threshold = 128;
-
-    //initialize memory
-    for (i = 0; i < HISTOGRAM_SIZE; i++) 
-	{
-	    subHist[i] = 0;
-	}
-    
-    //compute histogram of 31 x 31 subimage around pixel
-    for (yy = 0; yy <= 30; yy++)
-    {
-        int subPosY = globalY + yy - 15;
+	__local uint bucketSlots[WIDE_BUCKETS]; //slot of the fine bins of every bucket or one of WIDE_SLOT_NONE, WIDE_SLOT_NEW, WIDE_SLOT_GLOBAL
+	__local uint slotBuckets[WIDE_BUCKETS]; //bucket of every taken slot
+	__local uint usedSlots;
 
-        //check bounds
-        if (subPosY < 0 || subPosY >= height)
-            continue;
+	uint globalId = get_global_id(0);
+	uint globalSize = get_global_size(0);
+	uint localId = get_local_id(0);
+	uint localSize = get_local_size(0);
 
-        for (xx = 0; xx <= 30; xx++)
-        {
-            uint subPosX = globalX + xx - 15;
-            //check bounds
-            if (subPosX < 0 || subPosX >= width)
-                continue;
+	for (uint i = localId; i < min(numBins, WIDE_LOCAL_BINS); i += localSize)
+	{
+		cache[i] = 0;
+	}
 
-            //modify histogram
-            subHist[inputImage[subPosY * width + subPosX].x]++;
-        }
-    }       
-    //i have histogram
+	if (numBins <= WIDE_LOCAL_BINS)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
 
-    
-    int mean1 = 0;
-    int mean2 = 0;
-    int newTh = 128;
-    long sum = 0;
-    long count = 0;
+		for (uint i = globalId; i < numberOfPixels; i += globalSize)
+		{
+			atomic_inc(&cache[inputImage[i] >> binShift]);
+		}
 
-    //iterrate and try to find "ideal" threshold
-    for (iter = 0; iter < 15; iter++)
-    {       
-        for (i = 0; i < 255; i++)
-        {
-            //separate histogram by threshold and compute mean of all values bellow nad above threshold
-            if (i <= threshold)
-            {
-                //lower part
-                count += subHist[i];
-                sum += subHist[i] * i;
-                    
-                if (i == threshold)
-                {
-                    //last
-                    if (count == 0) //if no valid samples, move mean to threshold
-                        mean1 = threshold;
-                    else
-                        mean1 = sum / count;
-                    sum = count = 0;
-                }
-            }
-            else
-            {
-                //upper part                        
-                count += subHist[i];
-                sum += subHist[i] * i;
-            }
-        }
-        if (count == 0) //if no valid samples, move mean to threshold
-            mean2 = threshold;
-        else
-            mean2 = sum / count;
-        sum = count = 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
 
-        //compute new threshold
-        newTh = (mean1 + mean2) / 2;
+		for (uint i = localId; i < numBins; i += localSize)
+		{
+			if (cache[i] > 0)
+			{
+				atomic_add(&histogram[i], cache[i]);
+			}
+		}
 
-        //is aproximated? - no change
-        if (abs(newTh - threshold) < 3)
-            break;
+		return;
+	}
 
-        threshold = newTh;
-    }
-    threshold = newTh;
-    
-    //dont let threshold move to borders
-    if (threshold < 20)
-        threshold = 20;
-           
-    if (threshold > 255 - 20)
-        threshold = 255 - 20;
-    
-    //perform segmentation
-    if (inputImage[globalY * width + globalX].x <= threshold)
-    {
-        outputImage[globalY * width + globalX] = (0, 0, 0, 0); 
-    }
-    else
+	//a bucket holds slotBins fine bins, the cache has room for numSlots buckets
+	uint slotBins = numBins / WIDE_BUCKETS;
+	uint bucketShift = 31 - clz(slotBins);
+	uint numSlots = WIDE_LOCAL_BINS / slotBins;
+
+	for (uint i = localId; i < WIDE_BUCKETS; i += localSize)
+	{
+		bucketSlots[i] = WIDE_SLOT_NONE;
+	}
+
+	if (localId == 0)
+	{
+		usedSlots = 0;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint chunkPixels = localSize * WIDE_PIXELS_PER_ITEM;
+
+	for (uint chunk = get_group_id(0) * chunkPixels; chunk < numberOfPixels; chunk += get_num_groups(0) * chunkPixels)
+	{
+		//every sample is read once, numBins marks a position behind the image
+		uint bins[WIDE_PIXELS_PER_ITEM];
+		for (uint j = 0; j < WIDE_PIXELS_PER_ITEM; j++)
+		{
+			uint i = chunk + j * localSize + localId;
+			bins[j] = (i < numberOfPixels) ? inputImage[i] >> binShift : numBins;
+
+			//all work items of a new bucket write the same value
+			if (bins[j] < numBins && bucketSlots[bins[j] >> bucketShift] == WIDE_SLOT_NONE)
+			{
+				bucketSlots[bins[j] >> bucketShift] = WIDE_SLOT_NEW;
+			}
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint bucket = localId; bucket < WIDE_BUCKETS; bucket += localSize)
+		{
+			if (bucketSlots[bucket] == WIDE_SLOT_NEW)
+			{
+				uint slot = atomic_inc(&usedSlots);
+				if (slot < numSlots)
+				{
+					bucketSlots[bucket] = slot;
+					slotBuckets[slot] = bucket;
+				}
+				else
+				{
+					bucketSlots[bucket] = WIDE_SLOT_GLOBAL;
+				}
+			}
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		//buckets of this chunk are settled now, the next chunk marks only buckets without any sample
+		for (uint j = 0; j < WIDE_PIXELS_PER_ITEM; j++)
+		{
+			if (bins[j] < numBins)
+			{
+				uint slot = bucketSlots[bins[j] >> bucketShift];
+
+				if (slot == WIDE_SLOT_GLOBAL)
+				{
+					atomic_inc(&histogram[bins[j]]);
+				}
+				else
+				{
+					atomic_inc(&cache[slot * slotBins + (bins[j] & (slotBins - 1))]);
+				}
+			}
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint takenBins = min(usedSlots, numSlots) * slotBins;
+	for (uint i = localId; i < takenBins; i += localSize)
+	{
+		if (cache[i] > 0)
+		{
+			atomic_add(&histogram[(slotBuckets[i / slotBins] << bucketShift) + (i & (slotBins - 1))], cache[i]);
+		}
+	}
+}
+
+/*! Exclusive scan of HISTOGRAM_SIZE values in local memory, work-efficient (Blelloch).
+ *  Called by all HISTOGRAM_SIZE / 2 work items of a work group, every work item handles the values 2 * localX and 2 * localX + 1.
+ *
+ * \param[in,out] scan values, replaced by the sum of all values before them
+ * \param[in] localX local id of the work item
+ * \return sum of all values
+ */
+ulong scanHistogram(__local ulong* scan, uint localX)
+{
+	uint first = 2 * localX;
+	uint second = first + 1;
+
+	//up-sweep, builds partial sums in place
+	uint offset = 1;
+	for (uint active = HISTOGRAM_SIZE / 2; active > 0; active /= 2)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (localX < active)
+		{
+			uint left = offset * (first + 1) - 1;
+			uint right = offset * (second + 1) - 1;
+			scan[right] += scan[left];
+		}
+		offset *= 2;
+	}
+
+	//the sum of all values is the root of the tree
+	barrier(CLK_LOCAL_MEM_FENCE);
+	ulong total = scan[HISTOGRAM_SIZE - 1];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (localX == 0)
+	{
+		scan[HISTOGRAM_SIZE - 1] = 0;
+	}
+
+	//down-sweep, turns the partial sums into an exclusive scan
+	for (uint active = 1; active < HISTOGRAM_SIZE; active *= 2)
+	{
+		offset /= 2;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (localX < active)
+		{
+			uint left = offset * (first + 1) - 1;
+			uint right = offset * (second + 1) - 1;
+			ulong partial = scan[left];
+			scan[left] = scan[right];
+			scan[right] += partial;
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	return total;
+}
+
+/*! New pixel values of the histogram equalization computed by a work-group of HISTOGRAM_SIZE / 2 work items,
+ *  shared by equalize1 and equalizeBatch1.
+ *
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[out] newValues an array of 256 values, each value represents a new pixel value for a pixel value given by its index
+ * \param[in] scan local memory for HISTOGRAM_SIZE values
+ */
+void equalizeLevels(__global uint* histogram, __global uint* newValues, __local ulong* scan)
+{
+	uint localX = get_local_id(0);
+	uint first = 2 * localX;
+	uint second = first + 1;
+
+	uint firstCount = histogram[first];
+	uint secondCount = histogram[second];
+	scan[first] = firstCount;
+	scan[second] = secondCount;
+
+	//number of pixels in the input image is the sum of the histogram
+	ulong numberOfPixels = max(scanHistogram(scan, localX), (ulong) 1);
+
+	//computing final output in integers, the same as equalizeLUT() in cpu.cpp
+	ulong cumulative = scan[first] + firstCount;
+	newValues[first] = (uint) min(cumulative * HISTOGRAM_SIZE / numberOfPixels, (ulong) (HISTOGRAM_SIZE - 1));
+	cumulative += secondCount;
+	newValues[second] = (uint) min(cumulative * HISTOGRAM_SIZE / numberOfPixels, (ulong) (HISTOGRAM_SIZE - 1));
+}
+
+/*! First part of the histogram equalization, determines a new pixel value for each possible pixel value in the input image.
+ *  Runs as a single work-group of HISTOGRAM_SIZE / 2 work items, each of them handles two bins.
+ *  The cumulative histogram is a work-efficient (Blelloch) scan in local memory.
+ *
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[out] newValues an array of 256 values, each value represents a new pixel value for a pixel value given by its index
+ */
+__kernel void equalize1(__global uint* histogram, __global uint* newValues)
+{
+	__local ulong scan[HISTOGRAM_SIZE];
+
+	equalizeLevels(histogram, newValues, scan);
+}
+
+/*! Smallest gray level of the reference whose share of pixels reaches the share of the source level,
+ *  referenceCumulative[level] / referenceTotal >= target / (referenceTotal * sourceTotal).
+ *
+ * \param[in] referenceCumulative cumulative histogram of the reference image, 256 values
+ * \param[in] target cumulative count of the source level multiplied by the number of pixels of the reference
+ * \param[in] sourceTotal number of pixels of the source
+ */
+uint matchLevel(__local uint* referenceCumulative, ulong target, ulong sourceTotal)
+{
+	uint low = 0;
+	uint high = HISTOGRAM_SIZE - 1;
+
+	while (low < high)
+	{
+		uint middle = (low + high) / 2;
+		if ((ulong) referenceCumulative[middle] * sourceTotal >= target)
+			high = middle;
+		else
+			low = middle + 1;
+	}
+
+	return low;
+}
+
+/*! First part of the histogram matching, maps every gray level through the cumulative histogram of the input image
+ *  and the inverse of the cumulative histogram of the reference. The new values are applied by equalize2.
+ *  Runs as a single work-group of HISTOGRAM_SIZE / 2 work items like equalize1, the result is the same as of matchLUT() in cpu.cpp.
+ *
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[in] referenceCumulative cumulative histogram of the reference image computed by the host, 256 values
+ * \param[out] newValues an array of 256 values, each value represents a new pixel value for a pixel value given by its index
+ */
+__kernel void match1(__global uint* histogram, __global uint* referenceCumulative, __global uint* newValues)
+{
+	__local ulong scan[HISTOGRAM_SIZE];
+	__local uint reference[HISTOGRAM_SIZE];
+
+	uint localX = get_local_id(0);
+	uint first = 2 * localX;
+	uint second = first + 1;
+
+	uint firstCount = histogram[first];
+	uint secondCount = histogram[second];
+	scan[first] = firstCount;
+	scan[second] = secondCount;
+	reference[first] = referenceCumulative[first];
+	reference[second] = referenceCumulative[second];
+
+	//the scan starts and ends with a barrier, so the reference is loaded too
+	ulong sourceTotal = max(scanHistogram(scan, localX), (ulong) 1);
+	ulong referenceTotal = reference[HISTOGRAM_SIZE - 1];
+
+	ulong cumulative = scan[first] + firstCount;
+	newValues[first] = matchLevel(reference, cumulative * referenceTotal, sourceTotal);
+	cumulative += secondCount;
+	newValues[second] = matchLevel(reference, cumulative * referenceTotal, sourceTotal);
+}
+
+
+
+/*! Second part of the histogram equalization, creates an output image from the input image using the output from the first part.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage an equalized input image, one 8-bit gray value per pixel
+ * \param[in] newValues an array of 255 values, each value represents a new pixel value for a pixel value given by its index
+ * \param[in] width width of the input image
+ * \param[in] height height of the input image
+ */
+__kernel void equalize2(__global uchar* inputImage, __global uchar* outputImage, __global uint* newValues, uint width, uint height)
+{
+    //two dimensional matrix of work items
+    uint globalX = get_global_id(0);
+	uint globalY = get_global_id(1);
+	
+	if (globalX < width && globalY < height) //chceck if we are out of bounds
+	{
+        uchar newValue = newValues[inputImage[globalY * width + globalX]]; //get new value for current pixel
+		outputImage[globalY * width + globalX] = newValue; //write the new value to the output image
+	}
+	
+	return;
+}
+
+/*! Two neighbouring tiles of clahe along one axis and the weight of the second one, the same as claheNeighbours() in cpu.h.
+ */
+void claheNeighbours(int position, int tileSize, int tiles, int* first, int* second, int* weight)
+{
+	int offset = position - tileSize / 2;
+
+	if (offset < 0 || offset / tileSize >= tiles - 1)
+	{
+		*first = *second = (offset < 0) ? 0 : tiles - 1;
+		*weight = 0;
+		return;
+	}
+
+	*first = offset / tileSize;
+	*second = *first + 1;
+	*weight = offset % tileSize;
+}
+
+/*! First part of clahe, computes the new pixel values of every tile from its clipped histogram.
+ *  One work group of 16x16 work items per tile, every work item then handles one bin.
+ *  The result is the same as of claheClip() and equalizeLUT() in cpu.cpp.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[in] width width of the input image
+ * \param[in] height height of the input image
+ * \param[in] tileSize tile width and height
+ * \param[in] clipLimit largest bin height in 1/CLAHE_CLIP_SCALE of the mean bin height
+ * \param[out] newValues 256 new pixel values of every tile, tiles in rows
+ */
+__kernel void claheTiles(__global uchar* inputImage, uint width, uint height, uint tileSize, uint clipLimit, __global uchar* newValues)
+{
+	__local uint tileHistogram[HISTOGRAM_SIZE];
+	__local uint excess;
+
+	uint localX = get_local_id(0);
+	uint localY = get_local_id(1);
+	uint sizeX = get_local_size(0);
+	uint sizeY = get_local_size(1);
+	uint localId = localY * sizeX + localX;
+	uint tile = get_group_id(1) * get_num_groups(0) + get_group_id(0);
+
+	uint x0 = get_group_id(0) * tileSize;
+	uint y0 = get_group_id(1) * tileSize;
+	uint tileWidth = min(tileSize, width - x0);
+	uint tileHeight = min(tileSize, height - y0);
+
+	tileHistogram[localId] = 0;
+	if (localId == 0)
+		excess = 0;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint y = localY; y < tileHeight; y += sizeY)
+	{
+		for (uint x = localX; x < tileWidth; x += sizeX)
+		{
+			atomic_inc(&tileHistogram[inputImage[(y0 + y) * width + x0 + x]]);
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//clipping, the clipped pixels are spread evenly over all bins
+	uint limit = max((uint) ((ulong) tileWidth * tileHeight * clipLimit / (CLAHE_CLIP_SCALE * HISTOGRAM_SIZE)), 1u);
+	uint count = tileHistogram[localId];
+	if (count > limit)
+	{
+		atomic_add(&excess, count - limit);
+		count = limit;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	count += excess / HISTOGRAM_SIZE + ((localId < excess % HISTOGRAM_SIZE) ? 1 : 0);
+	tileHistogram[localId] = count;
+
+	//inclusive scan of the clipped histogram
+	for (uint offset = 1; offset < HISTOGRAM_SIZE; offset *= 2)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		uint previous = (localId >= offset) ? tileHistogram[localId - offset] : 0;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+		tileHistogram[localId] += previous;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	ulong cumulative = tileHistogram[localId];
+	ulong numberOfPixels = max(tileHistogram[HISTOGRAM_SIZE - 1], 1u);
+	newValues[tile * HISTOGRAM_SIZE + localId] = (uchar) min(cumulative * HISTOGRAM_SIZE / numberOfPixels, (ulong) (HISTOGRAM_SIZE - 1));
+}
+
+/*! Second part of clahe, every pixel gets a bilinear interpolation of the new values of the four nearest tiles.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage equalized image, one 8-bit gray value per pixel
+ * \param[in] newValues new pixel values of every tile from claheTiles
+ * \param[in] width width of the input image
+ * \param[in] height height of the input image
+ * \param[in] tileSize tile width and height
+ */
+__kernel void claheApply(__global uchar* inputImage, __global uchar* outputImage, __global uchar* newValues, uint width, uint height, uint tileSize)
+{
+	uint globalX = get_global_id(0);
+	uint globalY = get_global_id(1);
+
+	if (globalX >= width || globalY >= height)
+		return;
+
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+
+	int left, right, weightX;
+	int top, bottom, weightY;
+	claheNeighbours(globalX, tileSize, tilesX, &left, &right, &weightX);
+	claheNeighbours(globalY, tileSize, tilesY, &top, &bottom, &weightY);
+
+	uint value = inputImage[globalY * width + globalX];
+	__global uchar* topRow = newValues + top * tilesX * HISTOGRAM_SIZE;
+	__global uchar* bottomRow = newValues + bottom * tilesX * HISTOGRAM_SIZE;
+
+	uint topValue = (tileSize - weightX) * topRow[left * HISTOGRAM_SIZE + value] + weightX * topRow[right * HISTOGRAM_SIZE + value];
+	uint bottomValue = (tileSize - weightX) * bottomRow[left * HISTOGRAM_SIZE + value] + weightX * bottomRow[right * HISTOGRAM_SIZE + value];
+	uint area = tileSize * tileSize;
+
+	outputImage[globalY * width + globalX] = (uchar) (((tileSize - weightY) * topValue + weightY * bottomValue + area / 2) / area);
+}
+
+/*! Second part of the colour equalization, converts every pixel to YCbCr, replaces its luma by the new value
+ *  from equalize1 and converts it back. The result is the same as of equalizeColor() in cpu.cpp.
+ *
+ * \param[in] inputImage input image in rgba format
+ * \param[out] outputImage equalized image in rgba format, alpha is kept
+ * \param[in] newValues an array of 256 values, new luma for every luma of the input image
+ * \param[in] numberOfPixels number of pixels of the input image
+ */
+__kernel void equalizeColor(__global uchar4* inputImage, __global uchar4* outputImage, __global uint* newValues, uint numberOfPixels)
+{
+	uint globalX = get_global_id(0);
+
+	if (globalX >= numberOfPixels)
+		return;
+
+	uchar4 pixel = inputImage[globalX];
+
+	int newLuma = newValues[luma(pixel)] << 16;
+	int blueDifference = chromaBlue(pixel) - 128;
+	int redDifference = chromaRed(pixel) - 128;
+
+	uchar4 result;
+	result.x = fixedToChannel(newLuma + 91881 * redDifference + 32768);
+	result.y = fixedToChannel(newLuma - 22554 * blueDifference - 46802 * redDifference + 32768);
+	result.z = fixedToChannel(newLuma + 116130 * blueDifference + 32768);
+	result.w = pixel.w;
+
+	outputImage[globalX] = result;
+}
+
+/*! First part of the equalization of an image with samples of up to 16 bits, computes a new sample value for every bin.
+ *  Runs as one work group, every work item sums a continuous segment of bins, the segment sums are scanned in local memory
+ *  and every work item then walks its segment again. The result is the same as of equalizeWide in cpu.cpp.
+ *
+ * \param[in] histogram histogram of the input image, numBins values
+ * \param[in] numBins number of bins of the histogram
+ * \param[in] maxValue largest sample value, 2^bitDepth - 1
+ * \param[out] newValues new sample value for every bin
+ * \param[in] segmentSums local memory for the sums of all work items
+ */
+__kernel void equalizeWide1(__global uint* histogram, uint numBins, uint maxValue, __global uint* newValues, __local ulong* segmentSums)
+{
+	uint localId = get_local_id(0);
+	uint localSize = get_local_size(0);
+
+	uint segmentSize = (numBins + localSize - 1) / localSize;
+	uint first = min(localId * segmentSize, numBins);
+	uint last = min(first + segmentSize, numBins);
+
+	ulong sum = 0;
+	for (uint i = first; i < last; i++)
+	{
+		sum += histogram[i];
+	}
+
+	segmentSums[localId] = sum;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//inclusive scan of the segment sums
+	for (uint offset = 1; offset < localSize; offset *= 2)
+	{
+		ulong previous = (localId >= offset) ? segmentSums[localId - offset] : 0;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+		segmentSums[localId] += previous;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	ulong total = segmentSums[localSize - 1];
+	ulong cumulative = segmentSums[localId] - sum;
+
+	for (uint i = first; i < last; i++)
+	{
+		cumulative += histogram[i];
+		newValues[i] = (uint) (cumulative * maxValue / total);
+	}
+}
+
+/*! Second part of the equalization of an image with samples of up to 16 bits.
+ *
+ * \param[in] inputImage input image, one 16-bit sample per pixel
+ * \param[out] outputImage equalized image
+ * \param[in] newValues new sample value for every bin
+ * \param[in] numberOfPixels number of pixels of the input image
+ * \param[in] binShift number of low bits of a sample dropped to get its bin
+ */
+__kernel void equalizeWide2(__global ushort* inputImage, __global ushort* outputImage, __global uint* newValues, uint numberOfPixels, uint binShift)
+{
+	uint globalX = get_global_id(0);
+
+	if (globalX < numberOfPixels)
+	{
+		outputImage[globalX] = newValues[inputImage[globalX] >> binShift];
+	}
+}
+
+/*! Otsu threshold of a histogram with up to 65536 bins.
+ *  Runs as one work group, counts and moments of continuous segments of bins are scanned in local memory,
+ *  every work item then finds the best bin of its segment and the best bins are reduced to the lowest bin with the largest variance.
+ *  The result is the same as of otsuWide in cpu.cpp.
+ *
+ * \param[in] histogram histogram of the input image, numBins values
+ * \param[in] numBins number of bins of the histogram
+ * \param[out] threshold the threshold bin
+ * \param[in] counts local memory for the pixel counts of all work items
+ * \param[in] moments local memory for the moments of all work items
+ * \param[in] bestVariance local memory for the best variance of all work items
+ * \param[in] bestBin local memory for the best bin of all work items
+ */
+__kernel void thresholdWide(__global uint* histogram, uint numBins, __global uint* threshold,
+							__local ulong* counts, __local ulong* moments, __local float* bestVariance, __local uint* bestBin)
+{
+	uint localId = get_local_id(0);
+	uint localSize = get_local_size(0);
+
+	uint segmentSize = (numBins + localSize - 1) / localSize;
+	uint first = min(localId * segmentSize, numBins);
+	uint last = min(first + segmentSize, numBins);
+
+	ulong count = 0;
+	ulong moment = 0;
+	for (uint i = first; i < last; i++)
+	{
+		count += histogram[i];
+		moment += (ulong) i * histogram[i];
+	}
+
+	counts[localId] = count;
+	moments[localId] = moment;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//inclusive scan of the segment counts and moments
+	for (uint offset = 1; offset < localSize; offset *= 2)
+	{
+		ulong previousCount = (localId >= offset) ? counts[localId - offset] : 0;
+		ulong previousMoment = (localId >= offset) ? moments[localId - offset] : 0;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+		counts[localId] += previousCount;
+		moments[localId] += previousMoment;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	ulong total = counts[localSize - 1];
+	ulong sum = moments[localSize - 1];
+	ulong wB = counts[localId] - count;
+	ulong sumB = moments[localId] - moment;
+
+	float varMax = 0;
+	uint best = 0;
+
+	for (uint i = first; i < last; i++)
+	{
+		wB += histogram[i];
+		sumB += (ulong) i * histogram[i];
+
+		ulong wF = total - wB;
+		if (wB == 0 || wF == 0)
+			continue;
+
+		float mB = (float) sumB / (float) wB;
+		float mF = (float) (sum - sumB) / (float) wF;
+		float varBetween = (float) wB * (float) wF * (mB - mF) * (mB - mF);
+
+		if (varBetween > varMax)
+		{
+			varMax = varBetween;
+			best = i;
+		}
+	}
+
+	bestVariance[localId] = varMax;
+	bestBin[localId] = best;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//the largest variance wins, the lower bin on a tie, local size is a power of two
+	for (uint stride = localSize / 2; stride > 0; stride /= 2)
+	{
+		if (localId < stride)
+		{
+			float other = bestVariance[localId + stride];
+
+			if (other > bestVariance[localId] || (other == bestVariance[localId] && bestBin[localId + stride] < bestBin[localId]))
+			{
+				bestVariance[localId] = other;
+				bestBin[localId] = bestBin[localId + stride];
+			}
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (localId == 0)
+	{
+		threshold[0] = bestBin[0];
+	}
+}
+
+/*! Thresholding of an image with samples of up to 16 bits, samples in the bins above the threshold bin become maxValue, others 0.
+ *
+ * \param[in] inputImage input image, one 16-bit sample per pixel
+ * \param[out] outputImage thresholded image
+ * \param[in] threshold the threshold bin
+ * \param[in] numberOfPixels number of pixels of the input image
+ * \param[in] binShift number of low bits of a sample dropped to get its bin
+ * \param[in] maxValue largest sample value, 2^bitDepth - 1
+ */
+__kernel void thresholdingWide(__global ushort* inputImage, __global ushort* outputImage, __global uint* threshold, uint numberOfPixels, uint binShift, uint maxValue)
+{
+	uint globalX = get_global_id(0);
+
+	if (globalX < numberOfPixels)
+	{
+		outputImage[globalX] = ((inputImage[globalX] >> binShift) > threshold[0]) ? maxValue : 0;
+	}
+}
+
+/*! Between-class variance of the Otsu method when the background are the bins up to a given one,
+ *  the same as otsuVariance() in cpu.cpp if the program is built with correctly rounded division. Zero if one of the classes is empty.
+ *
+ * \param[in] wB number of pixels of the background
+ * \param[in] sumB sum of the gray levels of the background
+ * \param[in] total number of pixels
+ * \param[in] sum sum of the gray levels of all pixels
+ */
+float otsuVariance(ulong wB, ulong sumB, ulong total, ulong sum)
+{
+	//every operation is rounded on its own like on the cpu
+	#pragma OPENCL FP_CONTRACT OFF
+
+	ulong wF = total - wB;
+	if (wB == 0 || wF == 0)
+		return 0;
+
+	float mB = (float) sumB / (float) wB;
+	float mF = (float) (sum - sumB) / (float) wF;
+	return (float) wB * (float) wF * (mB - mF) * (mB - mF);
+}
+
+/*! Otsu threshold computed by a work-group of HISTOGRAM_SIZE / 2 work items, shared by threshold and thresholdBatch.
+ *  The threshold is returned to all work items.
+ *
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[in] counts local memory for HISTOGRAM_SIZE values
+ * \param[in] moments local memory for HISTOGRAM_SIZE values
+ * \param[in] bestVariance local memory for HISTOGRAM_SIZE / 2 values
+ * \param[in] bestBin local memory for HISTOGRAM_SIZE / 2 values
+ * \return threshold, pixels above it are the foreground
+ */
+uint otsuGroupThreshold(__global uint* histogram, __local ulong* counts, __local ulong* moments, __local float* bestVariance, __local uint* bestBin)
+{
+	uint localX = get_local_id(0);
+	uint first = 2 * localX;
+	uint second = first + 1;
+
+	uint firstCount = histogram[first];
+	uint secondCount = histogram[second];
+	counts[first] = firstCount;
+	counts[second] = secondCount;
+	moments[first] = (ulong) first * firstCount;
+	moments[second] = (ulong) second * secondCount;
+
+	ulong total = scanHistogram(counts, localX);
+	ulong sum = scanHistogram(moments, localX);
+
+	//the background are the bins up to and including the evaluated one
+	ulong wB = counts[first] + firstCount;
+	ulong sumB = moments[first] + (ulong) first * firstCount;
+	float firstVariance = otsuVariance(wB, sumB, total, sum);
+
+	wB += secondCount;
+	sumB += (ulong) second * secondCount;
+	float secondVariance = otsuVariance(wB, sumB, total, sum);
+
+	bestVariance[localX] = (secondVariance > firstVariance) ? secondVariance : firstVariance;
+	bestBin[localX] = (secondVariance > firstVariance) ? second : first;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//the largest variance wins, the lower bin on a tie
+	for (uint stride = HISTOGRAM_SIZE / 4; stride > 0; stride /= 2)
+	{
+		if (localX < stride)
+		{
+			float other = bestVariance[localX + stride];
+
+			if (other > bestVariance[localX] || (other == bestVariance[localX] && bestBin[localX + stride] < bestBin[localX]))
+			{
+				bestVariance[localX] = other;
+				bestBin[localX] = bestBin[localX + stride];
+			}
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	//pixels of the best bin still belong to the background
+	return (bestVariance[0] > 0) ? bestBin[0] + 1 : 0;
+}
+
+/*! Otsu threshold of the histogram of the input image.
+ *  Runs as a single work-group of HISTOGRAM_SIZE / 2 work items like equalize1, counts and moments of the bins are scanned
+ *  in local memory, every work item evaluates the between-class variance of its two bins and the bins are reduced
+ *  to the lowest one with the largest variance. The result is the same as of otsuThreshold() in cpu.cpp.
+ *
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[out] threshold pixels above the threshold are the foreground
+ */
+__kernel void threshold(__global uint* histogram, __global uint* threshold)
+{
+	__local ulong counts[HISTOGRAM_SIZE];
+	__local ulong moments[HISTOGRAM_SIZE];
+	__local float bestVariance[HISTOGRAM_SIZE / 2];
+	__local uint bestBin[HISTOGRAM_SIZE / 2];
+
+	uint value = otsuGroupThreshold(histogram, counts, moments, bestVariance, bestBin);
+
+	if (get_local_id(0) == 0)
+	{
+		threshold[0] = value;
+	}
+}
+
+/*! Between-class variance term of the class of bins from first to last - 1 of the multi-level Otsu method,
+ *  the same as otsuClassVariance() in cpu.cpp. Zero for an empty class.
+ *
+ * \param[in] counts number of pixels below every bin, HISTOGRAM_SIZE + 1 values
+ * \param[in] moments sum of the gray levels below every bin, HISTOGRAM_SIZE + 1 values
+ * \param[in] first first bin of the class
+ * \param[in] last bin after the last bin of the class
+ * \param[in] mean mean gray level of the image
+ */
+float otsuClassVariance(__local ulong* counts, __local ulong* moments, uint first, uint last, float mean)
+{
+	ulong w = counts[last] - counts[first];
+	if (w == 0)
+		return 0;
+
+	float classMean = (float) (moments[last] - moments[first]) / (float) w;
+	return (float) w * (classMean - mean) * (classMean - mean);
+}
+
+/*! Best tuple of class boundaries of the multi-level Otsu method for a fixed boundary of the lowest class,
+ *  the same as otsuMultiSearch() in cpu.cpp. Boundaries are the first bins of the classes above the lowest one,
+ *  on a tie the lowest tuple wins.
+ *
+ * \param[in] counts number of pixels below every bin, HISTOGRAM_SIZE + 1 values
+ * \param[in] moments sum of the gray levels below every bin, HISTOGRAM_SIZE + 1 values
+ * \param[in] mean mean gray level of the image
+ * \param[in] first first bin of the second class
+ * \param[in] classes number of classes, from 2 to OTSU_MAX_CLASSES
+ * \param[out] bounds classes - 1 boundaries of the best tuple
+ * \return between-class variance of the best tuple
+ */
+float otsuMultiSearch(__local ulong* counts, __local ulong* moments, float mean, uint first, uint classes, uint* bounds)
+{
+	//the sums are rounded the same way as on the cpu
+	#pragma OPENCL FP_CONTRACT OFF
+
+	float lower = otsuClassVariance(counts, moments, 0, first, mean);
+	float bestVariance = -1;
+	bounds[0] = first;
+
+	if (classes == 2)
+		return lower + otsuClassVariance(counts, moments, first, HISTOGRAM_SIZE, mean);
+
+	for (uint second = first + 1; second <= HISTOGRAM_SIZE - (classes - 2); second++)
+	{
+		float middle = lower + otsuClassVariance(counts, moments, first, second, mean);
+
+		if (classes == 3)
+		{
+			float variance = middle + otsuClassVariance(counts, moments, second, HISTOGRAM_SIZE, mean);
+			if (variance > bestVariance)
+			{
+				bestVariance = variance;
+				bounds[1] = second;
+			}
+			continue;
+		}
+
+		for (uint third = second + 1; third < HISTOGRAM_SIZE; third++)
+		{
+			float variance = middle + otsuClassVariance(counts, moments, second, third, mean) + otsuClassVariance(counts, moments, third, HISTOGRAM_SIZE, mean);
+			if (variance > bestVariance)
+			{
+				bestVariance = variance;
+				bounds[1] = second;
+				bounds[2] = third;
+			}
+		}
+	}
+
+	return bestVariance;
+}
+
+/*! Thresholds of the multi-level Otsu method of the histogram of the input image.
+ *  Runs as a single work-group of HISTOGRAM_SIZE / 2 work items. Cumulative counts and moments of the bins are scanned
+ *  into local memory, so the variance of every class costs O(1). The search is split over the boundary of the lowest
+ *  class, every work item searches two mirrored ones, localX + 1 and HISTOGRAM_SIZE - localX, so the long searches
+ *  of the low boundaries are paired with the short ones of the high boundaries. The work items are then reduced to the best tuple.
+ *  The result is the same as of otsuMultiThresholds() in cpu.cpp if the program is built with correctly rounded division.
+ *
+ * \param[in] histogram histogram of the input image, 256 values
+ * \param[out] threshold classes - 1 increasing thresholds, class j ends with the bin threshold[j]
+ * \param[in] classes number of classes, from 2 to OTSU_MAX_CLASSES
+ */
+__kernel void thresholdMulti(__global uint* histogram, __global uint* threshold, uint classes)
+{
+	__local ulong counts[HISTOGRAM_SIZE + 1];
+	__local ulong moments[HISTOGRAM_SIZE + 1];
+	__local float bestVariance[HISTOGRAM_SIZE / 2];
+	__local uint bestFirst[HISTOGRAM_SIZE / 2];
+
+	uint localX = get_local_id(0);
+
+	for (uint i = 2 * localX; i < 2 * localX + 2; i++)
+	{
+		uint count = histogram[i];
+		counts[i] = count;
+		moments[i] = (ulong) i * count;
+	}
+
+	ulong total = scanHistogram(counts, localX);
+	ulong sum = scanHistogram(moments, localX);
+
+	if (localX == 0)
+	{
+		counts[HISTOGRAM_SIZE] = total;
+		moments[HISTOGRAM_SIZE] = sum;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	float mean = (total > 0) ? (float) sum / (float) total : 0;
+
+	//a low and the mirrored high boundary per work item, the lower one first, so it wins a tie
+	uint bounds[OTSU_MAX_CLASSES - 1];
+	uint candidate[OTSU_MAX_CLASSES - 1];
+	float variance = -1;
+	uint first = 0;
+	uint firsts[2] = { localX + 1, HISTOGRAM_SIZE - localX };
+
+	for (uint i = 0; i < 2; i++)
+	{
+		uint f = firsts[i];
+		if (f > HISTOGRAM_SIZE - (classes - 1))
+			continue;
+
+		float candidateVariance = otsuMultiSearch(counts, moments, mean, f, classes, candidate);
+		if (candidateVariance > variance)
+		{
+			variance = candidateVariance;
+			first = f;
+			for (uint j = 0; j < classes - 1; j++)
+				bounds[j] = candidate[j];
+		}
+	}
+
+	bestVariance[localX] = variance;
+	bestFirst[localX] = first;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//the largest variance wins, the lower boundary on a tie
+	for (uint stride = HISTOGRAM_SIZE / 4; stride > 0; stride /= 2)
+	{
+		if (localX < stride)
+		{
+			float other = bestVariance[localX + stride];
+			uint otherFirst = bestFirst[localX + stride];
+
+			if (other > bestVariance[localX] || (other == bestVariance[localX] && otherFirst < bestFirst[localX]))
+			{
+				bestVariance[localX] = other;
+				bestFirst[localX] = otherFirst;
+			}
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	//the work item which found the best tuple writes it, a class ends one bin below the next boundary
+	if (first != 0 && first == bestFirst[0])
+	{
+		for (uint j = 0; j < classes - 1; j++)
+			threshold[j] = bounds[j] - 1;
+	}
+}
+
+/*! Otsu thresholding of the input image. Every pixel gets the level of its class, spread evenly from black to white,
+ *  with a single threshold pixels above it become white, others black.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage thresholded image, one 8-bit gray value per pixel
+ * \param[in] threshold increasing thresholds from the threshold or thresholdMulti kernel
+ * \param[in] thresholds number of thresholds, the number of classes - 1
+ * \param[in] width width of the input image
+ * \param[in] height height of the input image
+ */
+__kernel void thresholding(__global uchar* inputImage, __global uchar* outputImage, __constant uint* threshold, uint thresholds, uint width, uint height)
+{
+    uint globalX = get_global_id(0);
+	uint globalY = get_global_id(1);
+	
+	if (globalX < width && globalY < height)
+	{
+		uint value = inputImage[globalY * width + globalX];
+		uint level = 0;
+		for (uint j = 0; j < thresholds; j++)
+			level += (value > threshold[j]) ? 1 : 0;
+
+		outputImage[globalY * width + globalX] = level * 255 / thresholds;
+	}
+
+	return;
+}
+
+/*! Number of words of one row of a packed binary mask, the same as maskPitch() in cpu.h.
+ *  Rows start at whole words, pixel x of a row is the bit x % 32 of the word x / 32 and a set bit is a white pixel.
+ */
+uint maskPitch(uint width)
+{
+	return (width + MASK_WORD_PIXELS - 1) / MASK_WORD_PIXELS;
+}
+
+/*! Otsu thresholding of the input image to a packed binary mask, every work item packs one word of 32 pixels.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputMask packed mask, maskPitch(width) words per row, pixels above the threshold are set
+ * \param[in] threshold threshold from the threshold kernel
+ * \param[in] width width of the input image
+ * \param[in] height height of the input image
+ */
+__kernel void thresholdingPacked(__global uchar* inputImage, __global uint* outputMask, __constant uint* threshold, uint width, uint height)
+{
+	uint wordX = get_global_id(0);
+	uint globalY = get_global_id(1);
+	uint pitch = maskPitch(width);
+
+	if (wordX < pitch && globalY < height)
+	{
+		uint value = threshold[0];
+		uint first = wordX * MASK_WORD_PIXELS;
+		uint count = min((uint) MASK_WORD_PIXELS, width - first);
+		__global uchar* row = inputImage + globalY * width + first;
+
+		uint word = 0;
+		for (uint i = 0; i < count; i++)
+		{
+			word |= (row[i] > value) ? (1u << i) : 0;
+		}
+
+		outputMask[globalY * pitch + wordX] = word;
+	}
+}
+
+/*! Iteratively finds the threshold of a window histogram of the segmentation, the same as segmentationThreshold() in cpu.cpp.
+ *
+ * \param[in] subHist window histogram, bin i is at subHist[i * SEG_TILE_WIDTH]
+ * \param[in] threshold starting threshold
+ * \return threshold of the window, at least SEG_TH_BORDERS from both ends of the gray levels
+ */
+int segmentationThreshold(__local ushort* subHist, int threshold)
+{
+    int mean1 = 0;
+    int mean2 = 0;
+    int newTh = 128;
+    int sum = 0;
+    int count = 0;
+
+    //iterrate and try to find "ideal" threshold
+    for (int iter = 0; iter < 15; iter++)
+    {
+        //separate histogram by threshold and compute mean of all values bellow nad above threshold
+        for (int i = 0; i < HISTOGRAM_SIZE; i++)
+        {
+            int value = subHist[i * SEG_TILE_WIDTH];
+
+            if (i <= threshold)
+            {
+                //lower part
+                count += value;
+                sum += value * i;
+
+                if (i == threshold)
+                {
+                    //last
+                    mean1 = (count == 0) ? threshold : sum / count; //if no valid samples, move mean to threshold
+                    sum = count = 0;
+                }
+            }
+            else
+            {
+                //upper part
+                count += value;
+                sum += value * i;
+            }
+        }
+        mean2 = (count == 0) ? threshold : sum / count;
+        sum = count = 0;
+
+        //compute new threshold
+        newTh = (mean1 + mean2) / 2;
+
+        //is aproximated? - no change
+        if (abs(newTh - threshold) < 3)
+            break;
+
+        threshold = newTh;
+    }
+
+    //dont let threshold move to borders
+    return clamp(newTh, SEG_TH_BORDERS, 255 - SEG_TH_BORDERS);
+}
+
+/*! Adds one row of the tile to the window histogram of a work item, or removes it for a negative change.
+ */
+void segmentationWindowRow(__local ushort* subHist, __local uchar* row, int first, int last, int change)
+{
+    for (int x = first; x <= last; x++)
     {
-        outputImage[globalY * width + globalX] = (255, 255, 255, 255);
+        subHist[row[x] * SEG_TILE_WIDTH] += change;
     }
-    
-	return;
 }
 
+/*! Segmentation of one tile of SEG_TILE_WIDTH x SEG_TILE_ROWS pixels by a work-group of SEG_TILE_WIDTH work items,
+ *  shared by the segmentation kernels. The work-group loads the tile with an apron of SEG_SUB_DIAMETER pixels
+ *  into local memory once, then every work item slides the window histogram of its column down the tile,
+ *  adding the entering row and removing the leaving one. The window is clipped to the image.
+ *  Exactly one of the outputs is given, the other one is 0.
+ *  The window counts of 31x31 pixels need ushort bins, 16 KB for the work-group next to the 3.8 KB tile, so only
+ *  two or three work-groups of 32 work items are resident on a compute unit with 48 or 64 KB of local memory.
+ *  Taller work-groups would need a histogram per work item as well; the low occupancy is traded for reading
+ *  every pixel from global memory once per tile.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[in] width width of the input image
+ * \param[in] height height of the input image
+ * \param[in] tile local memory for SEG_APRON_WIDTH x SEG_APRON_ROWS pixels
+ * \param[in] windows local memory for HISTOGRAM_SIZE x SEG_TILE_WIDTH window counts
+ * \param[out] outputImage segmented image, one 8-bit gray value per pixel
+ * \param[out] rowWords packed mask of every row of the tile, cleared by the caller
+ */
+void segmentationTile(__global uchar* inputImage, uint width, uint height, __local uchar* tile, __local ushort* windows,
+                      __global uchar* outputImage, __local uint* rowWords)
+{
+    int localX = get_local_id(0);
+    int tileX = get_group_id(0) * SEG_TILE_WIDTH;
+    int tileY = get_group_id(1) * SEG_TILE_ROWS;
+    int apronX = tileX - SEG_SUB_DIAMETER;
+    int apronY = tileY - SEG_SUB_DIAMETER;
+
+    //pixels outside of the image are loaded as zeros, they are never counted
+    for (int i = localX; i < SEG_APRON_WIDTH * SEG_APRON_ROWS; i += SEG_TILE_WIDTH)
+    {
+        int x = apronX + i % SEG_APRON_WIDTH;
+        int y = apronY + i / SEG_APRON_WIDTH;
+        tile[i] = (x >= 0 && x < (int) width && y >= 0 && y < (int) height) ? inputImage[y * width + x] : 0;
+    }
+
+    __local ushort* subHist = windows + localX;
+    for (int i = 0; i < HISTOGRAM_SIZE; i++)
+    {
+        subHist[i * SEG_TILE_WIDTH] = 0;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int globalX = tileX + localX;
+    int lastY = min(tileY + SEG_TILE_ROWS, (int) height);
+    if (globalX >= (int) width)
+        return;
+
+    //columns of the window in the tile
+    int first = max(globalX - SEG_SUB_DIAMETER, 0) - apronX;
+    int last = min(globalX + SEG_SUB_DIAMETER, (int) width - 1) - apronX;
+
+    //rows above the first pixel, the loop adds the row below it
+    for (int y = max(apronY, 0); y < min(tileY + SEG_SUB_DIAMETER, (int) height); y++)
+    {
+        segmentationWindowRow(subHist, tile + (y - apronY) * SEG_APRON_WIDTH, first, last, 1);
+    }
+
+    for (int y = tileY; y < lastY; y++)
+    {
+        int entering = y + SEG_SUB_DIAMETER;
+        int leaving = y - SEG_SUB_DIAMETER - 1;
+
+        if (entering < (int) height)
+            segmentationWindowRow(subHist, tile + (entering - apronY) * SEG_APRON_WIDTH, first, last, 1);
+        if (y > tileY && leaving >= 0)
+            segmentationWindowRow(subHist, tile + (leaving - apronY) * SEG_APRON_WIDTH, first, last, -1);
+
+        int threshold = segmentationThreshold(subHist, 128);
+        bool foreground = tile[(y - apronY) * SEG_APRON_WIDTH + globalX - apronX] > threshold;
+
+        if (outputImage != 0)
+        {
+            outputImage[y * width + globalX] = foreground ? 255 : 0;
+        }
+        else if (foreground)
+        {
+            atomic_or(&rowWords[y - tileY], 1u << localX);
+        }
+    }
+}
+
+/*! Image Segmentation by Adaptive Histogram Thresholding.
+ *  Work-groups are SEG_TILE_WIDTH x 1 work items, every one of them segments SEG_TILE_ROWS pixels of its column.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputImage segmented image, one 8-bit gray value per pixel
+ * \param[in] width width of the input image
+ * \param[in] height height of the input image
+ */
+__kernel void segmentation(__global uchar* inputImage, __global uchar* outputImage, uint width, uint height)
+{
+    __local uchar tile[SEG_APRON_WIDTH * SEG_APRON_ROWS];
+    __local ushort windows[HISTOGRAM_SIZE * SEG_TILE_WIDTH];
+
+    segmentationTile(inputImage, width, height, tile, windows, outputImage, 0);
+}
+
+/*! Segmentation of the input image to a packed binary mask, the same pixels are set as are white in the output of segmentation.
+ *  Work-groups are the same as of segmentation, a row of a tile is one word of the mask as SEG_TILE_WIDTH is MASK_WORD_PIXELS.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] outputMask packed mask, maskPitch(width) words per row
+ * \param[in] width width of the input image
+ * \param[in] height height of the input image
+ */
+__kernel void segmentationPacked(__global uchar* inputImage, __global uint* outputMask, uint width, uint height)
+{
+    __local uchar tile[SEG_APRON_WIDTH * SEG_APRON_ROWS];
+    __local ushort windows[HISTOGRAM_SIZE * SEG_TILE_WIDTH];
+    __local uint rowWords[SEG_TILE_ROWS];
+
+    uint localX = get_local_id(0);
+
+    for (uint i = localX; i < SEG_TILE_ROWS; i += SEG_TILE_WIDTH)
+    {
+        rowWords[i] = 0;
+    }
+
+    //the tile function has a barrier after loading, before any bit is set
+    segmentationTile(inputImage, width, height, tile, windows, 0, rowWords);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint i = localX; i < SEG_TILE_ROWS; i += SEG_TILE_WIDTH)
+    {
+        uint y = get_group_id(1) * SEG_TILE_ROWS + i;
+        if (y < height)
+        {
+            outputMask[y * maskPitch(width) + get_group_id(0)] = rowWords[i];
+        }
+    }
+}
+
+/*! Number of grid nodes of the approximate segmentation along a side of size pixels, the same as segGridSize() in cpu.h.
+ *  Node i is at pixel i * stride, the last node lies at or behind the last pixel, so every pixel is between two nodes.
+ */
+uint segGridSize(uint size, uint stride)
+{
+    return (size - 1) / stride + 2;
+}
+
+/*! Thresholds of the approximate segmentation in the windows of a grid of nodes every stride pixels.
+ *  Work-groups are SEG_TILE_WIDTH x 1 work items, every work item counts the window of one node straight
+ *  from the image into its column of the local histograms. The windows of neighbouring nodes overlap,
+ *  segmentationGrid() in cpu.cpp slides them along a row of nodes, here every node is counted on its own
+ *  so that the work items don't depend on each other.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[out] thresholds threshold of every node, segGridSize(width, stride) per row
+ * \param[in] width width of the input image
+ * \param[in] height height of the input image
+ * \param[in] stride distance of the grid nodes in pixels
+ */
+__kernel void segmentationGrid(__global uchar* inputImage, __global uchar* thresholds, uint width, uint height, uint stride)
+{
+    __local ushort windows[HISTOGRAM_SIZE * SEG_TILE_WIDTH];
+
+    int gx = get_global_id(0);
+    int gy = get_global_id(1);
+    int gridWidth = segGridSize(width, stride);
+
+    if (gx >= gridWidth)
+        return;
+
+    __local ushort* subHist = windows + get_local_id(0);
+    for (int i = 0; i < HISTOGRAM_SIZE; i++)
+    {
+        subHist[i * SEG_TILE_WIDTH] = 0;
+    }
+
+    //window clipped to the image
+    int x0 = max(gx * (int) stride - SEG_SUB_DIAMETER, 0);
+    int x1 = min(gx * (int) stride + SEG_SUB_DIAMETER, (int) width - 1);
+    int y0 = max(gy * (int) stride - SEG_SUB_DIAMETER, 0);
+    int y1 = min(gy * (int) stride + SEG_SUB_DIAMETER, (int) height - 1);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            subHist[inputImage[y * width + x] * SEG_TILE_WIDTH]++;
+        }
+    }
+
+    thresholds[gy * gridWidth + gx] = segmentationThreshold(subHist, 128);
+}
+
+/*! Applies the thresholds of the approximate segmentation, the threshold of every pixel is bilinearly interpolated
+ *  from the four grid nodes around it. It is kept scaled by stride * stride, so the comparison is exact
+ *  and the output is the same as of segmentationGrid() in cpu.cpp.
+ *
+ * \param[in] inputImage input image, one 8-bit gray value per pixel
+ * \param[in] thresholds thresholds of the grid nodes from the segmentationGrid kernel
+ * \param[out] outputImage segmented image, one 8-bit gray value per pixel
+ * \param[in] width width of the input image
+ * \param[in] height height of the input image
+ * \param[in] stride distance of the grid nodes in pixels
+ */
+__kernel void segmentationInterpolate(__global uchar* inputImage, __global uchar* thresholds, __global uchar* outputImage,
+                                      uint width, uint height, uint stride)
+{
+    uint globalX = get_global_id(0);
+    uint globalY = get_global_id(1);
+
+    if (globalX < width && globalY < height)
+    {
+        uint gridWidth = segGridSize(width, stride);
+        uint gx = globalX / stride;
+        uint gy = globalY / stride;
+        uint fx = globalX - gx * stride;
+        uint fy = globalY - gy * stride;
+
+        __global uchar* top = thresholds + gy * gridWidth;
+        __global uchar* bottom = top + gridWidth;
+
+        uint upper = top[gx] * (stride - fx) + top[gx + 1] * fx;
+        uint lower = bottom[gx] * (stride - fx) + bottom[gx + 1] * fx;
+        uint threshold = upper * (stride - fy) + lower * fy;
+
+        outputImage[globalY * width + globalX] = (inputImage[globalY * width + globalX] * stride * stride > threshold) ? 255 : 0;
+    }
+}
+
+/*! Histograms of a batch of images packed one after another into one buffer, every work-group counts one image.
+ *  Every entry of the table holds the offset of the first pixel, the width and the height of one image.
+ *
+ * \param[in] images gray values of all images, one 8-bit value per pixel
+ * \param[in] table offset, width and height of every image
+ * \param[out] histograms 256 values for every image, written whole, no clearing is needed
+ */
+__kernel void histogramBatch(__global uchar* images, __global uint4* table, __global uint* histograms)
+{
+	__local uint localHistogram[HISTOGRAM_SIZE];
+
+	uint image = get_group_id(0);
+	uint localX = get_local_id(0);
+	uint localSize = get_local_size(0);
+
+	for (uint i = localX; i < HISTOGRAM_SIZE; i += localSize)
+	{
+		localHistogram[i] = 0;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint4 entry = table[image];
+	__global uchar* pixels = images + entry.x;
+	uint count = entry.y * entry.z;
+
+	for (uint i = localX; i < count; i += localSize)
+	{
+		atomic_inc(&localHistogram[pixels[i]]);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = localX; i < HISTOGRAM_SIZE; i += localSize)
+	{
+		histograms[image * HISTOGRAM_SIZE + i] = localHistogram[i];
+	}
+}
+
+/*! New pixel values of the equalization of every image of a batch, one work-group of HISTOGRAM_SIZE / 2 work items per image.
+ *
+ * \param[in] histograms 256 values for every image
+ * \param[out] newValues 256 new pixel values for every image
+ */
+__kernel void equalizeBatch1(__global uint* histograms, __global uint* newValues)
+{
+	__local ulong scan[HISTOGRAM_SIZE];
+
+	uint image = get_group_id(0);
+
+	equalizeLevels(histograms + image * HISTOGRAM_SIZE, newValues + image * HISTOGRAM_SIZE, scan);
+}
+
+/*! Otsu thresholds of every image of a batch turned into new pixel values, one work-group of HISTOGRAM_SIZE / 2
+ *  work items per image, so the output is written by the same applyBatch as of the equalization.
+ *
+ * \param[in] histograms 256 values for every image
+ * \param[out] newValues 256 new pixel values for every image, white above the threshold, black otherwise
+ */
+__kernel void thresholdBatch(__global uint* histograms, __global uint* newValues)
+{
+	__local ulong counts[HISTOGRAM_SIZE];
+	__local ulong moments[HISTOGRAM_SIZE];
+	__local float bestVariance[HISTOGRAM_SIZE / 2];
+	__local uint bestBin[HISTOGRAM_SIZE / 2];
+
+	uint image = get_group_id(0);
+	uint first = 2 * get_local_id(0);
+	uint second = first + 1;
+
+	uint value = otsuGroupThreshold(histograms + image * HISTOGRAM_SIZE, counts, moments, bestVariance, bestBin);
+
+	newValues[image * HISTOGRAM_SIZE + first] = (first > value) ? 255 : 0;
+	newValues[image * HISTOGRAM_SIZE + second] = (second > value) ? 255 : 0;
+}
+
+/*! Applies the new pixel values of every image of a batch. The second dimension of the grid is the image,
+ *  work-groups along the first dimension take tiles of BATCH_TILE_PIXELS consecutive pixels of it.
+ *
+ * \param[in] images gray values of all images, one 8-bit value per pixel
+ * \param[in] table offset, width and height of every image
+ * \param[in] newValues 256 new pixel values for every image
+ * \param[out] outputImages output images at the offsets of the input images
+ */
+__kernel void applyBatch(__global uchar* images, __global uint4* table, __global uint* newValues, __global uchar* outputImages)
+{
+	__local uchar levels[HISTOGRAM_SIZE];
+
+	uint image = get_global_id(1);
+	uint localX = get_local_id(0);
+	uint localSize = get_local_size(0);
+
+	uint4 entry = table[image];
+	uint first = get_group_id(0) * BATCH_TILE_PIXELS;
+	uint last = min(first + BATCH_TILE_PIXELS, entry.y * entry.z);
+
+	//tiles past the end of a smaller image have nothing to do, the whole work-group leaves
+	if (first >= last)
+		return;
+
+	for (uint i = localX; i < HISTOGRAM_SIZE; i += localSize)
+	{
+		levels[i] = (uchar) newValues[image * HISTOGRAM_SIZE + i];
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = first + localX; i < last; i += localSize)
+	{
+		outputImages[entry.x + i] = levels[images[entry.x + i]];
+	}
+}
@@ -5,6 +5,7 @@
 #include <CL/opencl.h>
 #include <stdlib.h>
 #include "cpu.h"
+#include "pgm.h"
 #include <ctime>
 #include <iostream>
 
@@ -17,47 +18,161 @@ using std::cout;
 
 cl_device_id *cdDevices = NULL;
 unsigned int deviceIndex = 0;
+cl_uint computeUnits = 1; //number of compute units of the selected device
 
 SDL_Surface *screen;
 
-cl_uchar4* h_inputImageData = NULL;
-cl_uchar4* h_gpu_outputImageData = NULL;
+cl_uchar* h_inputImageData = NULL; //one gray value per pixel
+cl_uchar* h_gpu_outputImageData = NULL;
 cl_uint* h_gpu_histogramData = NULL;
 cl_uint* h_gpu_histogramData2 = NULL;
 cl_uint* h_cpu_histogramData = NULL;
-cl_uchar4* h_cpu_outputImageData = NULL;
+cl_uchar* h_cpu_outputImageData = NULL;
+cl_uchar4* h_colorImageData = NULL; //rgba input, kept only for the multi-channel histogram and the colour equalization
+cl_uchar4* h_cpu_colorOutputData = NULL; //rgba output of the colour equalization
+cl_uchar4* h_gpu_colorOutputData = NULL;
+cl_uint* h_cpu_channelHistogramData = NULL;
+cl_uint* h_gpu_channelHistogramData = NULL;
 cl_uint* h_newValuesData = NULL; //mezivypocet pri ekvalizaci
 
+//images deeper than 8 bits or with other number of bins than 256 are processed by the wide functions
+cl_ushort* h_wideInputData = NULL; //one sample of bitDepth bits per pixel
+cl_ushort* h_cpu_wideOutputData = NULL;
+cl_ushort* h_gpu_wideOutputData = NULL;
+cl_uint* h_cpu_wideHistogramData = NULL;
+cl_uint* h_gpu_wideHistogramData = NULL;
+
+int bitDepth = 8; //bits per sample of the input image
+cl_uint numBins = HISTOGRAM_SIZE; //number of histogram bins, set by the bins option
+bool wideMode = false;
+
+//histograms of a rectangle of the image, optionally only of pixels with nonzero mask
+roi_t roi = { 0, 0, 0, 0 }; //counted rectangle, the whole image if not set by the roi option
+bool roiGiven = false;
+const char* maskName = NULL; //mask image set by the mask option
+bool roiMode = false;
+cl_uchar* h_maskData = NULL; //one 8-bit value per pixel, only pixels with nonzero value are counted
+
+//incremental histograms of a sequence of frames, the first frame is the input image and the others are listed in a file
+const char* framesName = NULL;
+const int HISTOGRAM_TILE_SIZE = 32; //tile width and height of the incremental histogram
+
+//many small images listed in a file are packed into one buffer and processed by one launch per stage
+const char* batchName = NULL;
+const size_t BATCH_MAX_PIXELS = 64 << 20; //larger lists are processed in several batches of at most this many pixels
+
+//segmentation with window histograms taken from the integral histogram
+int integralBins = 0; //number of bins of the integral histogram, 0 if not set by the integral option
+const size_t SEG_INTEGRAL_MEMORY = 64 << 20; //memory for one band of the integral histogram in bytes
+
+//approximate segmentation, thresholds only on a grid of nodes, interpolated for every pixel
+int segGridStride = 0; //distance of the grid nodes in pixels, 0 for the exact segmentation, set by the grid option
+
+//streaming of pgm images larger than memory, the image is read in bands of rows and never held whole
+const char* streamName = NULL; //output image set by the stream option
+int streamBandRows = 256; //number of rows of one band, set by the band option
+
+//equalize and otsu enqueued as one chain of kernels, only the output image is read back
+bool pipelineMode = false;
+bool pipelineTaps = false; //intermediate results are waited for and read back too, for debugging
+
+//histogram matching to a reference image or a stored histogram
+const char* referenceName = NULL; //set by the ref option
+cl_uint* h_referenceCumulativeData = NULL; //cumulative histogram of the reference, computed once
+
+//contrast-limited adaptive histogram equalization
+int claheTileSize = 64; //tile width and height, set by the tile option
+cl_uint claheClipLimit = 3 * CLAHE_CLIP_SCALE; //largest bin height in 1/CLAHE_CLIP_SCALE of the mean bin height, set by the clip option
+
+//otsu and segmentation write a packed binary mask, 32 pixels per word, set by the packed option
+bool packedMode = false;
+cl_uint* h_cpu_outputMaskData = NULL;
+cl_uint* h_gpu_outputMaskData = NULL;
+
+//multi-level otsu
+int otsuClasses = 2; //number of classes, more than two are searched by the thresholdMulti kernel, set by the classes option
+
 //width and height of the image
 int width = 0, height = 0;
 
 int localThreadsHistogram2a;
 int numSubHistograms;
-int globalThreadsHistogram2a;
+cl_uint pixelsPerGroupHistogram2a; //number of pixels counted to one sub-histogram
+
+const cl_uint HISTOGRAM_COPIES = 8; //number of local histogram copies in histogram3, same as in kernels.cl
+
+const cl_uint REDUCE_ROWS_PER_GROUP = 64; //number of partial histograms merged by one work group in one reduction pass
+const int MAX_REDUCE_PASSES = 8;
+
+const cl_uint WIDE_LOCAL_BINS = 4096; //number of bins counted in local memory by histogramWide, same as in kernels.cl
+const size_t WIDE_GROUP_SIZE = 256; //work group size of the one-group wide kernels, a power of two
 
-cl_uint pixelSize = 32; //rgba 8bits per channel
+cl_uint pixelSize = 32; //rgba 8bits per channel, only used for display
 
 //opencl stuff
 cl_context context;
 cl_command_queue commandQueue;
-cl_kernel histogramKernel1, histogramKernel2a, histogramKernel2b, equalizeKernel1, equalizeKernel2, thresholdKernel, thresholdingKernel, segKernel;
+cl_kernel histogramKernel1, histogramKernel2a, reduceHistogramsKernel, histogramKernel3, clearHistogramKernel, histogramRGBLKernel, equalizeKernel1, equalizeKernel2, thresholdKernel, thresholdMultiKernel, thresholdingKernel, segKernel;
+cl_kernel histogramWideKernel, equalizeWideKernel1, equalizeWideKernel2, thresholdWideKernel, thresholdingWideKernel;
+cl_kernel histogramROIKernel, tileHistogramUpdateKernel;
+cl_kernel claheTilesKernel, claheApplyKernel;
+cl_kernel thresholdingPackedKernel, segPackedKernel;
+cl_kernel segGridKernel, segInterpolateKernel;
+cl_kernel histogramBatchKernel, equalizeBatchKernel1, thresholdBatchKernel, applyBatchKernel;
+cl_kernel histogramLumaKernel, equalizeColorKernel;
+cl_kernel matchKernel1;
 cl_program program;
 
 /** CL memory buffer for images */
 cl_mem d_inputImageBuffer = NULL; 
 cl_mem d_histogramBuffer = NULL; 
 cl_mem d_subHistogramsBuffer = NULL;
+cl_mem d_colorImageBuffer = NULL; //rgba input for the multi-channel histogram and the colour equalization
+cl_mem d_colorOutputBuffer = NULL;
+cl_mem d_referenceCumulativeBuffer = NULL; //cumulative histogram of the reference, uploaded once
+cl_mem d_channelHistogramBuffer = NULL;
+cl_mem d_reduceBuffer = NULL; //intermediate results of the histogram reduction
+size_t reduceBufferSize = 0; //number of values that fit into d_reduceBuffer
+cl_mem d_batchImagesBuffer = NULL; //gray values of all images of a batch, kept for the following batches
+cl_mem d_batchOutputBuffer = NULL;
+size_t batchImagesSize = 0; //number of pixels that fit into the batch image buffers
+cl_mem d_batchTableBuffer = NULL;
+cl_mem d_batchHistogramsBuffer = NULL;
+cl_mem d_batchNewValuesBuffer = NULL;
+cl_uint batchTableSize = 0; //number of images that fit into the batch table, histogram and new value buffers
 cl_mem d_outputImageBuffer = NULL; 
+cl_mem d_outputMaskBuffer = NULL; //packed binary output of otsu and segmentation
 cl_mem d_newValuesBuffer = NULL; //mezivypocet pri ekvalizaci
 cl_mem d_threshold = NULL;
-
-cl_event event_histogram1, event_histogram2, event_equalize1, event_equalize2, event_threshold, event_thresholding, event_seg;
+cl_mem d_wideInputBuffer = NULL;
+cl_mem d_wideOutputBuffer = NULL;
+cl_mem d_wideHistogramBuffer = NULL;
+cl_mem d_wideNewValuesBuffer = NULL;
+cl_mem d_maskBuffer = NULL;
+cl_mem d_tileHistogramsBuffer = NULL; //histograms of all tiles of the last frame
+cl_mem d_tileChecksumsBuffer = NULL;
+cl_mem d_frameHistogramBuffer = NULL; //histogram of the last frame
+cl_mem d_changedTilesBuffer = NULL;
+cl_mem d_claheNewValuesBuffer = NULL; //new values of all clahe tiles
+cl_mem d_segGridBuffer = NULL; //thresholds of the grid nodes of the approximate segmentation
+
+cl_event event_histogram1, event_histogram2, event_clearHistogram, event_histogramRGBL, event_equalize1, event_equalize2, event_threshold, event_thresholding, event_seg;
+cl_event event_histogramWide, event_equalizeWide1, event_equalizeWide2, event_thresholdWide, event_thresholdingWide;
+cl_event event_tileHistogram;
+cl_event event_segGrid, event_segInterpolate;
+cl_event event_claheTiles, event_claheApply;
+cl_event event_equalizeColor;
+cl_event event_match1;
 
 /** Possible methods*/
 enum method_t {
 	EQUALIZE,
 	OTSU,
-    SEGMENTATION
+    SEGMENTATION,
+	CHANNEL_HISTOGRAM,
+	CLAHE,
+	COLOR_EQUALIZE,
+	MATCH
 };
 
 method_t method; //method for execution
@@ -91,6 +206,36 @@ int printTiming(cl_event event, const char* title){
     return 0;
 }
 
+/**
+ * Prints the time from the start of the first event to the end of the last one, for stages of several kernels
+ * @param firstEvent event of the first kernel of the stage
+ * @param lastEvent event of the last kernel of the stage
+ * @param title title of the printed line
+ */
+int printTimingSpan(cl_event firstEvent, cl_event lastEvent, const char* title)
+{
+	cl_ulong startTime;
+	cl_ulong endTime;
+
+	cl_int status = clGetEventProfilingInfo(firstEvent, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &startTime, 0);
+	CheckOpenCLError(status, "clGetEventProfilingInfo.(startTime)");
+
+	status = clGetEventProfilingInfo(lastEvent, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &endTime, 0);
+	CheckOpenCLError(status, "clGetEventProfilingInfo.(stopTime)");
+
+	printf("%s elapsedTime %.3lf ms\n", title, (endTime - startTime) * 1e-6);
+
+	return 0;
+}
+
+/**
+ * Returns true if the kernel stages have to wait for and read back their intermediate results, false in the pipeline mode without taps
+ */
+bool readIntermediate()
+{
+	return !pipelineMode || pipelineTaps;
+}
+
 char* loadProgSource(const char* cFilename)
 {
     // locals 
@@ -126,12 +271,25 @@ char* loadProgSource(const char* cFilename)
 }
 
 /**
- * Draw the output image to sdl surface
+ * Expand gray values to rgba pixels, used only for display
  */
-int drawOutputImage(SDL_Surface *screen){
+void expandToRGBA(const cl_uchar* grayData, cl_uchar4* imageData, int size)
+{
+	for (int i = 0; i < size; i++)
+	{
+		imageData[i].s[0] = grayData[i];
+		imageData[i].s[1] = grayData[i];
+		imageData[i].s[2] = grayData[i];
+		imageData[i].s[3] = 255;
+	}
+}
 
-	
-    SDL_Surface *temp = SDL_CreateRGBSurfaceFrom(h_gpu_outputImageData,
+/**
+ * Draw an rgba image to sdl surface
+ */
+int drawColorImage(SDL_Surface *screen, cl_uchar4* rgbaData){
+
+    SDL_Surface *temp = SDL_CreateRGBSurfaceFrom(rgbaData,
         width, height, pixelSize, width*4, 
         0x0000ff, 0x00ff00, 0xff0000, 0xff000000);
     SDL_Rect rec;
@@ -148,30 +306,49 @@ int drawOutputImage(SDL_Surface *screen){
     return 0;
 }
 
+/**
+ * Draw a gray image to sdl surface
+ */
+int drawGrayImage(SDL_Surface *screen, const cl_uchar* grayData){
+
+	cl_uchar4* rgbaData = (cl_uchar4*) malloc(width * height * sizeof(cl_uchar4));
+
+	if(rgbaData == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for display.");
+		return -1;
+	}
+
+	expandToRGBA(grayData, rgbaData, width * height);
+
+	int result = drawColorImage(screen, rgbaData);
+	free(rgbaData);
+    return result;
+}
+
+/**
+ * Draw the output image to sdl surface
+ */
+int drawOutputImage(SDL_Surface *screen){
+
+	if (method == COLOR_EQUALIZE)
+		return drawColorImage(screen, h_gpu_colorOutputData);
+
+	return drawGrayImage(screen, h_gpu_outputImageData);
+}
+
 /**
  * Draw the output image to sdl surface
  */
 int drawOutputImageCPU(SDL_Surface *screen){
 
-	
-    SDL_Surface *temp = SDL_CreateRGBSurfaceFrom(h_cpu_outputImageData,
-        width, height, pixelSize, width*4, 
-        0x0000ff, 0x00ff00, 0xff0000, 0xff000000);
-    SDL_Rect rec;
- 
-    rec.x = 0;
-    rec.y = 0;
-    rec.w = width;
-    rec.h = height;
-    
-    SDL_Surface *output = SDL_DisplayFormatAlpha(temp);
-    SDL_BlitSurface(output, &rec, screen, &rec);
-    SDL_FreeSurface(temp);
-    SDL_FreeSurface(output);
-    return 0;
+	if (method == COLOR_EQUALIZE)
+		return drawColorImage(screen, h_cpu_colorOutputData);
+
+	return drawGrayImage(screen, h_cpu_outputImageData);
 }
 
-void toGrayScale(cl_uchar4* imageData, int size)
+void toGrayScale(const cl_uchar4* imageData, cl_uchar* grayData, int size)
 {
 	for (int i = 0; i < size; i++)
 	{
@@ -179,18 +356,74 @@ void toGrayScale(cl_uchar4* imageData, int size)
 	    cl_uchar green = imageData[i].s[1];
 	    cl_uchar blue = imageData[i].s[2];
 
-		cl_uchar new_value = 0.299 * red + 0.587 * green + 0.114 * blue;
+		grayData[i] = luma(red, green, blue);
+	}
+}
+
+/**
+ * Scale wide samples to 8-bit gray values, used only for display
+ */
+void wideToGray(const cl_ushort* wideData, cl_uchar* grayData, int size)
+{
+	cl_uint maxValue = (1u << bitDepth) - 1;
 
-		imageData[i].s[0] = new_value;
-		imageData[i].s[1] = new_value;
-		imageData[i].s[2] = new_value;
+	for (int i = 0; i < size; i++)
+	{
+		grayData[i] = (cl_uchar) (wideData[i] * 255u / maxValue);
 	}
 }
 
 /**
- * Initialize stuff on the client side
+ * Read a binary pgm image to the wide input, the 8-bit input gets the samples scaled to 8 bits
  */
-int setupHost(const char *inputImageName)
+int readPGMImage(const char* inputImageName)
+{
+	pgm_t pgm;
+
+	if (openPGM(inputImageName, &pgm) != 0)
+	{
+		return -1;
+	}
+
+	width = pgm.width;
+	height = pgm.height;
+	bitDepth = pgm.bitDepth;
+
+	h_wideInputData = (cl_ushort*) malloc(width * height * sizeof(cl_ushort));
+	h_inputImageData = (cl_uchar*) malloc(width * height * sizeof(cl_uchar));
+
+	if (h_wideInputData == NULL || h_inputImageData == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+		closePGM(&pgm);
+		return -1;
+	}
+
+	int result = readPGMRows(&pgm, h_wideInputData, height);
+	if (result != 0)
+	{
+		if (result == -2)
+			logMessage(DEBUG_LEVEL_ERROR, "Image %s has a sample above maxval %d.", inputImageName, pgm.maxValue);
+		else
+			logMessage(DEBUG_LEVEL_ERROR, "Image %s is too short.", inputImageName);
+		closePGM(&pgm);
+		return -1;
+	}
+
+	closePGM(&pgm);
+
+	for (int i = 0; i < width * height; i++)
+	{
+		h_inputImageData[i] = (bitDepth > 8) ? (cl_uchar) (h_wideInputData[i] >> (bitDepth - 8)) : (cl_uchar) (h_wideInputData[i] << (8 - bitDepth));
+	}
+
+	return 0;
+}
+
+/**
+ * Read an image through SDL, the input is its gray version
+ */
+int readColorImage(const char* inputImageName)
 {
 	SDL_Surface *inputImage;
 
@@ -202,1061 +435,3878 @@ int setupHost(const char *inputImageName)
 	width = inputImage->w;
 	height = inputImage->h;
 
-	localThreadsHistogram2a = 128;
-	globalThreadsHistogram2a = (width * height) / HISTOGRAM_SIZE; //512 * 512 / 256 = 1024
-	
-	numSubHistograms = ((globalThreadsHistogram2a + localThreadsHistogram2a - 1)/localThreadsHistogram2a); //globalThreadsHistogram2a / localThreadsHistogram2a;
-
 	//allocate input image
 
-	h_inputImageData = (cl_uchar4*) malloc(width * height * sizeof(cl_uchar4));
+	h_inputImageData = (cl_uchar*) malloc(width * height * sizeof(cl_uchar));
 
 	if(h_inputImageData == NULL)
 	{
 		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+		SDL_FreeSurface(inputImage);
 		return -1;
 	}
 
-	memcpy(h_inputImageData, inputImage->pixels, width * height * sizeof(cl_uchar4));
-
-	SDL_FreeSurface(inputImage);
-
 	// prevod na grayscale format
 
-	toGrayScale(h_inputImageData, width * height);
+	toGrayScale((cl_uchar4*) inputImage->pixels, h_inputImageData, width * height);
 
-	//allocate output image
+	if (method == CHANNEL_HISTOGRAM)
+	{
+		//the multi-channel histogram needs the colours
+		h_colorImageData = (cl_uchar4*) malloc(width * height * sizeof(cl_uchar4));
+		h_cpu_channelHistogramData = (cl_uint*) malloc(HISTOGRAM_CHANNELS * HISTOGRAM_SIZE * sizeof(cl_uint));
+		h_gpu_channelHistogramData = (cl_uint*) malloc(HISTOGRAM_CHANNELS * HISTOGRAM_SIZE * sizeof(cl_uint));
+
+		if(h_colorImageData == NULL || h_cpu_channelHistogramData == NULL || h_gpu_channelHistogramData == NULL)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for multi-channel histogram.");
+			SDL_FreeSurface(inputImage);
+			return -1;
+		}
 
-	h_gpu_outputImageData = (cl_uchar4 *) malloc(width * height * sizeof(cl_uchar4));
+		memcpy(h_colorImageData, inputImage->pixels, width * height * sizeof(cl_uchar4));
+	}
 
-	if(h_gpu_outputImageData == NULL)
+	if (method == COLOR_EQUALIZE)
 	{
-		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
-		return -1;
+		//the colour equalization keeps the chroma of the input
+		h_colorImageData = (cl_uchar4*) malloc(width * height * sizeof(cl_uchar4));
+		h_cpu_colorOutputData = (cl_uchar4*) calloc(width * height, sizeof(cl_uchar4));
+		h_gpu_colorOutputData = (cl_uchar4*) calloc(width * height, sizeof(cl_uchar4));
+
+		if(h_colorImageData == NULL || h_cpu_colorOutputData == NULL || h_gpu_colorOutputData == NULL)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for colour equalization.");
+			SDL_FreeSurface(inputImage);
+			return -1;
+		}
+
+		memcpy(h_colorImageData, inputImage->pixels, width * height * sizeof(cl_uchar4));
 	}
 
-	memset(h_gpu_outputImageData, 0, width * height * sizeof(cl_uchar4));
+	SDL_FreeSurface(inputImage);
+
+	return 0;
+}
 
-	h_cpu_outputImageData = (cl_uchar4 *) malloc(width * height * sizeof(cl_uchar4));
+/**
+ * Decide whether the wide functions are needed and check that they can be used
+ */
+int setupWideMode()
+{
+	wideMode = bitDepth > 8 || numBins != HISTOGRAM_SIZE;
 
-	if(h_cpu_outputImageData == NULL)
+	if (!wideMode)
 	{
-		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
-		return -1;
+		return 0;
 	}
 
-	memset(h_cpu_outputImageData, 0, width * height * sizeof(cl_uchar4));
+	if (method != EQUALIZE && method != OTSU)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Only equalize and otsu support images deeper than 8 bits and other number of bins than %u.", HISTOGRAM_SIZE);
+		return -1;
+	}
 
-	//allocate cpu histogram
+	if (otsuClasses > 2 || packedMode || batchName != NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Multi-level otsu, packed mask and batch support only 8-bit images with %u bins.", HISTOGRAM_SIZE);
+		return -1;
+	}
 
-	h_cpu_histogramData = (cl_uint *) malloc(HISTOGRAM_SIZE * sizeof(cl_uint));
+	if (pipelineMode)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Pipeline supports only 8-bit images with %u bins.", HISTOGRAM_SIZE);
+		return -1;
+	}
 
-	if(h_cpu_histogramData == NULL)
+	if (numBins > (1u << bitDepth))
 	{
-		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for cpu histogram result data.");
+		logMessage(DEBUG_LEVEL_ERROR, "Number of bins %u is larger than the number of values of a %d-bit image.", numBins, bitDepth);
 		return -1;
 	}
 
-	memset(h_cpu_histogramData, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+	printf("Processing %d-bit image with %u bins, the histogram method is not used.\n", bitDepth, numBins);
 
-	//allocate gpu histogram
+	//8-bit images are widened, deeper ones were read to the wide input already
+	if (h_wideInputData == NULL)
+	{
+		h_wideInputData = (cl_ushort*) malloc(width * height * sizeof(cl_ushort));
 
-	h_gpu_histogramData = (cl_uint *) malloc(HISTOGRAM_SIZE * sizeof(cl_uint));
+		if (h_wideInputData == NULL)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+			return -1;
+		}
 
-	if(h_gpu_histogramData == NULL)
+		for (int i = 0; i < width * height; i++)
+		{
+			h_wideInputData[i] = h_inputImageData[i];
+		}
+	}
+
+	h_cpu_wideOutputData = (cl_ushort*) calloc(width * height, sizeof(cl_ushort));
+	h_gpu_wideOutputData = (cl_ushort*) calloc(width * height, sizeof(cl_ushort));
+	h_cpu_wideHistogramData = (cl_uint*) calloc(numBins, sizeof(cl_uint));
+	h_gpu_wideHistogramData = (cl_uint*) calloc(numBins, sizeof(cl_uint));
+
+	if (h_cpu_wideOutputData == NULL || h_gpu_wideOutputData == NULL || h_cpu_wideHistogramData == NULL || h_gpu_wideHistogramData == NULL)
 	{
-		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for gpu histogram result data.");
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for wide results.");
 		return -1;
 	}
 
-	memset(h_gpu_histogramData, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+	return 0;
+}
 
-	//allocate gpu histogram 2
+/**
+ * Check the rectangle and load the mask if the histograms are computed only of a part of the image
+ */
+int setupROIMode()
+{
+	roiMode = roiGiven || maskName != NULL;
 
-	h_gpu_histogramData2 = (cl_uint *) malloc(numSubHistograms * HISTOGRAM_SIZE * sizeof(cl_uint));
+	if (!roiMode)
+	{
+		return 0;
+	}
 
-	if(h_gpu_histogramData2 == NULL)
+	if ((method != EQUALIZE && method != OTSU && method != MATCH) || wideMode)
 	{
-		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for gpu histogram result data 2.");
+		logMessage(DEBUG_LEVEL_ERROR, "Rectangle and mask are supported only by equalize, otsu and match of 8-bit images with %u bins.", HISTOGRAM_SIZE);
 		return -1;
 	}
 
-	memset(h_gpu_histogramData2, 0, ((width *height) / (HISTOGRAM_SIZE * localThreadsHistogram2a)) * HISTOGRAM_SIZE * sizeof(cl_uint));
+	if (!roiGiven)
+	{
+		roi.x = 0;
+		roi.y = 0;
+		roi.width = width;
+		roi.height = height;
+	}
+	else if (roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 || roi.x + roi.width > width || roi.y + roi.height > height)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Rectangle %d,%d,%d,%d does not lie inside the %dx%d image.", roi.x, roi.y, roi.width, roi.height, width, height);
+		return -1;
+	}
 
-	//allocate array for new values after equalization
+	if (maskName != NULL)
+	{
+		SDL_Surface *maskImage;
 
-	h_newValuesData = (cl_uint *) malloc(HISTOGRAM_SIZE * sizeof(cl_uint));
+		if (readImage(maskName, &maskImage) < 0)
+		{
+			return -1;
+		}
 
-	if(h_newValuesData == NULL)
+		if (maskImage->w != width || maskImage->h != height)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Mask %s has to be as large as the image.", maskName);
+			SDL_FreeSurface(maskImage);
+			return -1;
+		}
+
+		h_maskData = (cl_uchar*) malloc(width * height * sizeof(cl_uchar));
+
+		if (h_maskData == NULL)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for mask.");
+			SDL_FreeSurface(maskImage);
+			return -1;
+		}
+
+		toGrayScale((cl_uchar4*) maskImage->pixels, h_maskData, width * height);
+		SDL_FreeSurface(maskImage);
+	}
+
+	//equalization and otsu divide by the number of counted pixels
+	cl_uint roiHistogram[HISTOGRAM_SIZE];
+
+	cl_uint count = histogramROI(h_inputImageData, width, roi, h_maskData, roiHistogram);
+
+	if (count == 0)
 	{
-		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for equalized histogram result data.");
+		logMessage(DEBUG_LEVEL_ERROR, "No pixel of the rectangle has nonzero mask.");
 		return -1;
 	}
 
-	memset(h_newValuesData, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+	printf("Counting %u pixels of the rectangle %d,%d,%d,%d.\n", count, roi.x, roi.y, roi.width, roi.height);
 
 	return 0;
 }
 
 /**
- * Initialize host and opencl device
+ * First pass of the streaming, reads the pgm image band by band and counts its histogram
+ * @return 0 on success, -1 if the image can not be read
  */
-int setupCL()
+int streamHistogram(const char* inputImageName, cl_ushort* inputBand, int bandRows, cl_uint* streamHistogramData, int shift)
 {
-	cl_int ciErr = CL_SUCCESS;
-
-	// Get Platform
-	cl_platform_id *cpPlatforms;
-	cl_uint cuiPlatformsCount;
-	ciErr = clGetPlatformIDs(0, NULL, &cuiPlatformsCount); CheckOpenCLError( ciErr, "clGetPlatformIDs: cuiPlatformsNum=%i", cuiPlatformsCount );
-	cpPlatforms = (cl_platform_id*)malloc(cuiPlatformsCount*sizeof(cl_platform_id));
-	ciErr = clGetPlatformIDs(cuiPlatformsCount, cpPlatforms, NULL); CheckOpenCLError( ciErr, "clGetPlatformIDs" );
-	
-	cl_platform_id platform = 0;
+	pgm_t input;
 
-	const unsigned int TMP_BUFFER_SIZE = 1024;
-	char sTmp[TMP_BUFFER_SIZE];
+	if (openPGM(inputImageName, &input) != 0)
+	{
+		return -1;
+	}
 
-	for(unsigned int f0=0; f0<cuiPlatformsCount; f0++){
-		bool shouldBrake = false;
-		ciErr = clGetPlatformInfo (cpPlatforms[f0], CL_PLATFORM_PROFILE, TMP_BUFFER_SIZE, sTmp, NULL);    CheckOpenCLError( ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_PROFILE=%s",f0, sTmp);
-		ciErr = clGetPlatformInfo (cpPlatforms[f0], CL_PLATFORM_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);    CheckOpenCLError( ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_VERSION=%s",f0, sTmp);
-		ciErr = clGetPlatformInfo (cpPlatforms[f0], CL_PLATFORM_NAME, TMP_BUFFER_SIZE, sTmp, NULL);       CheckOpenCLError( ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_NAME=%s",f0, sTmp);
-		ciErr = clGetPlatformInfo (cpPlatforms[f0], CL_PLATFORM_VENDOR, TMP_BUFFER_SIZE, sTmp, NULL);     CheckOpenCLError( ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_VENDOR=%s",f0, sTmp);
+	for (int y = 0; y < input.height; y += bandRows)
+	{
+		int rows = MIN(bandRows, input.height - y);
 
-		//prioritize AMD and CUDA platforms
-		
-		if ((strcmp(sTmp, "Advanced Micro Devices, Inc.") == 0) || (strcmp(sTmp, "NVIDIA Corporation") == 0)) {
-			platform = cpPlatforms[f0];
+		int result = readPGMRows(&input, inputBand, rows);
+		if (result != 0)
+		{
+			if (result == -2)
+				logMessage(DEBUG_LEVEL_ERROR, "Image %s has a sample above maxval %d in rows %d to %d.", inputImageName, input.maxValue, y, y + rows - 1);
+			else
+				logMessage(DEBUG_LEVEL_ERROR, "Image %s is too short.", inputImageName);
+			closePGM(&input);
+			return -1;
 		}
-		
-		//prioritize Intel
-		/*if ((strcmp(sTmp, "Intel(R) Corporation") == 0)) {
-			platform = cpPlatforms[f0];
-		}*/
 
-		ciErr = clGetPlatformInfo (cpPlatforms[f0], CL_PLATFORM_EXTENSIONS, TMP_BUFFER_SIZE, sTmp, NULL); CheckOpenCLError( ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_EXTENSIONS=%s",f0, sTmp);
-		printf("\n");
+		histogramWideAccumulate(inputBand, (size_t) input.width * rows, streamHistogramData, shift);
 	}
 
-	if(platform == 0)
-	{ //no prioritized found
-		if(cuiPlatformsCount > 0)
-		{ 
-			platform = cpPlatforms[0];
-		} else {
-			logMessage(DEBUG_LEVEL_ERROR, "No device was found");
-			return -1;
-		}
+	closePGM(&input);
+
+	return 0;
+}
+
+/**
+ * Second pass of the streaming, reads the pgm image band by band and writes the new values of its samples
+ * @return 0 on success, -1 if the image can not be read or written
+ */
+int streamApply(const char* inputImageName, cl_ushort* inputBand, cl_ushort* outputBand, int bandRows, const cl_ushort* newValues, int shift)
+{
+	pgm_t input;
+	pgm_t output;
+
+	if (openPGM(inputImageName, &input) != 0)
+	{
+		return -1;
 	}
-	// Get Devices
-	cl_uint cuiDevicesCount;
-	ciErr = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &cuiDevicesCount); CheckOpenCLError( ciErr, "clGetDeviceIDs: cuiDevicesCount=%i", cuiDevicesCount );
-	cdDevices = (cl_device_id*)malloc(cuiDevicesCount*sizeof(cl_device_id));
-	ciErr = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, cuiDevicesCount, cdDevices, NULL); CheckOpenCLError( ciErr, "clGetDeviceIDs" );
-	
-	//unsigned int deviceIndex = 0;
 
-	for(unsigned int f0=0; f0<cuiDevicesCount; f0++){
-		cl_device_type cdtTmp;
-		size_t iDim[3];
+	if (createPGM(streamName, input.width, input.height, (1 << input.bitDepth) - 1, &output) != 0)
+	{
+		closePGM(&input);
+		return -1;
+	}
 
-		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_TYPE, sizeof(cdtTmp), &cdtTmp, NULL);
-		CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_TYPE=%s%s%s%s",f0, cdtTmp&CL_DEVICE_TYPE_CPU?"CPU,":"", 
-			cdtTmp&CL_DEVICE_TYPE_GPU?"GPU,":"", 
-			cdtTmp&CL_DEVICE_TYPE_ACCELERATOR?"ACCELERATOR,":"", 
-			cdtTmp&CL_DEVICE_TYPE_DEFAULT?"DEFAULT,":"");
+	int result = 0;
 
-		if(cdtTmp & CL_DEVICE_TYPE_GPU)
-		{ //prioritize gpu if both cpu and gpu are available
-			deviceIndex = f0;
+	for (int y = 0; y < input.height && result == 0; y += bandRows)
+	{
+		int rows = MIN(bandRows, input.height - y);
+
+		result = readPGMRows(&input, inputBand, rows);
+		if (result != 0)
+		{
+			if (result == -2)
+				logMessage(DEBUG_LEVEL_ERROR, "Image %s has a sample above maxval %d in rows %d to %d.", inputImageName, input.maxValue, y, y + rows - 1);
+			else
+				logMessage(DEBUG_LEVEL_ERROR, "Image %s is too short.", inputImageName);
+			result = -1;
+			break;
 		}
 
-		cl_bool bTmp;
-		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_AVAILABLE, sizeof(bTmp), &bTmp, NULL);             CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_AVAILABLE=%s",f0, bTmp?"YES":"NO");
-		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_NAME, TMP_BUFFER_SIZE, sTmp, NULL);                CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_NAME=%s",f0, sTmp);
-		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_VENDOR, TMP_BUFFER_SIZE, sTmp, NULL);              CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_VENDOR=%s",f0, sTmp);
-		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DRIVER_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);             CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DRIVER_VERSION=%s",f0, sTmp);
-		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_PROFILE, TMP_BUFFER_SIZE, sTmp, NULL);             CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_PROFILE=%s",f0, sTmp);
-		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);             CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_VERSION=%s",f0, sTmp);
-		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(iDim), iDim, NULL);    CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_MAX_WORK_ITEM_SIZES=%ix%ix%i",f0, iDim[0], iDim[1], iDim[2]);
-		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), iDim, NULL);  CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_MAX_WORK_GROUP_SIZE=%i",f0, iDim[0]);
-		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_EXTENSIONS, TMP_BUFFER_SIZE, sTmp, NULL);          CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_EXTENSIONS=%s",f0, sTmp);
-		printf("\n");
+		applyWideLUT(inputBand, outputBand, (size_t) input.width * rows, newValues, shift);
+
+		if (writePGMRows(&output, outputBand, rows) != 0)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Unable to write image %s.", streamName);
+			result = -1;
+		}
 	}
 
-	cl_context_properties cps[3] = 
-    { 
-        CL_CONTEXT_PLATFORM, 
-        (cl_context_properties)platform, 
-        0 
-    };
+	closePGM(&input);
+	closePGM(&output);
 
-	//create context
-	context = clCreateContext(cps, 1, &cdDevices[deviceIndex], NULL, NULL, &ciErr);  CheckOpenCLError( ciErr, "clCreateContext" );
-	//may use clCreateContextFromType than choose a device based on the returned devices
-	
-	//create a command queue
-	commandQueue = clCreateCommandQueue(context, cdDevices[deviceIndex], 
-			CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &ciErr); 
-	CheckOpenCLError( ciErr, "clCreateCommandQueue" );
+	return result;
+}
 
-	//==================================================================================
-	//allocate and initialize memory buffers
+/**
+ * Equalization or otsu of a pgm image in two passes over bands of rows, the first pass computes the histogram
+ * and the second one applies the new values and writes the output, memory is bounded by the band size
+ */
+int runStreaming(const char* inputImageName)
+{
+	pgm_t input;
 
-	//we are only going to read from this
-	d_inputImageBuffer = clCreateBuffer(context,
-										CL_MEM_READ_ONLY,
-										width * height * pixelSize,
-										0,
-										&ciErr);
-	CheckOpenCLError(ciErr, "CreateBuffer inputImage");
+	//only the header is needed here
+	if (openPGM(inputImageName, &input) != 0)
+	{
+		return -1;
+	}
 
-	//write our image to the buffer
-	// Write Data to inputImageBuffer - blocking write
-    ciErr = clEnqueueWriteBuffer(commandQueue,
-                                  d_inputImageBuffer,
-                                  CL_TRUE, //blocking write
-                                  0,
-                                  width * height * sizeof(cl_uchar4),
-                                  h_inputImageData,
-                                  0,
-                                  0,
-                                  0);
+	closePGM(&input);
 
-	CheckOpenCLError(ciErr, "Copy input image data");
+	if (numBins > (1u << input.bitDepth))
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Number of bins %u is larger than the number of values of a %d-bit image.", numBins, input.bitDepth);
+		return -1;
+	}
 
-	//output image buffer - write only
-	d_outputImageBuffer = clCreateBuffer(context,
-										CL_MEM_WRITE_ONLY,
-										width * height * pixelSize,
-										0,
-										&ciErr);
-	CheckOpenCLError(ciErr, "Allocate output buffer");
+	int bandRows = MIN(streamBandRows, input.height);
+	size_t bandSamples = (size_t) input.width * bandRows;
+	int shift = binShift(input.bitDepth, numBins);
 
-	//histogram buffer
-	d_histogramBuffer = clCreateBuffer(context,
-										CL_MEM_READ_WRITE,
-										HISTOGRAM_SIZE * sizeof(cl_uint), // Histogram result - unsigned integer values (colors of grey) of occurence
-										0, &ciErr);
-	CheckOpenCLError(ciErr, "Allocate histogram buffer");
+	cl_ushort* inputBand = (cl_ushort*) malloc(bandSamples * sizeof(cl_ushort));
+	cl_ushort* outputBand = (cl_ushort*) malloc(bandSamples * sizeof(cl_ushort));
+	cl_uint* streamHistogramData = (cl_uint*) calloc(numBins, sizeof(cl_uint));
+	cl_ushort* newValues = (cl_ushort*) malloc(numBins * sizeof(cl_ushort));
 
-	//histogram buffer 2
-	if (histogramMethod == 2)
+	int result = -1;
+
+	if (inputBand == NULL || outputBand == NULL || streamHistogramData == NULL || newValues == NULL)
 	{
-	    d_subHistogramsBuffer = clCreateBuffer(context,
-										CL_MEM_READ_WRITE,
-										((width *height) / (HISTOGRAM_SIZE * localThreadsHistogram2a)) * HISTOGRAM_SIZE * sizeof(cl_uint), // Histogram result - unsigned integer values (colors of grey) of occurence
-										0, &ciErr);
-	    CheckOpenCLError(ciErr, "Allocate subhistograms buffer");
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for bands.");
 	}
+	else
+	{
+		printf("Streaming %dx%d %d-bit image in bands of %d rows, %u bins, %.1f MB of image data in memory.\n",
+			input.width, input.height, input.bitDepth, bandRows, numBins, 2.0 * bandSamples * sizeof(cl_ushort) / (1 << 20));
 
-	//eq histogram buffer
-	d_newValuesBuffer = clCreateBuffer(context,
-										CL_MEM_READ_WRITE,
-										HISTOGRAM_SIZE * sizeof(cl_uint), // Histogram result - unsigned integer values (colors of grey) of occurence
-										0, &ciErr);
-	CheckOpenCLError(ciErr, "Allocate eq histogram buffer");
+		volatile double t1 = getTime();
+		result = streamHistogram(inputImageName, inputBand, bandRows, streamHistogramData, shift);
+		volatile double t2 = getTime();
+		printf("CPU streaming histogram:  elapsedTime %.3lf ms\n", (t2 - t1) * 1000.0f);
 
-	//treshhold
-	d_threshold  = clCreateBuffer(context,
-										CL_MEM_READ_WRITE,
-										sizeof(cl_ulong),
-										0, &ciErr);
-	CheckOpenCLError(ciErr, "Allocate eq treshhold buffer");	
-	
+		if (result == 0)
+		{
+			if (method == EQUALIZE)
+			{
+				equalizeWideLUT(streamHistogramData, input.bitDepth, numBins, newValues);
+			}
+			else
+			{
+				cl_uint threshold = otsuWideLUT(streamHistogramData, input.bitDepth, numBins, newValues);
+				printf("Otsu threshold bin %u\n", threshold);
+			}
+
+			t1 = getTime();
+			result = streamApply(inputImageName, inputBand, outputBand, bandRows, newValues, shift);
+			t2 = getTime();
+			printf("CPU streaming %s:  elapsedTime %.3lf ms\n", (method == EQUALIZE) ? "equalize" : "otsu", (t2 - t1) * 1000.0f);
+		}
+	}
 
-	//=================================================================================
-	// Create and compile and openCL program
+	free(inputBand);
+	free(outputBand);
+	free(streamHistogramData);
+	free(newValues);
 
-	char *cSourceCL = loadProgSource("kernels.cl");
-	
-	program = clCreateProgramWithSource(context, 1, (const char **)&cSourceCL, NULL, &ciErr);  CheckOpenCLError( ciErr, "clCreateProgramWithSource" );
-	free(cSourceCL);
+	return result;
+}
 
-	ciErr = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-	
-	cl_int logStatus;
+/**
+ * Read the histogram of the reference image for the histogram matching.
+ * The reference is either a text file .hist with 256 counts or an image, pgm images are scaled to 8 bits.
+ */
+int readReferenceHistogram(const char* name, cl_uint* referenceHistogram)
+{
+	size_t nameLength = strlen(name);
 
-	//build log
-    char *buildLog = NULL;
-    size_t buildLogSize = 0;
-    logStatus = clGetProgramBuildInfo( program, 
-										cdDevices[deviceIndex], 
-										CL_PROGRAM_BUILD_LOG, 
-										buildLogSize, 
-										buildLog, 
-										&buildLogSize);
-	
-	CheckOpenCLError(logStatus, "clGetProgramBuildInfo.");
+	if (nameLength > 5 && !strcmp(name + nameLength - 5, ".hist"))
+	{
+		FILE* file = fopen(name, "r");
+		if (file == NULL)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Failed to open reference histogram %s.", name);
+			return -1;
+		}
 
-    buildLog = (char*)malloc(buildLogSize);
-    if(buildLog == NULL)
-    {
-        printf("Failed to allocate host memory. (buildLog)");
-        return -1;
-    }
-    memset(buildLog, 0, buildLogSize);
+		for (cl_uint i = 0; i < HISTOGRAM_SIZE; i++)
+		{
+			if (fscanf(file, "%u", &referenceHistogram[i]) != 1)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Reference histogram %s has to have %u counts.", name, HISTOGRAM_SIZE);
+				fclose(file);
+				return -1;
+			}
+		}
 
-    logStatus = clGetProgramBuildInfo (program, 
-										cdDevices[deviceIndex], 
-										CL_PROGRAM_BUILD_LOG, 
-										buildLogSize, 
-										buildLog, 
-										NULL);
-	CheckOpenCLError(logStatus, "clGetProgramBuildInfo.");
+		fclose(file);
+		return 0;
+	}
 
-    printf(" \n\t\t\tBUILD LOG\n");
-    printf(" ************************************************\n");
-    printf("%s", buildLog);
-    printf(" ************************************************\n");
-    free(buildLog);
-	
-	CheckOpenCLError( ciErr, "clBuildProgram" );
+	int referenceWidth, referenceHeight;
+	cl_uchar* grayData = NULL;
 
-	//==========================================================================
-	// kernels
-	equalizeKernel1 = clCreateKernel(program, "equalize1", &ciErr);
-	CheckOpenCLError( ciErr, "clCreateKernel equalize1" );
-	histogramKernel1 = clCreateKernel(program, "histogram1", &ciErr);
-	CheckOpenCLError( ciErr, "clCreateKernel histogram1" );
-	histogramKernel2a = clCreateKernel(program, "histogram2a", &ciErr);
-	CheckOpenCLError( ciErr, "clCreateKernel histogram2a" );
-	histogramKernel2b = clCreateKernel(program, "histogram2b", &ciErr);
-	CheckOpenCLError( ciErr, "clCreateKernel histogram2b" );
-	equalizeKernel2 = clCreateKernel(program, "equalize2", &ciErr);
-	CheckOpenCLError( ciErr, "clCreateKernel equalize2" );
-	thresholdKernel = clCreateKernel(program, "threshold", &ciErr);
-	CheckOpenCLError( ciErr, "clCreateKernel threshold" );
-	thresholdingKernel = clCreateKernel(program, "thresholding", &ciErr);
-	CheckOpenCLError( ciErr, "clCreateKernel thresholding" );
-    segKernel = clCreateKernel(program, "segmentation", &ciErr);
-	CheckOpenCLError( ciErr, "clCreateKernel segmentation" );
+	if (nameLength > 4 && !strcmp(name + nameLength - 4, ".pgm"))
+	{
+		pgm_t pgm;
+		if (openPGM(name, &pgm) != 0)
+			return -1;
+
+		referenceWidth = pgm.width;
+		referenceHeight = pgm.height;
+
+		cl_ushort* samples = (cl_ushort*) malloc(referenceWidth * referenceHeight * sizeof(cl_ushort));
+		grayData = (cl_uchar*) malloc(referenceWidth * referenceHeight * sizeof(cl_uchar));
+
+		if (samples == NULL || grayData == NULL || readPGMRows(&pgm, samples, referenceHeight) != 0)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Failed to read reference image %s.", name);
+			free(samples);
+			free(grayData);
+			closePGM(&pgm);
+			return -1;
+		}
+
+		closePGM(&pgm);
+
+		for (int i = 0; i < referenceWidth * referenceHeight; i++)
+		{
+			grayData[i] = (pgm.bitDepth > 8) ? (cl_uchar) (samples[i] >> (pgm.bitDepth - 8)) : (cl_uchar) (samples[i] << (8 - pgm.bitDepth));
+		}
+
+		free(samples);
+	}
+	else
+	{
+		SDL_Surface* referenceImage;
+		if (readImage(name, &referenceImage) < 0)
+			return -1;
+
+		referenceWidth = referenceImage->w;
+		referenceHeight = referenceImage->h;
+
+		grayData = (cl_uchar*) malloc(referenceWidth * referenceHeight * sizeof(cl_uchar));
+		if (grayData == NULL)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for reference image.");
+			SDL_FreeSurface(referenceImage);
+			return -1;
+		}
+
+		toGrayScale((cl_uchar4*) referenceImage->pixels, grayData, referenceWidth * referenceHeight);
+		SDL_FreeSurface(referenceImage);
+	}
+
+	histogram(grayData, referenceHistogram, referenceWidth, referenceHeight);
+	free(grayData);
 
 	return 0;
 }
 
-int checkWorkgroupSize(cl_kernel &pkernel, size_t &blockSizeX, size_t &blockSizeY)
+/**
+ * Read the reference of the histogram matching and compute its cumulative histogram, once for all matched images
+ */
+int setupReference()
 {
-	cl_int ciErr = CL_SUCCESS;
-	size_t maxKernelWorkGroupSize;
-	ciErr = clGetKernelWorkGroupInfo(pkernel,
-									cdDevices[deviceIndex], //this only workes if single device
-									CL_KERNEL_WORK_GROUP_SIZE,
-									sizeof(size_t),
-									&maxKernelWorkGroupSize,
-									0);
-	CheckOpenCLError(ciErr, "clGetKernelInfo %u", maxKernelWorkGroupSize);
-   
-	if((blockSizeX * blockSizeY) > maxKernelWorkGroupSize)
-    {
-        printf("Out of Resources!\n");
-        printf("Group Size specified: %i\n", blockSizeX * blockSizeY);
-        printf("Max Group Size supported on the kernel: %i\n", maxKernelWorkGroupSize);
-        printf("Falling back to %i.\n", maxKernelWorkGroupSize);
+	if (method != MATCH)
+	{
+		return 0;
+	}
 
-        if(blockSizeX > maxKernelWorkGroupSize)
-        {
-            blockSizeX = maxKernelWorkGroupSize;
-            blockSizeY = 1;
-			return EXIT_FAILURE;
-        }
-    }
-	
-	return EXIT_SUCCESS;	
+	if (referenceName == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Histogram matching needs a reference, ref=<image or .hist>.");
+		return -1;
+	}
+
+	cl_uint referenceHistogram[HISTOGRAM_SIZE];
+	h_referenceCumulativeData = (cl_uint*) malloc(HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	if (h_referenceCumulativeData == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+		return -1;
+	}
+
+	if (readReferenceHistogram(referenceName, referenceHistogram) != 0)
+	{
+		return -1;
+	}
+
+	cumulativeHistogram(referenceHistogram, h_referenceCumulativeData);
+
+	if (h_referenceCumulativeData[HISTOGRAM_SIZE - 1] == 0)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Reference histogram %s is empty.", referenceName);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Initialize stuff on the client side
+ */
+int setupHost(const char *inputImageName)
+{
+	size_t nameLength = strlen(inputImageName);
+
+	if (nameLength > 4 && !strcmp(inputImageName + nameLength - 4, ".pgm"))
+	{
+		//pgm images may have up to 16 bits per sample
+		if (readPGMImage(inputImageName) != 0)
+		{
+			return -1;
+		}
+
+		if (method == CHANNEL_HISTOGRAM || method == COLOR_EQUALIZE)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Multi-channel histogram and colour equalization need a colour image.");
+			return -1;
+		}
+	}
+	else if (readColorImage(inputImageName) != 0)
+	{
+		return -1;
+	}
+
+	if (setupWideMode() != 0 || setupROIMode() != 0 || setupReference() != 0)
+	{
+		return -1;
+	}
+
+	localThreadsHistogram2a = 128;
+	pixelsPerGroupHistogram2a = localThreadsHistogram2a * HISTOGRAM_SIZE; //every work item counts 256 pixels
+
+	numSubHistograms = (width * height + pixelsPerGroupHistogram2a - 1) / pixelsPerGroupHistogram2a; //one sub-histogram per work group, the last one may be partial
+
+	//allocate output image
+
+	h_gpu_outputImageData = (cl_uchar *) malloc(width * height * sizeof(cl_uchar));
+
+	if(h_gpu_outputImageData == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+		return -1;
+	}
+
+	memset(h_gpu_outputImageData, 0, width * height * sizeof(cl_uchar));
+
+	h_cpu_outputImageData = (cl_uchar *) malloc(width * height * sizeof(cl_uchar));
+
+	if(h_cpu_outputImageData == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+		return -1;
+	}
+
+	memset(h_cpu_outputImageData, 0, width * height * sizeof(cl_uchar));
+
+	//packed masks, unpacked to the output images only for display
+	if (packedMode)
+	{
+		h_cpu_outputMaskData = (cl_uint*) calloc((size_t) maskPitch(width) * height, sizeof(cl_uint));
+		h_gpu_outputMaskData = (cl_uint*) calloc((size_t) maskPitch(width) * height, sizeof(cl_uint));
+
+		if (h_cpu_outputMaskData == NULL || h_gpu_outputMaskData == NULL)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory.");
+			return -1;
+		}
+	}
+
+	//allocate cpu histogram
+
+	h_cpu_histogramData = (cl_uint *) malloc(HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	if(h_cpu_histogramData == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for cpu histogram result data.");
+		return -1;
+	}
+
+	memset(h_cpu_histogramData, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	//allocate gpu histogram
+
+	h_gpu_histogramData = (cl_uint *) malloc(HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	if(h_gpu_histogramData == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for gpu histogram result data.");
+		return -1;
+	}
+
+	memset(h_gpu_histogramData, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	//allocate gpu histogram 2
+
+	h_gpu_histogramData2 = (cl_uint *) malloc(numSubHistograms * HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	if(h_gpu_histogramData2 == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for gpu histogram result data 2.");
+		return -1;
+	}
+
+	memset(h_gpu_histogramData2, 0, numSubHistograms * HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	//allocate array for new values after equalization
+
+	h_newValuesData = (cl_uint *) malloc(HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	if(h_newValuesData == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for equalized histogram result data.");
+		return -1;
+	}
+
+	memset(h_newValuesData, 0, HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	return 0;
+}
+
+/**
+ * Initialize host and opencl device
+ */
+int setupCL()
+{
+	cl_int ciErr = CL_SUCCESS;
+
+	// Get Platform
+	cl_platform_id *cpPlatforms;
+	cl_uint cuiPlatformsCount;
+	ciErr = clGetPlatformIDs(0, NULL, &cuiPlatformsCount); CheckOpenCLError( ciErr, "clGetPlatformIDs: cuiPlatformsNum=%i", cuiPlatformsCount );
+	cpPlatforms = (cl_platform_id*)malloc(cuiPlatformsCount*sizeof(cl_platform_id));
+	ciErr = clGetPlatformIDs(cuiPlatformsCount, cpPlatforms, NULL); CheckOpenCLError( ciErr, "clGetPlatformIDs" );
+	
+	cl_platform_id platform = 0;
+
+	const unsigned int TMP_BUFFER_SIZE = 1024;
+	char sTmp[TMP_BUFFER_SIZE];
+
+	for(unsigned int f0=0; f0<cuiPlatformsCount; f0++){
+		bool shouldBrake = false;
+		ciErr = clGetPlatformInfo (cpPlatforms[f0], CL_PLATFORM_PROFILE, TMP_BUFFER_SIZE, sTmp, NULL);    CheckOpenCLError( ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_PROFILE=%s",f0, sTmp);
+		ciErr = clGetPlatformInfo (cpPlatforms[f0], CL_PLATFORM_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);    CheckOpenCLError( ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_VERSION=%s",f0, sTmp);
+		ciErr = clGetPlatformInfo (cpPlatforms[f0], CL_PLATFORM_NAME, TMP_BUFFER_SIZE, sTmp, NULL);       CheckOpenCLError( ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_NAME=%s",f0, sTmp);
+		ciErr = clGetPlatformInfo (cpPlatforms[f0], CL_PLATFORM_VENDOR, TMP_BUFFER_SIZE, sTmp, NULL);     CheckOpenCLError( ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_VENDOR=%s",f0, sTmp);
+
+		//prioritize AMD and CUDA platforms
+		
+		if ((strcmp(sTmp, "Advanced Micro Devices, Inc.") == 0) || (strcmp(sTmp, "NVIDIA Corporation") == 0)) {
+			platform = cpPlatforms[f0];
+		}
+		
+		//prioritize Intel
+		/*if ((strcmp(sTmp, "Intel(R) Corporation") == 0)) {
+			platform = cpPlatforms[f0];
+		}*/
+
+		ciErr = clGetPlatformInfo (cpPlatforms[f0], CL_PLATFORM_EXTENSIONS, TMP_BUFFER_SIZE, sTmp, NULL); CheckOpenCLError( ciErr, "clGetPlatformInfo: Id=%i: CL_PLATFORM_EXTENSIONS=%s",f0, sTmp);
+		printf("\n");
+	}
+
+	if(platform == 0)
+	{ //no prioritized found
+		if(cuiPlatformsCount > 0)
+		{ 
+			platform = cpPlatforms[0];
+		} else {
+			logMessage(DEBUG_LEVEL_ERROR, "No device was found");
+			return -1;
+		}
+	}
+	// Get Devices
+	cl_uint cuiDevicesCount;
+	ciErr = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &cuiDevicesCount); CheckOpenCLError( ciErr, "clGetDeviceIDs: cuiDevicesCount=%i", cuiDevicesCount );
+	cdDevices = (cl_device_id*)malloc(cuiDevicesCount*sizeof(cl_device_id));
+	ciErr = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, cuiDevicesCount, cdDevices, NULL); CheckOpenCLError( ciErr, "clGetDeviceIDs" );
+	
+	//unsigned int deviceIndex = 0;
+
+	for(unsigned int f0=0; f0<cuiDevicesCount; f0++){
+		cl_device_type cdtTmp;
+		size_t iDim[3];
+
+		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_TYPE, sizeof(cdtTmp), &cdtTmp, NULL);
+		CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_TYPE=%s%s%s%s",f0, cdtTmp&CL_DEVICE_TYPE_CPU?"CPU,":"", 
+			cdtTmp&CL_DEVICE_TYPE_GPU?"GPU,":"", 
+			cdtTmp&CL_DEVICE_TYPE_ACCELERATOR?"ACCELERATOR,":"", 
+			cdtTmp&CL_DEVICE_TYPE_DEFAULT?"DEFAULT,":"");
+
+		if(cdtTmp & CL_DEVICE_TYPE_GPU)
+		{ //prioritize gpu if both cpu and gpu are available
+			deviceIndex = f0;
+		}
+
+		cl_bool bTmp;
+		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_AVAILABLE, sizeof(bTmp), &bTmp, NULL);             CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_AVAILABLE=%s",f0, bTmp?"YES":"NO");
+		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_NAME, TMP_BUFFER_SIZE, sTmp, NULL);                CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_NAME=%s",f0, sTmp);
+		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_VENDOR, TMP_BUFFER_SIZE, sTmp, NULL);              CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_VENDOR=%s",f0, sTmp);
+		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DRIVER_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);             CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DRIVER_VERSION=%s",f0, sTmp);
+		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_PROFILE, TMP_BUFFER_SIZE, sTmp, NULL);             CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_PROFILE=%s",f0, sTmp);
+		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_VERSION, TMP_BUFFER_SIZE, sTmp, NULL);             CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_VERSION=%s",f0, sTmp);
+		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(iDim), iDim, NULL);    CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_MAX_WORK_ITEM_SIZES=%ix%ix%i",f0, iDim[0], iDim[1], iDim[2]);
+		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), iDim, NULL);  CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_MAX_WORK_GROUP_SIZE=%i",f0, iDim[0]);
+		ciErr = clGetDeviceInfo (cdDevices[f0], CL_DEVICE_EXTENSIONS, TMP_BUFFER_SIZE, sTmp, NULL);          CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_EXTENSIONS=%s",f0, sTmp);
+		printf("\n");
+	}
+
+	cl_context_properties cps[3] = 
+    { 
+        CL_CONTEXT_PLATFORM, 
+        (cl_context_properties)platform, 
+        0 
+    };
+
+	ciErr = clGetDeviceInfo(cdDevices[deviceIndex], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &computeUnits, NULL);
+	CheckOpenCLError( ciErr, "clGetDeviceInfo: Id=%i: CL_DEVICE_MAX_COMPUTE_UNITS=%u", deviceIndex, computeUnits);
+
+	//create context
+	context = clCreateContext(cps, 1, &cdDevices[deviceIndex], NULL, NULL, &ciErr);  CheckOpenCLError( ciErr, "clCreateContext" );
+	//may use clCreateContextFromType than choose a device based on the returned devices
+	
+	//create a command queue
+	commandQueue = clCreateCommandQueue(context, cdDevices[deviceIndex], 
+			CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &ciErr); 
+	CheckOpenCLError( ciErr, "clCreateCommandQueue" );
+
+	//==================================================================================
+	//allocate and initialize memory buffers
+
+	//we are only going to read from this
+	d_inputImageBuffer = clCreateBuffer(context,
+										CL_MEM_READ_ONLY,
+										width * height * sizeof(cl_uchar),
+										0,
+										&ciErr);
+	CheckOpenCLError(ciErr, "CreateBuffer inputImage");
+
+	//write our image to the buffer
+	// Write Data to inputImageBuffer - blocking write
+    ciErr = clEnqueueWriteBuffer(commandQueue,
+                                  d_inputImageBuffer,
+                                  CL_TRUE, //blocking write
+                                  0,
+                                  width * height * sizeof(cl_uchar),
+                                  h_inputImageData,
+                                  0,
+                                  0,
+                                  0);
+
+	CheckOpenCLError(ciErr, "Copy input image data");
+
+	//output image buffer - write only
+	d_outputImageBuffer = clCreateBuffer(context,
+										CL_MEM_WRITE_ONLY,
+										width * height * sizeof(cl_uchar),
+										0,
+										&ciErr);
+	CheckOpenCLError(ciErr, "Allocate output buffer");
+
+	if (packedMode)
+	{
+		d_outputMaskBuffer = clCreateBuffer(context,
+										CL_MEM_WRITE_ONLY,
+										(size_t) maskPitch(width) * height * sizeof(cl_uint),
+										0,
+										&ciErr);
+		CheckOpenCLError(ciErr, "Allocate output mask buffer");
+	}
+
+	if (segGridStride > 0)
+	{
+		d_segGridBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										(size_t) segGridSize(width, segGridStride) * segGridSize(height, segGridStride),
+										0,
+										&ciErr);
+		CheckOpenCLError(ciErr, "Allocate segmentation grid buffer");
+	}
+
+	//histogram buffer
+	d_histogramBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										HISTOGRAM_SIZE * sizeof(cl_uint), // Histogram result - unsigned integer values (colors of grey) of occurence
+										0, &ciErr);
+	CheckOpenCLError(ciErr, "Allocate histogram buffer");
+
+	//histogram buffer 2
+	if (histogramMethod == 2)
+	{
+	    d_subHistogramsBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										numSubHistograms * HISTOGRAM_SIZE * sizeof(cl_uint), // Histogram result - unsigned integer values (colors of grey) of occurence
+										0, &ciErr);
+	    CheckOpenCLError(ciErr, "Allocate subhistograms buffer");
+	}
+
+	//rgba input of the multi-channel histogram and the colour equalization
+	if (method == CHANNEL_HISTOGRAM || method == COLOR_EQUALIZE)
+	{
+		d_colorImageBuffer = clCreateBuffer(context,
+										CL_MEM_READ_ONLY,
+										width * height * sizeof(cl_uchar4),
+										0,
+										&ciErr);
+		CheckOpenCLError(ciErr, "CreateBuffer colorImage");
+
+		ciErr = clEnqueueWriteBuffer(commandQueue,
+                                  d_colorImageBuffer,
+                                  CL_TRUE, //blocking write
+                                  0,
+                                  width * height * sizeof(cl_uchar4),
+                                  h_colorImageData,
+                                  0,
+                                  0,
+                                  0);
+		CheckOpenCLError(ciErr, "Copy color image data");
+	}
+
+	if (method == CHANNEL_HISTOGRAM)
+	{
+		d_channelHistogramBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										HISTOGRAM_CHANNELS * HISTOGRAM_SIZE * sizeof(cl_uint),
+										0, &ciErr);
+		CheckOpenCLError(ciErr, "Allocate channel histogram buffer");
+	}
+
+	if (method == COLOR_EQUALIZE)
+	{
+		d_colorOutputBuffer = clCreateBuffer(context,
+										CL_MEM_WRITE_ONLY,
+										width * height * sizeof(cl_uchar4),
+										0, &ciErr);
+		CheckOpenCLError(ciErr, "Allocate color output buffer");
+	}
+
+	//cumulative histogram of the reference of the histogram matching, computed once by the host and kept for all matched images
+	if (method == MATCH)
+	{
+		d_referenceCumulativeBuffer = clCreateBuffer(context,
+										CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+										HISTOGRAM_SIZE * sizeof(cl_uint),
+										h_referenceCumulativeData, &ciErr);
+		CheckOpenCLError(ciErr, "Allocate reference cumulative histogram buffer");
+	}
+
+	//new values of every clahe tile
+	if (method == CLAHE)
+	{
+		size_t numTiles = ((width + claheTileSize - 1) / claheTileSize) * ((height + claheTileSize - 1) / claheTileSize);
+
+		d_claheNewValuesBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										numTiles * HISTOGRAM_SIZE * sizeof(cl_uchar),
+										0, &ciErr);
+		CheckOpenCLError(ciErr, "Allocate clahe new values buffer");
+	}
+
+	//eq histogram buffer
+	d_newValuesBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										HISTOGRAM_SIZE * sizeof(cl_uint), // Histogram result - unsigned integer values (colors of grey) of occurence
+										0, &ciErr);
+	CheckOpenCLError(ciErr, "Allocate eq histogram buffer");
+
+	//treshhold, one for every class of the multi-level otsu but the last
+	d_threshold  = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										(OTSU_MAX_CLASSES - 1) * sizeof(cl_uint),
+										0, &ciErr);
+	CheckOpenCLError(ciErr, "Allocate eq treshhold buffer");	
+
+	//wide input, output and histogram
+	if (wideMode)
+	{
+		d_wideInputBuffer = clCreateBuffer(context,
+										CL_MEM_READ_ONLY,
+										width * height * sizeof(cl_ushort),
+										0,
+										&ciErr);
+		CheckOpenCLError(ciErr, "CreateBuffer wideInput");
+
+		ciErr = clEnqueueWriteBuffer(commandQueue,
+                                  d_wideInputBuffer,
+                                  CL_TRUE, //blocking write
+                                  0,
+                                  width * height * sizeof(cl_ushort),
+                                  h_wideInputData,
+                                  0,
+                                  0,
+                                  0);
+		CheckOpenCLError(ciErr, "Copy wide input data");
+
+		d_wideOutputBuffer = clCreateBuffer(context,
+										CL_MEM_WRITE_ONLY,
+										width * height * sizeof(cl_ushort),
+										0,
+										&ciErr);
+		CheckOpenCLError(ciErr, "Allocate wide output buffer");
+
+		d_wideHistogramBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										numBins * sizeof(cl_uint),
+										0, &ciErr);
+		CheckOpenCLError(ciErr, "Allocate wide histogram buffer");
+
+		d_wideNewValuesBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										numBins * sizeof(cl_uint),
+										0, &ciErr);
+		CheckOpenCLError(ciErr, "Allocate wide new values buffer");
+	}
+
+	//mask of the counted pixels
+	if (h_maskData != NULL)
+	{
+		d_maskBuffer = clCreateBuffer(context,
+										CL_MEM_READ_ONLY,
+										width * height * sizeof(cl_uchar),
+										0,
+										&ciErr);
+		CheckOpenCLError(ciErr, "CreateBuffer mask");
+
+		ciErr = clEnqueueWriteBuffer(commandQueue,
+                                  d_maskBuffer,
+                                  CL_TRUE, //blocking write
+                                  0,
+                                  width * height * sizeof(cl_uchar),
+                                  h_maskData,
+                                  0,
+                                  0,
+                                  0);
+		CheckOpenCLError(ciErr, "Copy mask data");
+	}
+
+	//incremental histograms of frames
+	if (framesName != NULL)
+	{
+		size_t numTiles = ((width + HISTOGRAM_TILE_SIZE - 1) / HISTOGRAM_TILE_SIZE) * ((height + HISTOGRAM_TILE_SIZE - 1) / HISTOGRAM_TILE_SIZE);
+
+		d_tileHistogramsBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										numTiles * HISTOGRAM_SIZE * sizeof(cl_uint),
+										0, &ciErr);
+		CheckOpenCLError(ciErr, "Allocate tile histograms buffer");
+
+		d_tileChecksumsBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										numTiles * sizeof(cl_uint),
+										0, &ciErr);
+		CheckOpenCLError(ciErr, "Allocate tile checksums buffer");
+
+		d_frameHistogramBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										HISTOGRAM_SIZE * sizeof(cl_uint),
+										0, &ciErr);
+		CheckOpenCLError(ciErr, "Allocate frame histogram buffer");
+
+		d_changedTilesBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										sizeof(cl_uint),
+										0, &ciErr);
+		CheckOpenCLError(ciErr, "Allocate changed tiles buffer");
+	}
+	
+
+	//=================================================================================
+	// Create and compile and openCL program
+
+	char *cSourceCL = loadProgSource("kernels.cl");
+	
+	program = clCreateProgramWithSource(context, 1, (const char **)&cSourceCL, NULL, &ciErr);  CheckOpenCLError( ciErr, "clCreateProgramWithSource" );
+	free(cSourceCL);
+
+	//otsu variances are divided in float, the thresholds match the cpu only with correctly rounded division
+	const char* buildOptions = NULL;
+#ifdef CL_FP_CORRECTLY_ROUNDED_DIVIDE_SQRT
+	cl_device_fp_config singleFpConfig = 0;
+	ciErr = clGetDeviceInfo(cdDevices[deviceIndex], CL_DEVICE_SINGLE_FP_CONFIG, sizeof(singleFpConfig), &singleFpConfig, NULL);
+	CheckOpenCLError(ciErr, "clGetDeviceInfo CL_DEVICE_SINGLE_FP_CONFIG");
+
+	if (singleFpConfig & CL_FP_CORRECTLY_ROUNDED_DIVIDE_SQRT)
+		buildOptions = "-cl-fp32-correctly-rounded-divide-sqrt";
+#endif
+	if (buildOptions == NULL)
+		printf("Float division of the device is not correctly rounded, otsu thresholds may differ from the CPU on near ties.\n");
+
+	ciErr = clBuildProgram(program, 0, NULL, buildOptions, NULL, NULL);
+	
+	cl_int logStatus;
+
+	//build log
+    char *buildLog = NULL;
+    size_t buildLogSize = 0;
+    logStatus = clGetProgramBuildInfo( program, 
+										cdDevices[deviceIndex], 
+										CL_PROGRAM_BUILD_LOG, 
+										buildLogSize, 
+										buildLog, 
+										&buildLogSize);
+	
+	CheckOpenCLError(logStatus, "clGetProgramBuildInfo.");
+
+    buildLog = (char*)malloc(buildLogSize);
+    if(buildLog == NULL)
+    {
+        printf("Failed to allocate host memory. (buildLog)");
+        return -1;
+    }
+    memset(buildLog, 0, buildLogSize);
+
+    logStatus = clGetProgramBuildInfo (program, 
+										cdDevices[deviceIndex], 
+										CL_PROGRAM_BUILD_LOG, 
+										buildLogSize, 
+										buildLog, 
+										NULL);
+	CheckOpenCLError(logStatus, "clGetProgramBuildInfo.");
+
+    printf(" \n\t\t\tBUILD LOG\n");
+    printf(" ************************************************\n");
+    printf("%s", buildLog);
+    printf(" ************************************************\n");
+    free(buildLog);
+	
+	CheckOpenCLError( ciErr, "clBuildProgram" );
+
+	//==========================================================================
+	// kernels
+	equalizeKernel1 = clCreateKernel(program, "equalize1", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel equalize1" );
+	histogramKernel1 = clCreateKernel(program, "histogram1", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel histogram1" );
+	histogramKernel2a = clCreateKernel(program, "histogram2a", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel histogram2a" );
+	reduceHistogramsKernel = clCreateKernel(program, "reduceHistograms", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel reduceHistograms" );
+	histogramKernel3 = clCreateKernel(program, "histogram3", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel histogram3" );
+	clearHistogramKernel = clCreateKernel(program, "clearHistogram", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel clearHistogram" );
+	histogramRGBLKernel = clCreateKernel(program, "histogramRGBL", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel histogramRGBL" );
+	equalizeKernel2 = clCreateKernel(program, "equalize2", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel equalize2" );
+	thresholdKernel = clCreateKernel(program, "threshold", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel threshold" );
+	thresholdMultiKernel = clCreateKernel(program, "thresholdMulti", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel thresholdMulti" );
+	thresholdingKernel = clCreateKernel(program, "thresholding", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel thresholding" );
+    segKernel = clCreateKernel(program, "segmentation", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel segmentation" );
+	thresholdingPackedKernel = clCreateKernel(program, "thresholdingPacked", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel thresholdingPacked" );
+	segPackedKernel = clCreateKernel(program, "segmentationPacked", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel segmentationPacked" );
+	segGridKernel = clCreateKernel(program, "segmentationGrid", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel segmentationGrid" );
+	segInterpolateKernel = clCreateKernel(program, "segmentationInterpolate", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel segmentationInterpolate" );
+	histogramBatchKernel = clCreateKernel(program, "histogramBatch", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel histogramBatch" );
+	equalizeBatchKernel1 = clCreateKernel(program, "equalizeBatch1", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel equalizeBatch1" );
+	thresholdBatchKernel = clCreateKernel(program, "thresholdBatch", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel thresholdBatch" );
+	applyBatchKernel = clCreateKernel(program, "applyBatch", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel applyBatch" );
+	histogramWideKernel = clCreateKernel(program, "histogramWide", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel histogramWide" );
+	equalizeWideKernel1 = clCreateKernel(program, "equalizeWide1", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel equalizeWide1" );
+	equalizeWideKernel2 = clCreateKernel(program, "equalizeWide2", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel equalizeWide2" );
+	thresholdWideKernel = clCreateKernel(program, "thresholdWide", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel thresholdWide" );
+	thresholdingWideKernel = clCreateKernel(program, "thresholdingWide", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel thresholdingWide" );
+	histogramROIKernel = clCreateKernel(program, "histogramROI", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel histogramROI" );
+	tileHistogramUpdateKernel = clCreateKernel(program, "tileHistogramUpdate", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel tileHistogramUpdate" );
+	claheTilesKernel = clCreateKernel(program, "claheTiles", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel claheTiles" );
+	claheApplyKernel = clCreateKernel(program, "claheApply", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel claheApply" );
+	histogramLumaKernel = clCreateKernel(program, "histogramLuma", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel histogramLuma" );
+	equalizeColorKernel = clCreateKernel(program, "equalizeColor", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel equalizeColor" );
+	matchKernel1 = clCreateKernel(program, "match1", &ciErr);
+	CheckOpenCLError( ciErr, "clCreateKernel match1" );
+
+	return 0;
+}
+
+int checkWorkgroupSize(cl_kernel &pkernel, size_t &blockSizeX, size_t &blockSizeY)
+{
+	cl_int ciErr = CL_SUCCESS;
+	size_t maxKernelWorkGroupSize;
+	ciErr = clGetKernelWorkGroupInfo(pkernel,
+									cdDevices[deviceIndex], //this only workes if single device
+									CL_KERNEL_WORK_GROUP_SIZE,
+									sizeof(size_t),
+									&maxKernelWorkGroupSize,
+									0);
+	CheckOpenCLError(ciErr, "clGetKernelInfo %u", maxKernelWorkGroupSize);
+   
+	if((blockSizeX * blockSizeY) > maxKernelWorkGroupSize)
+    {
+        printf("Out of Resources!\n");
+        printf("Group Size specified: %i\n", blockSizeX * blockSizeY);
+        printf("Max Group Size supported on the kernel: %i\n", maxKernelWorkGroupSize);
+        printf("Falling back to %i.\n", maxKernelWorkGroupSize);
+
+        if(blockSizeX > maxKernelWorkGroupSize)
+        {
+            blockSizeX = maxKernelWorkGroupSize;
+            blockSizeY = 1;
+        }
+		return EXIT_FAILURE;
+    }
+	
+	return EXIT_SUCCESS;	
+}
+
+/**
+ * Prints how many work-groups of a kernel fit into the local memory of a compute unit
+ * @param pkernel kernel whose local memory is queried
+ * @param groupSize number of work items of a work-group
+ * @param title title of the printed line
+ */
+void printLocalMemoryOccupancy(cl_kernel &pkernel, size_t groupSize, const char* title)
+{
+	cl_int ciErr = CL_SUCCESS;
+	cl_ulong kernelLocalMem, deviceLocalMem;
+
+	ciErr = clGetKernelWorkGroupInfo(pkernel,
+									cdDevices[deviceIndex], //this only workes if single device
+									CL_KERNEL_LOCAL_MEM_SIZE,
+									sizeof(cl_ulong),
+									&kernelLocalMem,
+									0);
+	CheckOpenCLError(ciErr, "clGetKernelWorkGroupInfo CL_KERNEL_LOCAL_MEM_SIZE");
+
+	ciErr = clGetDeviceInfo(cdDevices[deviceIndex], CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &deviceLocalMem, NULL);
+	CheckOpenCLError(ciErr, "clGetDeviceInfo CL_DEVICE_LOCAL_MEM_SIZE");
+
+	cl_ulong groups = (kernelLocalMem > 0) ? deviceLocalMem / kernelLocalMem : 0;
+	printf("%slocal memory %lu B per work-group, at most %lu work-groups (%lu work items) per compute unit\n",
+		title, (unsigned long) kernelLocalMem, (unsigned long) groups, (unsigned long) (groups * groupSize));
+}
+
+void runGpuHistogram1() {
+	int status;
+
+	/* Setup arguments to the kernel */
+
+    /* input buffer */
+    status = clSetKernelArg(histogramKernel1, 
+                            0, 
+                            sizeof(cl_mem), 
+                            &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+    /* image width */
+    status = clSetKernelArg(histogramKernel1, 
+                            1, 
+                            sizeof(cl_uint), 
+                            &width);
+
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	/* image height */
+    status = clSetKernelArg(histogramKernel1, 
+                            2, 
+                            sizeof(cl_uint), 
+                            &height);
+
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+    
+	/* histogram buffer */
+	status = clSetKernelArg(histogramKernel1, 
+                            3, 
+                            sizeof(cl_mem), 
+                            &d_histogramBuffer);
+	
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+
+    /* cache */
+	status = clSetKernelArg(histogramKernel1, 
+	                        4, 
+							HISTOGRAM_SIZE * sizeof(cl_uint),
+	                        0);
+
+	CheckOpenCLError(status, "clSetKernelArg. (cache) %u", sizeof(cl_uint)*HISTOGRAM_SIZE);
+
+	//the global number of threads in each dimension has to be divisible
+	// by the local dimension numbers
+	//size_t globalThreadsHistogram[] = { ((height + blockSizeY - 1)/blockSizeY) * blockSizeY };
+    //size_t localThreadsHistogram[] = { blockSizeY };
+	size_t blockSizeX = 16;
+	size_t blockSizeY = 16;
+
+	checkWorkgroupSize(histogramKernel1, blockSizeX, blockSizeY);
+
+	size_t globalThreadsHistogram[] = 
+	{
+		((width + blockSizeX - 1)/blockSizeX) * blockSizeX,
+		((height + blockSizeY - 1)/blockSizeY) * blockSizeY
+	};
+	size_t localThreadsHistogram[] = {blockSizeX, blockSizeY};
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    histogramKernel1,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalThreadsHistogram,
+                                    localThreadsHistogram,
+                                    0,
+                                    NULL,
+                                    &event_histogram1);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	if (!readIntermediate())
+		return;
+
+    status = clWaitForEvents(1, &event_histogram1);
+    CheckOpenCLError(status, "clWaitForEvents.");
+
+	//Read back the histogram
+	//blocking read
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_histogramBuffer,
+                                CL_TRUE,
+                                0,
+								HISTOGRAM_SIZE * sizeof(cl_uint),
+                                h_gpu_histogramData,
+                                0,
+                                0,
+                                0);
+		
+   CheckOpenCLError(status, "read histogram.");
+
+   printTiming(event_histogram1, "GPU Histogram 1: ");
+
+   return;
+}
+
+/**
+ * Merges partial histograms to one histogram on the device.
+ * Every pass merges groups of REDUCE_ROWS_PER_GROUP histograms in parallel, passes are repeated until one histogram remains.
+ * @param partialBuffer numPartial histograms of numBins values, overwritten by intermediate results
+ * @param numPartial number of partial histograms
+ * @param numBins number of values in every histogram
+ * @param outputBuffer buffer for the resulting histogram
+ * @param waitEvent event after which the partial histograms are ready
+ * @param event returns the event of the last pass
+ */
+void runGpuReduceHistograms(cl_mem partialBuffer, cl_uint numPartial, cl_uint numBins, cl_mem outputBuffer, cl_event waitEvent, cl_event* event)
+{
+	cl_int status;
+
+	size_t blockSizeX = 64;
+	size_t blockSizeY = 4;
+
+	checkWorkgroupSize(reduceHistogramsKernel, blockSizeX, blockSizeY);
+
+	//intermediate results of the first pass have to fit into the reduce buffer, the following passes need less
+	cl_uint firstPassRows = (numPartial + REDUCE_ROWS_PER_GROUP - 1) / REDUCE_ROWS_PER_GROUP;
+
+	if (firstPassRows > 1 && (size_t) firstPassRows * numBins > reduceBufferSize)
+	{
+		if (d_reduceBuffer)
+		{
+			status = clReleaseMemObject(d_reduceBuffer);
+			CheckOpenCLError(status, "clReleaseMemObject reduce");
+		}
+
+		reduceBufferSize = (size_t) firstPassRows * numBins;
+		d_reduceBuffer = clCreateBuffer(context,
+										CL_MEM_READ_WRITE,
+										reduceBufferSize * sizeof(cl_uint),
+										0, &status);
+		CheckOpenCLError(status, "Allocate reduce buffer");
+	}
+
+	cl_event passEvents[MAX_REDUCE_PASSES];
+	int numPasses = 0;
+
+	cl_mem source = partialBuffer;
+	cl_uint numRows = numPartial;
+	cl_event lastEvent = waitEvent;
+
+	do
+	{
+		cl_uint outputRows = (numRows + REDUCE_ROWS_PER_GROUP - 1) / REDUCE_ROWS_PER_GROUP;
+
+		//ping-pong between the partial and reduce buffers, the last pass writes the result
+		cl_mem target = (outputRows == 1) ? outputBuffer : ((source == d_reduceBuffer) ? partialBuffer : d_reduceBuffer);
+
+		status = clSetKernelArg(reduceHistogramsKernel, 0, sizeof(cl_mem), &source);
+		CheckOpenCLError(status, "clSetKernelArg. (partialHistograms)");
+
+		status = clSetKernelArg(reduceHistogramsKernel, 1, sizeof(cl_mem), &target);
+		CheckOpenCLError(status, "clSetKernelArg. (histograms)");
+
+		status = clSetKernelArg(reduceHistogramsKernel, 2, sizeof(cl_uint), &numRows);
+		CheckOpenCLError(status, "clSetKernelArg. (numPartial)");
+
+		status = clSetKernelArg(reduceHistogramsKernel, 3, sizeof(cl_uint), &numBins);
+		CheckOpenCLError(status, "clSetKernelArg. (numBins)");
+
+		status = clSetKernelArg(reduceHistogramsKernel, 4, sizeof(cl_uint), &REDUCE_ROWS_PER_GROUP);
+		CheckOpenCLError(status, "clSetKernelArg. (rowsPerGroup)");
+
+		status = clSetKernelArg(reduceHistogramsKernel, 5, blockSizeX * blockSizeY * sizeof(cl_uint), 0);
+		CheckOpenCLError(status, "clSetKernelArg. (partialSums)");
+
+		size_t globalThreads[] = 
+		{
+			((numBins + blockSizeX - 1)/blockSizeX) * blockSizeX,
+			outputRows * blockSizeY
+		};
+		size_t localThreads[] = {blockSizeX, blockSizeY};
+
+		status = clEnqueueNDRangeKernel(commandQueue,
+										reduceHistogramsKernel,
+										2,
+										NULL, //offset
+										globalThreads,
+										localThreads,
+										lastEvent ? 1 : 0,
+										lastEvent ? &lastEvent : NULL,
+										&passEvents[numPasses]);
+		CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+		lastEvent = passEvents[numPasses++];
+		source = target;
+		numRows = outputRows;
+	} while (numRows > 1);
+
+	if (readIntermediate())
+	{
+		status = clWaitForEvents(1, &lastEvent);
+		CheckOpenCLError(status, "clWaitForEvents.");
+	}
+
+	for (int i = 0; i < numPasses; i++)
+	{
+		char title[64];
+		sprintf(title, "GPU Reduce histograms, pass %d: ", i + 1);
+		if (readIntermediate())
+			printTiming(passEvents[i], title);
+
+		if (i < numPasses - 1)
+			clReleaseEvent(passEvents[i]);
+	}
+
+	*event = lastEvent;
+}
+
+void runGpuHistogram2() {
+	int status;
+
+//////////////KERNEL 2A////////////////////////////////////////////////////////////////////////////////////////
+
+	/* Setup arguments to the kernel */
+
+    /* input buffer */
+    status = clSetKernelArg(histogramKernel2a, 
+                            0, 
+                            sizeof(cl_mem), 
+                            &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+    /* image width */
+    status = clSetKernelArg(histogramKernel2a, 
+                            3, 
+                            sizeof(cl_uint), 
+                            &width);
+
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	/* image height */
+    status = clSetKernelArg(histogramKernel2a, 
+                            4, 
+                            sizeof(cl_uint), 
+                            &height);
+
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+	/* shared array buffer */
+    status = clSetKernelArg(histogramKernel2a, 
+                            1, 
+                            HISTOGRAM_SIZE * sizeof(cl_uint), 
+                            0);
+	CheckOpenCLError(status, "clSetKernelArg. (sharedArray)");
+
+	/* pixels per group */
+    status = clSetKernelArg(histogramKernel2a, 
+                            5, 
+                            sizeof(cl_uint), 
+                            &pixelsPerGroupHistogram2a);
+	CheckOpenCLError(status, "clSetKernelArg. (pixelsPerGroup)");
+    
+	/* subhistograms buffer */
+	status = clSetKernelArg(histogramKernel2a, 
+                            2, 
+                            sizeof(cl_mem), 
+                            &d_subHistogramsBuffer);
+	
+	CheckOpenCLError(status, "clSetKernelArg. (subHistograms)");
+
+	//the global number of threads in each dimension has to be divisible
+	// by the local dimension numbers
+	size_t blockSizeX = localThreadsHistogram2a;
+	size_t blockSizeY = 1;
+
+	checkWorkgroupSize(histogramKernel2a, blockSizeX, blockSizeY);
+
+	//one work group per sub-histogram
+	size_t globalThreads[] = 
+	{
+		numSubHistograms * blockSizeX
+	};
+	size_t localThreads[] = {blockSizeX};
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    histogramKernel2a,
+									1,
+                                    NULL, //offset
+                                    globalThreads,
+                                    localThreads,
+                                    0,
+                                    NULL,
+                                    &event_histogram2);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	if (readIntermediate())
+	{
+		status = clWaitForEvents(1, &event_histogram2);
+		CheckOpenCLError(status, "clWaitForEvents.");
+
+		printTiming(event_histogram2, "GPU Histogram 2a: ");
+	}
+
+//////////////REDUCTION/////////////////////////////////////////////////////////////////////////////////////////
+
+	runGpuReduceHistograms(d_subHistogramsBuffer, numSubHistograms, HISTOGRAM_SIZE, d_histogramBuffer, event_histogram2, &event_histogram1);
+
+	if (!readIntermediate())
+		return;
+	
+	//Read back the histogram
+	//blocking read
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_histogramBuffer,
+                                CL_TRUE,
+                                0,
+								HISTOGRAM_SIZE * sizeof(cl_uint),
+                                h_gpu_histogramData,
+                                0,
+                                0,
+                                0);
+		
+   CheckOpenCLError(status, "read histogram.");
+
+   return;
+}
+
+/**
+ * Enqueues clearing of a histogram buffer on the device
+ * @param histogramBuffer buffer to clear
+ * @param numBins number of values in the buffer
+ * @param event returns the event of the clearing
+ */
+void runGpuClearHistogram(cl_mem histogramBuffer, cl_uint numBins, cl_event* event)
+{
+	int status;
+
+	/* histogram buffer */
+	status = clSetKernelArg(clearHistogramKernel, 
+                            0, 
+                            sizeof(cl_mem), 
+                            &histogramBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+
+	/* number of bins */
+	status = clSetKernelArg(clearHistogramKernel, 
+                            1, 
+                            sizeof(cl_uint), 
+                            &numBins);
+	CheckOpenCLError(status, "clSetKernelArg. (numBins)");
+
+	size_t globalThreadsClear[] = { numBins };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    clearHistogramKernel,
+									1,
+                                    NULL, //offset
+                                    globalThreadsClear,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    event);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+}
+
+void runGpuHistogram3() {
+	int status;
+
+	runGpuClearHistogram(d_histogramBuffer, HISTOGRAM_SIZE, &event_clearHistogram);
+
+//////////////KERNEL 3/////////////////////////////////////////////////////////////////////////////////////////
+
+	/* Setup arguments to the kernel */
+
+    /* input buffer */
+    status = clSetKernelArg(histogramKernel3, 
+                            0, 
+                            sizeof(cl_mem), 
+                            &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+    /* image width */
+    status = clSetKernelArg(histogramKernel3, 
+                            1, 
+                            sizeof(cl_uint), 
+                            &width);
+
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	/* image height */
+    status = clSetKernelArg(histogramKernel3, 
+                            2, 
+                            sizeof(cl_uint), 
+                            &height);
+
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+    
+	/* histogram buffer */
+	status = clSetKernelArg(histogramKernel3, 
+                            3, 
+                            sizeof(cl_mem), 
+                            &d_histogramBuffer);
+	
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+
+    /* cache */
+	status = clSetKernelArg(histogramKernel3, 
+	                        4, 
+							HISTOGRAM_COPIES * HISTOGRAM_SIZE * sizeof(cl_uint),
+	                        0);
+
+	CheckOpenCLError(status, "clSetKernelArg. (cache) %u", HISTOGRAM_COPIES * HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	size_t blockSizeX = 256;
+	size_t blockSizeY = 1;
+
+	checkWorkgroupSize(histogramKernel3, blockSizeX, blockSizeY);
+
+	//a few work groups per compute unit, every work item then loops over the image,
+	//but there is no need for more work items than groups of four pixels
+	size_t numberOfQuads = (width * height + 3) / 4;
+	size_t numGroups = MIN(computeUnits * 4, (numberOfQuads + blockSizeX - 1) / blockSizeX);
+
+	size_t globalThreadsHistogram[] = { numGroups * blockSizeX };
+	size_t localThreadsHistogram[] = { blockSizeX };
+
+	cl_event histogram3_wait_events[] = { event_clearHistogram };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    histogramKernel3,
+                                    1, // Dimensions
+                                    NULL, //offset
+                                    globalThreadsHistogram,
+                                    localThreadsHistogram,
+                                    1,
+                                    histogram3_wait_events,
+                                    &event_histogram1);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	if (!readIntermediate())
+		return;
+
+    status = clWaitForEvents(1, &event_histogram1);
+    CheckOpenCLError(status, "clWaitForEvents.");
+
+	//Read back the histogram
+	//blocking read
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_histogramBuffer,
+                                CL_TRUE,
+                                0,
+								HISTOGRAM_SIZE * sizeof(cl_uint),
+                                h_gpu_histogramData,
+                                0,
+                                0,
+                                0);
+		
+   CheckOpenCLError(status, "read histogram.");
+
+   printTiming(event_clearHistogram, "GPU Clear histogram: ");
+   printTiming(event_histogram1, "GPU Histogram 3: ");
+
+   return;
+}
+
+void runGpuHistogramRGBL() {
+	int status;
+
+	runGpuClearHistogram(d_channelHistogramBuffer, HISTOGRAM_CHANNELS * HISTOGRAM_SIZE, &event_clearHistogram);
+
+	/* Setup arguments to the kernel */
+
+    /* input buffer */
+    status = clSetKernelArg(histogramRGBLKernel, 
+                            0, 
+                            sizeof(cl_mem), 
+                            &d_colorImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+    /* image width */
+    status = clSetKernelArg(histogramRGBLKernel, 
+                            1, 
+                            sizeof(cl_uint), 
+                            &width);
+
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	/* image height */
+    status = clSetKernelArg(histogramRGBLKernel, 
+                            2, 
+                            sizeof(cl_uint), 
+                            &height);
+
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+    
+	/* histogram buffer */
+	status = clSetKernelArg(histogramRGBLKernel, 
+                            3, 
+                            sizeof(cl_mem), 
+                            &d_channelHistogramBuffer);
+	
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+
+    /* cache */
+	status = clSetKernelArg(histogramRGBLKernel, 
+	                        4, 
+							HISTOGRAM_CHANNELS * HISTOGRAM_SIZE * sizeof(cl_uint),
+	                        0);
+
+	CheckOpenCLError(status, "clSetKernelArg. (cache) %u", HISTOGRAM_CHANNELS * HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	size_t blockSizeX = 256;
+	size_t blockSizeY = 1;
+
+	checkWorkgroupSize(histogramRGBLKernel, blockSizeX, blockSizeY);
+
+	size_t numberOfPixels = width * height;
+	size_t numGroups = MIN(computeUnits * 4, (numberOfPixels + blockSizeX - 1) / blockSizeX);
+
+	size_t globalThreadsHistogram[] = { numGroups * blockSizeX };
+	size_t localThreadsHistogram[] = { blockSizeX };
+
+	cl_event histogramRGBL_wait_events[] = { event_clearHistogram };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    histogramRGBLKernel,
+                                    1, // Dimensions
+                                    NULL, //offset
+                                    globalThreadsHistogram,
+                                    localThreadsHistogram,
+                                    1,
+                                    histogramRGBL_wait_events,
+                                    &event_histogramRGBL);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+    status = clWaitForEvents(1, &event_histogramRGBL);
+    CheckOpenCLError(status, "clWaitForEvents.");
+
+	//Read back the histograms
+	//blocking read
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_channelHistogramBuffer,
+                                CL_TRUE,
+                                0,
+								HISTOGRAM_CHANNELS * HISTOGRAM_SIZE * sizeof(cl_uint),
+                                h_gpu_channelHistogramData,
+                                0,
+                                0,
+                                0);
+		
+   CheckOpenCLError(status, "read channel histogram.");
+
+   printTiming(event_histogramRGBL, "GPU Histogram RGBL: ");
+
+   return;
+}
+
+void runGpuHistogramROI() {
+	int status;
+
+	runGpuClearHistogram(d_histogramBuffer, HISTOGRAM_SIZE, &event_clearHistogram);
+
+	cl_uint pitch = width;
+
+	status = clSetKernelArg(histogramROIKernel, 0, sizeof(cl_mem), &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	status = clSetKernelArg(histogramROIKernel, 1, sizeof(cl_uint), &pitch);
+	CheckOpenCLError(status, "clSetKernelArg. (pitch)");
+
+	status = clSetKernelArg(histogramROIKernel, 2, sizeof(cl_uint), &roi.x);
+	CheckOpenCLError(status, "clSetKernelArg. (roiX)");
+
+	status = clSetKernelArg(histogramROIKernel, 3, sizeof(cl_uint), &roi.y);
+	CheckOpenCLError(status, "clSetKernelArg. (roiY)");
+
+	status = clSetKernelArg(histogramROIKernel, 4, sizeof(cl_uint), &roi.width);
+	CheckOpenCLError(status, "clSetKernelArg. (roiWidth)");
+
+	status = clSetKernelArg(histogramROIKernel, 5, sizeof(cl_uint), &roi.height);
+	CheckOpenCLError(status, "clSetKernelArg. (roiHeight)");
+
+	//without mask the kernel gets a NULL buffer
+	status = clSetKernelArg(histogramROIKernel, 6, sizeof(cl_mem), &d_maskBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (mask)");
+
+	status = clSetKernelArg(histogramROIKernel, 7, sizeof(cl_mem), &d_histogramBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+
+	status = clSetKernelArg(histogramROIKernel, 8, HISTOGRAM_SIZE * sizeof(cl_uint), 0);
+	CheckOpenCLError(status, "clSetKernelArg. (cache) %u", HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	size_t blockSizeX = 64;
+	size_t blockSizeY = 4;
+
+	checkWorkgroupSize(histogramROIKernel, blockSizeX, blockSizeY);
+
+	//the rectangle is covered in width, a few groups per compute unit loop over its rows
+	size_t groupsX = (roi.width + blockSizeX - 1) / blockSizeX;
+	size_t groupsY = MIN((roi.height + blockSizeY - 1) / blockSizeY, (computeUnits * 4 + groupsX - 1) / groupsX);
+
+	size_t globalThreadsHistogram[] = { groupsX * blockSizeX, groupsY * blockSizeY };
+	size_t localThreadsHistogram[] = { blockSizeX, blockSizeY };
+
+	cl_event histogramROI_wait_events[] = { event_clearHistogram };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    histogramROIKernel,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalThreadsHistogram,
+                                    localThreadsHistogram,
+                                    1,
+                                    histogramROI_wait_events,
+                                    &event_histogram1);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	if (!readIntermediate())
+		return;
+
+    status = clWaitForEvents(1, &event_histogram1);
+    CheckOpenCLError(status, "clWaitForEvents.");
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_histogramBuffer,
+                                CL_TRUE,
+                                0,
+								HISTOGRAM_SIZE * sizeof(cl_uint),
+                                h_gpu_histogramData,
+                                0,
+                                0,
+                                0);
+   CheckOpenCLError(status, "read histogram.");
+
+   printTiming(event_clearHistogram, "GPU Clear histogram: ");
+   printTiming(event_histogram1, "GPU Histogram ROI: ");
+}
+
+void runCpuHistogramROI() 
+{
+	printf("Running CPU rectangle histogram implementation.\n");
+	volatile double t1 = getTime();
+	cl_uint count = histogramROI(h_inputImageData, width, roi, h_maskData, h_cpu_histogramData);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU histogram ROI (%u pixels):  elapsedTime %.3lf ms\n", count, elapsedTime);
+}
+
+void runCpuHistogramRGBL() 
+{
+	printf("Running CPU multi-channel histogram implementation.\n");
+	volatile double t1 = getTime();
+	histogramRGBL(h_colorImageData, h_cpu_channelHistogramData, width, height);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU histogram RGBL:  elapsedTime %.3lf ms\n", elapsedTime);
+}
+
+void runCpuHistogram() 
+{
+	printf("Running CPU histogram implementation.\n");
+	volatile double t1 = getTime();
+	histogram(h_inputImageData, h_cpu_histogramData, width, height);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU histogram:  elapsedTime %.3lf ms\n", elapsedTime);
+
+	t1 = getTime();
+	histogramUnrolled(h_inputImageData, h_cpu_histogramData, width, height);
+	t2 = getTime();
+    elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU histogram unrolled:  elapsedTime %.3lf ms\n", elapsedTime);
+
+	//parallel version for 1, 2, 4, ... threads up to the number of available threads
+	int maxThreads = cpuThreadCount();
+
+	for (int threads = 1; ; threads *= 2)
+	{
+		if (threads > maxThreads)
+			threads = maxThreads;
+
+		t1 = getTime();
+		histogramParallel(h_inputImageData, h_cpu_histogramData, width, height, threads);
+		t2 = getTime();
+		elapsedTime = (t2 - t1) * 1000.0f;
+		printf("CPU histogram parallel (%d threads):  elapsedTime %.3lf ms\n", threads, elapsedTime);
+
+		if (threads == maxThreads)
+			break;
+	}
+}
+
+void runCpuEqualize() 
+{
+	printf("Running CPU equalization implementation.\n");
+	volatile double t1 = getTime();
+    equalize(h_inputImageData, h_cpu_outputImageData, readIntermediate() ? h_gpu_histogramData : h_cpu_histogramData, width, height);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU equalize:  elapsedTime %.3lf ms\n", elapsedTime);
+}
+
+void runGpuEqualization1() {
+	int status;
+
+	/* histogram buffer */
+	status = clSetKernelArg(equalizeKernel1, 
+	                        0, 
+	                        sizeof(cl_mem), 
+	                        &d_histogramBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+
+	/* output buffer */
+	status = clSetKernelArg(equalizeKernel1, 
+	                        1, 
+	                        sizeof(cl_mem), 
+	                        &d_newValuesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (output)");
+
+	//a single work-group scans the whole histogram, every work item handles two bins
+	size_t globalThreadsEqualize1[] = { HISTOGRAM_SIZE / 2 };
+	size_t localThreadsEqualize1[] = { HISTOGRAM_SIZE / 2 };
+
+	cl_event equalize_wait_events[] = { event_histogram1 };
+
+	status = clEnqueueNDRangeKernel(commandQueue,
+		equalizeKernel1,
+		1, // Dimensions
+		NULL, //offset
+		globalThreadsEqualize1,
+		localThreadsEqualize1,
+		1, //num events in wait list
+		equalize_wait_events,
+		&event_equalize1);
+
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	if (!readIntermediate())
+		return;
+
+	status = clWaitForEvents(1, &event_equalize1);
+	CheckOpenCLError(status, "clWaitForEvents.");
+
+	//Read back the image - if textures were used for showing this wouldn't be necessary
+	//blocking read
+	status = clEnqueueReadBuffer(commandQueue,
+	                            d_newValuesBuffer,
+                                CL_TRUE,
+                                0,
+                                HISTOGRAM_SIZE * sizeof(cl_uint),
+                                h_newValuesData,
+                                0,
+                                0,
+                                0);
+	
+    CheckOpenCLError(status, "read equalize1 output.");
+
+	printTiming(event_equalize1, "GPU Equalize1: ");
+
+	return;
+}
+
+/**
+ * Creates the output image from the new values of every gray level, used by the equalization and the histogram matching
+ * @param waitEvent event after which the new values are ready
+ */
+void runGpuEqualization2(cl_event waitEvent) {
+	int status;
+
+	/* Setup arguments to the kernel */
+
+    /* input buffer */
+    status = clSetKernelArg(equalizeKernel2, 
+                            0, 
+                            sizeof(cl_mem), 
+                            &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	/* output buffer */
+	status = clSetKernelArg(equalizeKernel2, 
+	                        1, 
+	                        sizeof(cl_mem), 
+	                        &d_outputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
+
+	/* histogram buffer */
+	status = clSetKernelArg(equalizeKernel2, 
+                            2, 
+                            sizeof(cl_mem), 
+                            &d_newValuesBuffer);
+	
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+
+    /* image width */
+    status = clSetKernelArg(equalizeKernel2, 
+                            3, 
+                            sizeof(cl_uint), 
+                            &width);
+
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	/* image height */
+    status = clSetKernelArg(equalizeKernel2, 
+                            4, 
+                            sizeof(cl_uint), 
+                            &height);
+
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+	//the global number of threads in each dimension has to be divisible
+	// by the local dimension numbers
+	size_t blockSizeX = 16;
+	size_t blockSizeY = 16;
+
+	checkWorkgroupSize(histogramKernel1, blockSizeX, blockSizeY);
+
+	size_t globalThreadsEqualize2[] = 
+	{
+		((width + blockSizeX - 1)/blockSizeX) * blockSizeX,
+		((height + blockSizeY - 1)/blockSizeY) * blockSizeY
+	};
+	size_t localThreadsEqualize2[] = {blockSizeX, blockSizeY};
+
+	cl_event equalize2_wait_events[] = { waitEvent };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    equalizeKernel2,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalThreadsEqualize2,
+                                    localThreadsEqualize2,
+                                    1,
+                                    equalize2_wait_events,
+                                    &event_equalize2);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+    status = clWaitForEvents(1, &event_equalize2);
+    CheckOpenCLError(status, "clWaitForEvents.");
+
+	//Read back the histogram
+	//blocking read
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_outputImageBuffer,
+                                CL_TRUE,
+                                0,
+								width * height * sizeof(cl_uchar),
+                                h_gpu_outputImageData,
+                                0,
+                                0,
+                                0);
+		
+   CheckOpenCLError(status, "read output.");
+
+   printTiming(event_equalize2, "GPU Equalize2: ");
+
+   return;
+}
+
+void runCpuMatch() 
+{
+	printf("Running CPU histogram matching implementation.\n");
+	volatile double t1 = getTime();
+	matchHistogram(h_inputImageData, h_cpu_outputImageData, h_cpu_histogramData, h_referenceCumulativeData, width, height);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU match:  elapsedTime %.3lf ms\n", elapsedTime);
+}
+
+void runGpuMatch() 
+{
+	int status;
+
+	status = clSetKernelArg(matchKernel1, 0, sizeof(cl_mem), &d_histogramBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+
+	status = clSetKernelArg(matchKernel1, 1, sizeof(cl_mem), &d_referenceCumulativeBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (referenceCumulative)");
+
+	status = clSetKernelArg(matchKernel1, 2, sizeof(cl_mem), &d_newValuesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (newValues)");
+
+	//a single work-group like equalize1
+	size_t globalThreadsMatch1[] = { HISTOGRAM_SIZE / 2 };
+	size_t localThreadsMatch1[] = { HISTOGRAM_SIZE / 2 };
+
+	cl_event match_wait_events[] = { event_histogram1 };
+
+	status = clEnqueueNDRangeKernel(commandQueue,
+		matchKernel1,
+		1, // Dimensions
+		NULL, //offset
+		globalThreadsMatch1,
+		localThreadsMatch1,
+		1, //num events in wait list
+		match_wait_events,
+		&event_match1);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	runGpuEqualization2(event_match1);
+
+	printTiming(event_match1, "GPU Match1: ");
+}
+
+/**
+ * Reads the packed output mask back and unpacks it to the gpu output image for display
+ * @param event the kernel which wrote the mask
+ */
+void readOutputMask(cl_event event)
+{
+	size_t maskSize = (size_t) maskPitch(width) * height * sizeof(cl_uint);
+	cl_event event_readMask;
+
+	cl_int status = clEnqueueReadBuffer(commandQueue,
+                                d_outputMaskBuffer,
+                                CL_TRUE,
+                                0,
+								maskSize,
+                                h_gpu_outputMaskData,
+                                1,
+                                &event,
+                                &event_readMask);
+	CheckOpenCLError(status, "read output mask.");
+
+	printf("GPU mask readback of %u bytes instead of %u\n", (cl_uint) maskSize, width * height);
+	printTiming(event_readMask, "GPU mask readback: ");
+
+	status = clReleaseEvent(event_readMask);
+	CheckOpenCLError(status, "clReleaseEvent.");
+
+	unpackMask(h_gpu_outputMaskData, h_gpu_outputImageData, width, height);
+}
+
+/**
+ * Thresholds the input image to the packed output mask, the threshold is already on the device
+ */
+void runGpuThresholdingPacked()
+{
+	int status;
+
+	status = clSetKernelArg(thresholdingPackedKernel, 0, sizeof(cl_mem), &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	status = clSetKernelArg(thresholdingPackedKernel, 1, sizeof(cl_mem), &d_outputMaskBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputMask)");
+
+	status = clSetKernelArg(thresholdingPackedKernel, 2, sizeof(cl_mem), &d_threshold);
+	CheckOpenCLError(status, "clSetKernelArg. (threshold)");
+
+	status = clSetKernelArg(thresholdingPackedKernel, 3, sizeof(cl_uint), &width);
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	status = clSetKernelArg(thresholdingPackedKernel, 4, sizeof(cl_uint), &height);
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+	//one work item per word of the mask
+	size_t blockSizeX = 16;
+	size_t blockSizeY = 16;
+
+	checkWorkgroupSize(thresholdingPackedKernel, blockSizeX, blockSizeY);
+
+	size_t globalThreads[] = 
+	{
+		((maskPitch(width) + blockSizeX - 1)/blockSizeX) * blockSizeX,
+		((height + blockSizeY - 1)/blockSizeY) * blockSizeY
+	};
+	size_t localThreads[] = {blockSizeX, blockSizeY};
+
+	cl_event wait_events[] = { event_threshold };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    thresholdingPackedKernel,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalThreads,
+                                    localThreads,
+                                    1,
+                                    wait_events,
+                                    &event_thresholding);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	readOutputMask(event_thresholding);
+
+	printTiming(event_thresholding, "GPU thresholding packed: ");
+}
+
+/**
+ * Prints the thresholds of the multi-level otsu
+ * @param device name of the device which found them
+ * @param thresholds otsuClasses - 1 thresholds
+ */
+void printThresholds(const char* device, const cl_uint* thresholds)
+{
+	printf("%s thresholds", device);
+	for (int j = 0; j < otsuClasses - 1; j++)
+	{
+		printf(" %u", thresholds[j]);
+	}
+	printf("\n");
+}
+
+void runCpuOtsu() 
+{
+	cl_uint* histogram = readIntermediate() ? h_gpu_histogramData : h_cpu_histogramData;
+	cl_uint thresholds[OTSU_MAX_CLASSES - 1];
+
+	printf("Running CPU otsu implementation.\n");
+	volatile double t1 = getTime();
+	if (otsuClasses > 2)
+	{
+		otsuMulti(h_inputImageData, h_cpu_outputImageData, histogram, width, height, otsuClasses, thresholds);
+	}
+	else if (packedMode)
+	{
+		otsuPacked(h_inputImageData, h_cpu_outputMaskData, histogram, width, height);
+	}
+	else
+	{
+		otsu(h_inputImageData, h_cpu_outputImageData, histogram, width, height);
+	}
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU otsu%s:  elapsedTime %.3lf ms\n", packedMode ? " packed" : "", elapsedTime);
+
+	if (packedMode)
+	{
+		unpackMask(h_cpu_outputMaskData, h_cpu_outputImageData, width, height);
+	}
+
+	if (otsuClasses > 2)
+	{
+		printThresholds("CPU", thresholds);
+	}
+}
+
+void runGpuOtsu() 
+{
+	int status;
+
+	cl_uint h_threshold[OTSU_MAX_CLASSES - 1] = { 0 };
+	cl_uint numThresholds = otsuClasses - 1;
+	cl_kernel searchKernel = (otsuClasses > 2) ? thresholdMultiKernel : thresholdKernel;
+
+	/* Setup arguments to the kernel */
+
+	/* histogram buffer */
+	status = clSetKernelArg(searchKernel, 
+                            0, 
+                            sizeof(cl_mem), 
+                            &d_histogramBuffer);
+	
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+
+
+	/* output buffer */
+	status = clSetKernelArg(searchKernel, 
+	                        1, 
+	                        sizeof(cl_mem), 
+	                        &d_threshold);
+	CheckOpenCLError(status, "clSetKernelArg. (threshold)");
+
+	if (otsuClasses > 2)
+	{
+		/* number of classes */
+		cl_uint classes = otsuClasses;
+		status = clSetKernelArg(searchKernel, 
+		                        2, 
+		                        sizeof(cl_uint), 
+		                        &classes);
+		CheckOpenCLError(status, "clSetKernelArg. (classes)");
+	}
+	
+
+	//a single work-group evaluates all bins, every work item handles two bins or two boundaries of the lowest class
+	size_t globalThreadsThreshold[] = { HISTOGRAM_SIZE / 2 };
+	size_t localThreadsThreshold[] = { HISTOGRAM_SIZE / 2 };
+
+	cl_event threshold_wait_events[] = { event_histogram1 };
+
+	status = clEnqueueNDRangeKernel(commandQueue,
+									searchKernel,
+									1, // Dimensions
+									NULL, //offset
+									globalThreadsThreshold,
+									localThreadsThreshold,
+									1, //num events in wait list
+									threshold_wait_events,
+									&event_threshold);
+
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	//the thresholding kernel reads the threshold on the device, it is read back only to be inspected
+	if (readIntermediate())
+	{
+		status = clWaitForEvents(1, &event_threshold);
+		CheckOpenCLError(status, "clWaitForEvents.");
+
+		//blocking read
+		status = clEnqueueReadBuffer(commandQueue,
+									d_threshold,
+									CL_TRUE,
+									0,
+									numThresholds * sizeof(cl_uint),
+									h_threshold,
+									0,
+									0,
+									0);
+	
+		CheckOpenCLError(status, "read threshold output.");
+
+		printTiming(event_threshold, "GPU threshold: ");
+		if (otsuClasses > 2)
+		{
+			printThresholds("GPU", h_threshold);
+		}
+		else
+		{
+			printf("GPU threshold %u\n", h_threshold[0]);
+		}
+	}
+
+	if (packedMode)
+	{
+		runGpuThresholdingPacked();
+		return;
+	}
+
+	// thresholding 
+
+	/* Setup arguments to the kernel */
+
+    /* input buffer */
+    status = clSetKernelArg(thresholdingKernel, 
+                            0, 
+                            sizeof(cl_mem), 
+                            &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	/* output buffer */
+	status = clSetKernelArg(thresholdingKernel, 
+	                        1, 
+	                        sizeof(cl_mem), 
+	                        &d_outputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
+
+	/* image threshold */
+    status = clSetKernelArg(thresholdingKernel, 
+                            2, 
+                            sizeof(cl_mem), 
+                            &d_threshold);
+
+	CheckOpenCLError(status, "clSetKernelArg. (threshold)");
+
+	/* number of thresholds */
+    status = clSetKernelArg(thresholdingKernel, 
+                            3, 
+                            sizeof(cl_uint), 
+                            &numThresholds);
+
+	CheckOpenCLError(status, "clSetKernelArg. (thresholds)");
+
+    /* image width */
+    status = clSetKernelArg(thresholdingKernel, 
+                            4, 
+                            sizeof(cl_uint), 
+                            &width);
+
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	/* image height */
+    status = clSetKernelArg(thresholdingKernel, 
+                            5, 
+                            sizeof(cl_uint), 
+                            &height);
+
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+	//the global number of threads in each dimension has to be divisible
+	// by the local dimension numbers
+	size_t blockSizeX = 16;
+	size_t blockSizeY = 16;
+
+	checkWorkgroupSize(thresholdingKernel, blockSizeX, blockSizeY);
+
+	size_t globalThreadsthresholding[] = 
+	{
+		((width + blockSizeX - 1)/blockSizeX) * blockSizeX,
+		((height + blockSizeY - 1)/blockSizeY) * blockSizeY
+	};
+	size_t localThreadsthresholding[] = {blockSizeX, blockSizeY};
+
+	cl_event thresholding_wait_events[] = { event_threshold };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    thresholdingKernel,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalThreadsthresholding,
+                                    localThreadsthresholding,
+                                    1,
+                                    thresholding_wait_events,
+                                    &event_thresholding);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+    status = clWaitForEvents(1, &event_thresholding);
+    CheckOpenCLError(status, "clWaitForEvents.");
+
+	//Read back the histogram
+	//blocking read
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_outputImageBuffer,
+                                CL_TRUE,
+                                0,
+								width * height * sizeof(cl_uchar),
+                                h_gpu_outputImageData,
+                                0,
+                                0,
+                                0);
+		
+   CheckOpenCLError(status, "read output.");
+
+   printTiming(event_thresholding, "GPU thresholding: ");
+
+   return;
+}
+
+void runCpuSeg() 
+{
+	printf("Running CPU segmentation implementation.\n");
+	volatile double t1 = getTime();
+	int result;
+	if (packedMode)
+		result = segmentationPacked(h_inputImageData, h_cpu_outputMaskData, width, height);
+	else
+		result = segmentation(h_inputImageData, h_cpu_outputImageData, width, height);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+
+	if (result != 0)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for column histograms of the segmentation.");
+		return;
+	}
+
+    printf("CPU segmentation%s:  elapsedTime %.3lf ms\n", packedMode ? " packed" : "", elapsedTime);
+
+	if (packedMode)
+	{
+		unpackMask(h_cpu_outputMaskData, h_cpu_outputImageData, width, height);
+	}
+}
+
+void runCpuSegIntegral() 
+{
+	cl_uchar* integralOutput = (cl_uchar*) malloc(width * height * sizeof(cl_uchar));
+
+	if (integralOutput == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for integral segmentation.");
+		return;
+	}
+
+	printf("Running CPU integral histogram segmentation implementation.\n");
+	volatile double t1 = getTime();
+	int result = segmentationIntegral(h_inputImageData, integralOutput, width, height, integralBins, SEG_INTEGRAL_MEMORY);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+
+	if (result != 0)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for integral histogram or its row does not fit %u bytes.", (unsigned) SEG_INTEGRAL_MEMORY);
+	}
+	else
+	{
+		printf("CPU segmentation integral (%d bins):  elapsedTime %.3lf ms\n", integralBins, elapsedTime);
+
+		int differentPixels = 0;
+		for (int i = 0; i < width * height; i++)
+		{
+			if (integralOutput[i] != h_cpu_outputImageData[i])
+				differentPixels++;
+		}
+
+		printf("Integral and direct segmentation differ in %d pixels\n", differentPixels);
+	}
+
+	free(integralOutput);
+}
+
+/**
+ * Approximate segmentation with thresholds on a grid, compared with the exact one,
+ * the approximate output replaces it then, so it is shown next to the output of the device
+ */
+void runCpuSegGrid() 
+{
+	cl_uchar* gridOutput = (cl_uchar*) malloc(width * height * sizeof(cl_uchar));
+
+	if (gridOutput == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for grid segmentation.");
+		return;
+	}
+
+	printf("Running CPU grid segmentation implementation.\n");
+	volatile double t1 = getTime();
+	int result = segmentationGrid(h_inputImageData, gridOutput, width, height, segGridStride);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+
+	if (result != 0)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for grid thresholds.");
+	}
+	else
+	{
+		printf("CPU segmentation grid (stride %d):  elapsedTime %.3lf ms\n", segGridStride, elapsedTime);
+
+		//the segmentation output carries the threshold from pixel to pixel, the grid starts every node at 128,
+		//so the reference is the grid with a node at every pixel, the same per-pixel search without interpolation
+		result = segmentationGrid(h_inputImageData, h_cpu_outputImageData, width, height, 1);
+		if (result != 0)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for grid thresholds.");
+			free(gridOutput);
+			return;
+		}
+
+		int differentPixels = 0;
+		for (int i = 0; i < width * height; i++)
+		{
+			if (gridOutput[i] != h_cpu_outputImageData[i])
+				differentPixels++;
+		}
+
+		printf("Grid and exact per-pixel segmentation differ in %d pixels\n", differentPixels);
+
+		memcpy(h_cpu_outputImageData, gridOutput, width * height * sizeof(cl_uchar));
+	}
+
+	free(gridOutput);
+}
+
+/**
+ * Approximate segmentation on the device, thresholds of the grid nodes then the interpolated thresholding
+ */
+void runGpuSegGrid()
+{
+	int status;
+	cl_uint stride = segGridStride;
+
+	status = clSetKernelArg(segGridKernel, 0, sizeof(cl_mem), &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	status = clSetKernelArg(segGridKernel, 1, sizeof(cl_mem), &d_segGridBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (thresholds)");
+
+	status = clSetKernelArg(segGridKernel, 2, sizeof(cl_uint), &width);
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	status = clSetKernelArg(segGridKernel, 3, sizeof(cl_uint), &height);
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+	status = clSetKernelArg(segGridKernel, 4, sizeof(cl_uint), &stride);
+	CheckOpenCLError(status, "clSetKernelArg. (stride)");
+
+	//one work item per grid node, the local histograms are sized for SEG_TILE_WIDTH work items
+	size_t gridWidth = segGridSize(width, segGridStride);
+	size_t globalGridSize[] = 
+	{
+		((gridWidth + SEG_TILE_WIDTH - 1) / SEG_TILE_WIDTH) * SEG_TILE_WIDTH,
+		(size_t) segGridSize(height, segGridStride)
+	};
+	size_t localGridSize[] = {SEG_TILE_WIDTH, 1};
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    segGridKernel,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalGridSize,
+                                    localGridSize,
+                                    0,
+                                    NULL,
+                                    &event_segGrid);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	status = clSetKernelArg(segInterpolateKernel, 0, sizeof(cl_mem), &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	status = clSetKernelArg(segInterpolateKernel, 1, sizeof(cl_mem), &d_segGridBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (thresholds)");
+
+	status = clSetKernelArg(segInterpolateKernel, 2, sizeof(cl_mem), &d_outputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
+
+	status = clSetKernelArg(segInterpolateKernel, 3, sizeof(cl_uint), &width);
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	status = clSetKernelArg(segInterpolateKernel, 4, sizeof(cl_uint), &height);
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+	status = clSetKernelArg(segInterpolateKernel, 5, sizeof(cl_uint), &stride);
+	CheckOpenCLError(status, "clSetKernelArg. (stride)");
+
+	size_t blockSizeX = 16;
+	size_t blockSizeY = 16;
+
+	checkWorkgroupSize(segInterpolateKernel, blockSizeX, blockSizeY);
+
+	size_t globalSize[] = 
+	{
+		((width + blockSizeX - 1) / blockSizeX) * blockSizeX,
+		((height + blockSizeY - 1) / blockSizeY) * blockSizeY
+	};
+	size_t localSize[] = {blockSizeX, blockSizeY};
+
+	cl_event wait_events[] = { event_segGrid };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    segInterpolateKernel,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalSize,
+                                    localSize,
+                                    1,
+                                    wait_events,
+                                    &event_segInterpolate);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_outputImageBuffer,
+                                CL_TRUE,
+                                0,
+								width * height * sizeof(cl_uchar),
+                                h_gpu_outputImageData,
+                                1,
+                                &event_segInterpolate,
+                                0);
+	CheckOpenCLError(status, "read output.");
+
+	printf("GPU segmentation grid (stride %d):\n", segGridStride);
+	printTiming(event_segGrid, "GPU segmentation grid thresholds: ");
+	printTiming(event_segInterpolate, "GPU segmentation grid interpolation: ");
+}
+
+/**
+ * Segmentation of the input image to the packed output mask
+ */
+void runGpuSegPacked()
+{
+	int status;
+
+	status = clSetKernelArg(segPackedKernel, 0, sizeof(cl_mem), &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	status = clSetKernelArg(segPackedKernel, 1, sizeof(cl_mem), &d_outputMaskBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputMask)");
+
+	status = clSetKernelArg(segPackedKernel, 2, sizeof(cl_uint), &width);
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	status = clSetKernelArg(segPackedKernel, 3, sizeof(cl_uint), &height);
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+	//the same tiles as of runGpuSeg, every row of a tile fills one word of the mask
+	size_t globalSize[] = 
+	{
+		(size_t) ((width + SEG_TILE_WIDTH - 1) / SEG_TILE_WIDTH) * SEG_TILE_WIDTH,
+		(size_t) (height + SEG_TILE_ROWS - 1) / SEG_TILE_ROWS
+	};
+	size_t localSize[] = {SEG_TILE_WIDTH, 1};
+
+	printLocalMemoryOccupancy(segPackedKernel, SEG_TILE_WIDTH, "GPU segmentation packed: ");
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    segPackedKernel,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalSize,
+                                    localSize,
+                                    0,
+                                    NULL,
+                                    &event_seg);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	readOutputMask(event_seg);
+
+	printTiming(event_seg, "GPU segmentation packed: ");
+}
+
+void runGpuSeg() 
+{
+	int status;
+
+	if (packedMode)
+	{
+		runGpuSegPacked();
+		return;
+	}
+
+	if (segGridStride > 0)
+	{
+		runGpuSegGrid();
+		return;
+	}
+    
+	/* Setup arguments to the kernel */
+
+    /* input buffer */
+    status = clSetKernelArg(segKernel, 
+                            0, 
+                            sizeof(cl_mem), 
+                            &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	/* output buffer */
+	status = clSetKernelArg(segKernel, 
+	                        1, 
+	                        sizeof(cl_mem), 
+	                        &d_outputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
+    
+    /* image width */
+    status = clSetKernelArg(segKernel, 
+                            2, 
+                            sizeof(cl_uint), 
+                            &width);
+
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	/* image height */
+    status = clSetKernelArg(segKernel, 
+                            3, 
+                            sizeof(cl_uint), 
+                            &height);
+
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+	//a work-group of SEG_TILE_WIDTH work items segments a tile of SEG_TILE_WIDTH x SEG_TILE_ROWS pixels,
+	//every work item one column of it, the size is fixed by the local memory of the kernel.
+	//The window histograms take most of it, so only a few work-groups are resident per compute unit.
+	size_t globalSize[] = 
+	{
+		(size_t) ((width + SEG_TILE_WIDTH - 1) / SEG_TILE_WIDTH) * SEG_TILE_WIDTH,
+		(size_t) (height + SEG_TILE_ROWS - 1) / SEG_TILE_ROWS
+	};
+	size_t localSize[] = {SEG_TILE_WIDTH, 1};
+
+	printLocalMemoryOccupancy(segKernel, SEG_TILE_WIDTH, "GPU segmentation: ");
+
+	cl_event wait_events[] = { event_seg };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    segKernel,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalSize,
+                                    localSize,
+                                    0,
+                                    NULL,
+                                    &event_seg);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+    status = clWaitForEvents(1, &event_seg);
+    CheckOpenCLError(status, "clWaitForEvents.");
+
+	//Read back the histogram
+	//blocking read
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_outputImageBuffer,
+                                CL_TRUE,
+                                0,
+								width * height * sizeof(cl_uchar),
+                                h_gpu_outputImageData,
+                                0,
+                                0,
+                                0);
+		
+   CheckOpenCLError(status, "read output.");
+
+   printTiming(event_seg, "GPU segmentation: ");
+
+   return;
+}
+
+void runCpuClahe() 
+{
+	printf("Running CPU clahe implementation.\n");
+	volatile double t1 = getTime();
+	int result = clahe(h_inputImageData, h_cpu_outputImageData, width, height, claheTileSize, claheClipLimit);
+	volatile double t2 = getTime();
+
+	if (result != 0)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for clahe tiles.");
+		return;
+	}
+
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU clahe (%dx%d tiles):  elapsedTime %.3lf ms\n", claheTileSize, claheTileSize, elapsedTime);
+}
+
+void runGpuClahe() 
+{
+	int status;
+
+	cl_uint tileSize = claheTileSize;
+	size_t tilesX = (width + claheTileSize - 1) / claheTileSize;
+	size_t tilesY = (height + claheTileSize - 1) / claheTileSize;
+
+	//new values of the tiles, one work group with one work item per bin for every tile
+	status = clSetKernelArg(claheTilesKernel, 0, sizeof(cl_mem), &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	status = clSetKernelArg(claheTilesKernel, 1, sizeof(cl_uint), &width);
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	status = clSetKernelArg(claheTilesKernel, 2, sizeof(cl_uint), &height);
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+	status = clSetKernelArg(claheTilesKernel, 3, sizeof(cl_uint), &tileSize);
+	CheckOpenCLError(status, "clSetKernelArg. (tileSize)");
+
+	status = clSetKernelArg(claheTilesKernel, 4, sizeof(cl_uint), &claheClipLimit);
+	CheckOpenCLError(status, "clSetKernelArg. (clipLimit)");
+
+	status = clSetKernelArg(claheTilesKernel, 5, sizeof(cl_mem), &d_claheNewValuesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (newValues)");
+
+	size_t blockSizeX = 16;
+	size_t blockSizeY = HISTOGRAM_SIZE / blockSizeX;
+
+	//the kernel needs exactly one work item per bin, a smaller group can not be used
+	if (checkWorkgroupSize(claheTilesKernel, blockSizeX, blockSizeY) != EXIT_SUCCESS)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "The claheTiles kernel needs a work group of %u work items.", HISTOGRAM_SIZE);
+		return;
+	}
+
+	size_t globalThreadsTiles[] = { tilesX * blockSizeX, tilesY * blockSizeY };
+	size_t localThreadsTiles[] = { blockSizeX, blockSizeY };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    claheTilesKernel,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalThreadsTiles,
+                                    localThreadsTiles,
+                                    0,
+                                    NULL,
+                                    &event_claheTiles);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	//interpolation of the new values of the nearest tiles
+	status = clSetKernelArg(claheApplyKernel, 0, sizeof(cl_mem), &d_inputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	status = clSetKernelArg(claheApplyKernel, 1, sizeof(cl_mem), &d_outputImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
+
+	status = clSetKernelArg(claheApplyKernel, 2, sizeof(cl_mem), &d_claheNewValuesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (newValues)");
+
+	status = clSetKernelArg(claheApplyKernel, 3, sizeof(cl_uint), &width);
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
+
+	status = clSetKernelArg(claheApplyKernel, 4, sizeof(cl_uint), &height);
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
+
+	status = clSetKernelArg(claheApplyKernel, 5, sizeof(cl_uint), &tileSize);
+	CheckOpenCLError(status, "clSetKernelArg. (tileSize)");
+
+	checkWorkgroupSize(claheApplyKernel, blockSizeX, blockSizeY);
+
+	size_t globalThreadsApply[] = 
+	{
+		((width + blockSizeX - 1)/blockSizeX) * blockSizeX,
+		((height + blockSizeY - 1)/blockSizeY) * blockSizeY
+	};
+	size_t localThreadsApply[] = {blockSizeX, blockSizeY};
+
+	cl_event apply_wait_events[] = { event_claheTiles };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    claheApplyKernel,
+                                    2, // Dimensions
+                                    NULL, //offset
+                                    globalThreadsApply,
+                                    localThreadsApply,
+                                    1,
+                                    apply_wait_events,
+                                    &event_claheApply);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+    status = clWaitForEvents(1, &event_claheApply);
+    CheckOpenCLError(status, "clWaitForEvents.");
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_outputImageBuffer,
+                                CL_TRUE,
+                                0,
+								width * height * sizeof(cl_uchar),
+                                h_gpu_outputImageData,
+                                0,
+                                0,
+                                0);
+   CheckOpenCLError(status, "read output.");
+
+   printTiming(event_claheTiles, "GPU clahe tiles: ");
+   printTiming(event_claheApply, "GPU clahe apply: ");
 }
 
-void runGpuHistogram1() {
-	int status;
+void runCpuEqualizeColor() 
+{
+	printf("Running CPU colour equalization implementation.\n");
+	volatile double t1 = getTime();
+	//the gray input is the luma of the colour input
+	histogramParallel(h_inputImageData, h_cpu_histogramData, width, height, cpuThreadCount());
+	equalizeColor(h_colorImageData, h_cpu_colorOutputData, h_cpu_histogramData, width, height);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU colour equalize:  elapsedTime %.3lf ms\n", elapsedTime);
+}
 
-	/* Setup arguments to the kernel */
+/**
+ * Colour equalization on gpu, histogram of the luma -> new values by equalize1 -> one pass over the rgba pixels
+ */
+void runGpuEqualizeColor() 
+{
+	int status;
 
-    /* input buffer */
-    status = clSetKernelArg(histogramKernel1, 
-                            0, 
-                            sizeof(cl_mem), 
-                            &d_inputImageBuffer);
-	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+	cl_uint numberOfPixels = width * height;
 
-    /* image width */
-    status = clSetKernelArg(histogramKernel1, 
-                            1, 
-                            sizeof(cl_uint), 
-                            &width);
+	runGpuClearHistogram(d_histogramBuffer, HISTOGRAM_SIZE, &event_clearHistogram);
 
-	CheckOpenCLError(status, "clSetKernelArg. (width)");
+	status = clSetKernelArg(histogramLumaKernel, 0, sizeof(cl_mem), &d_colorImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
 
-	/* image height */
-    status = clSetKernelArg(histogramKernel1, 
-                            2, 
-                            sizeof(cl_uint), 
-                            &height);
+	status = clSetKernelArg(histogramLumaKernel, 1, sizeof(cl_uint), &numberOfPixels);
+	CheckOpenCLError(status, "clSetKernelArg. (numberOfPixels)");
 
-	CheckOpenCLError(status, "clSetKernelArg. (height)");
-    
-	/* histogram buffer */
-	status = clSetKernelArg(histogramKernel1, 
-                            3, 
-                            sizeof(cl_mem), 
-                            &d_histogramBuffer);
-	
+	status = clSetKernelArg(histogramLumaKernel, 2, sizeof(cl_mem), &d_histogramBuffer);
 	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
 
-    /* cache */
-	status = clSetKernelArg(histogramKernel1, 
-	                        4, 
-							HISTOGRAM_SIZE * sizeof(cl_uint),
-	                        0);
+	status = clSetKernelArg(histogramLumaKernel, 3, HISTOGRAM_SIZE * sizeof(cl_uint), 0);
+	CheckOpenCLError(status, "clSetKernelArg. (cache)");
 
-	CheckOpenCLError(status, "clSetKernelArg. (cache) %u", sizeof(cl_uint)*HISTOGRAM_SIZE);
+	size_t blockSizeX = 256;
+	size_t blockSizeY = 1;
 
-	//the global number of threads in each dimension has to be divisible
-	// by the local dimension numbers
-	//size_t globalThreadsHistogram[] = { ((height + blockSizeY - 1)/blockSizeY) * blockSizeY };
-    //size_t localThreadsHistogram[] = { blockSizeY };
-	size_t blockSizeX = 16;
-	size_t blockSizeY = 16;
+	checkWorkgroupSize(histogramLumaKernel, blockSizeX, blockSizeY);
 
-	checkWorkgroupSize(histogramKernel1, blockSizeX, blockSizeY);
+	size_t numGroups = MIN(computeUnits * 4, (numberOfPixels + blockSizeX - 1) / blockSizeX);
 
-	size_t globalThreadsHistogram[] = 
-	{
-		((width + blockSizeX - 1)/blockSizeX) * blockSizeX,
-		((height + blockSizeY - 1)/blockSizeY) * blockSizeY
-	};
-	size_t localThreadsHistogram[] = {blockSizeX, blockSizeY};
+	size_t globalThreadsHistogram[] = { numGroups * blockSizeX };
+	size_t localThreadsHistogram[] = { blockSizeX };
+
+	cl_event histogram_wait_events[] = { event_clearHistogram };
 
     status = clEnqueueNDRangeKernel(commandQueue,
-                                    histogramKernel1,
-                                    2, // Dimensions
+                                    histogramLumaKernel,
+                                    1, // Dimensions
                                     NULL, //offset
                                     globalThreadsHistogram,
                                     localThreadsHistogram,
-                                    0,
-                                    NULL,
+                                    1,
+                                    histogram_wait_events,
                                     &event_histogram1);
     CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
 
-    status = clWaitForEvents(1, &event_histogram1);
-    CheckOpenCLError(status, "clWaitForEvents.");
-
-	//Read back the histogram
-	//blocking read
-
+	//the histogram is read back only to be compared with the cpu one
 	status = clEnqueueReadBuffer(commandQueue,
                                 d_histogramBuffer,
                                 CL_TRUE,
                                 0,
 								HISTOGRAM_SIZE * sizeof(cl_uint),
                                 h_gpu_histogramData,
+                                1,
+                                &event_histogram1,
+                                0);
+	CheckOpenCLError(status, "read histogram.");
+
+	printTiming(event_histogram1, "GPU Histogram luma: ");
+
+	runGpuEqualization1();
+
+	status = clSetKernelArg(equalizeColorKernel, 0, sizeof(cl_mem), &d_colorImageBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	status = clSetKernelArg(equalizeColorKernel, 1, sizeof(cl_mem), &d_colorOutputBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
+
+	status = clSetKernelArg(equalizeColorKernel, 2, sizeof(cl_mem), &d_newValuesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (newValues)");
+
+	status = clSetKernelArg(equalizeColorKernel, 3, sizeof(cl_uint), &numberOfPixels);
+	CheckOpenCLError(status, "clSetKernelArg. (numberOfPixels)");
+
+	blockSizeX = 256;
+	blockSizeY = 1;
+
+	checkWorkgroupSize(equalizeColorKernel, blockSizeX, blockSizeY);
+
+	size_t globalThreadsEqualize[] = { ((numberOfPixels + blockSizeX - 1) / blockSizeX) * blockSizeX };
+	size_t localThreadsEqualize[] = { blockSizeX };
+
+	cl_event equalize_wait_events[] = { event_equalize1 };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    equalizeColorKernel,
+                                    1, // Dimensions
+                                    NULL, //offset
+                                    globalThreadsEqualize,
+                                    localThreadsEqualize,
+                                    1,
+                                    equalize_wait_events,
+                                    &event_equalizeColor);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+    status = clWaitForEvents(1, &event_equalizeColor);
+    CheckOpenCLError(status, "clWaitForEvents.");
+
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_colorOutputBuffer,
+                                CL_TRUE,
+                                0,
+								numberOfPixels * sizeof(cl_uchar4),
+                                h_gpu_colorOutputData,
                                 0,
                                 0,
                                 0);
-		
-   CheckOpenCLError(status, "read histogram.");
+	CheckOpenCLError(status, "read color output.");
 
-   printTiming(event_histogram1, "GPU Histogram 1: ");
+	printTiming(event_equalizeColor, "GPU Equalize colour: ");
+}
 
-   return;
+void runCpuHistogramWide() 
+{
+	printf("Running CPU wide histogram implementation.\n");
+	volatile double t1 = getTime();
+	histogramWide(h_wideInputData, h_cpu_wideHistogramData, width, height, bitDepth, numBins);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU histogram wide (%d bits, %u bins):  elapsedTime %.3lf ms\n", bitDepth, numBins, elapsedTime);
 }
 
-void runGpuHistogram2() {
+void runGpuHistogramWide()
+{
 	int status;
 
-//////////////KERNEL 2A////////////////////////////////////////////////////////////////////////////////////////
+	runGpuClearHistogram(d_wideHistogramBuffer, numBins, &event_clearHistogram);
 
-	/* Setup arguments to the kernel */
+	cl_uint numberOfPixels = width * height;
+	cl_uint shift = binShift(bitDepth, numBins);
+	cl_uint cacheBins = MIN(numBins, WIDE_LOCAL_BINS);
 
-    /* input buffer */
-    status = clSetKernelArg(histogramKernel2a, 
-                            0, 
-                            sizeof(cl_mem), 
-                            &d_inputImageBuffer);
+	status = clSetKernelArg(histogramWideKernel, 0, sizeof(cl_mem), &d_wideInputBuffer);
 	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
 
-    /* image width */
-    status = clSetKernelArg(histogramKernel2a, 
-                            3, 
-                            sizeof(cl_uint), 
-                            &width);
+	status = clSetKernelArg(histogramWideKernel, 1, sizeof(cl_uint), &numberOfPixels);
+	CheckOpenCLError(status, "clSetKernelArg. (numberOfPixels)");
 
-	CheckOpenCLError(status, "clSetKernelArg. (width)");
+	status = clSetKernelArg(histogramWideKernel, 2, sizeof(cl_uint), &shift);
+	CheckOpenCLError(status, "clSetKernelArg. (binShift)");
 
-	/* image height */
-    status = clSetKernelArg(histogramKernel2a, 
-                            4, 
-                            sizeof(cl_uint), 
-                            &height);
+	status = clSetKernelArg(histogramWideKernel, 3, sizeof(cl_uint), &numBins);
+	CheckOpenCLError(status, "clSetKernelArg. (numBins)");
 
-	CheckOpenCLError(status, "clSetKernelArg. (height)");
+	status = clSetKernelArg(histogramWideKernel, 4, sizeof(cl_mem), &d_wideHistogramBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
 
-	/* shared array buffer */
-    status = clSetKernelArg(histogramKernel2a, 
-                            1, 
-                            localThreadsHistogram2a * HISTOGRAM_SIZE * sizeof(cl_uchar), 
-                            0);
-	CheckOpenCLError(status, "clSetKernelArg. (sharedArray)");
-    
-	/* subhistograms buffer */
-	status = clSetKernelArg(histogramKernel2a, 
-                            2, 
-                            sizeof(cl_mem), 
-                            &d_subHistogramsBuffer);
-	
-	CheckOpenCLError(status, "clSetKernelArg. (subHistograms)");
+	status = clSetKernelArg(histogramWideKernel, 5, cacheBins * sizeof(cl_uint), 0);
+	CheckOpenCLError(status, "clSetKernelArg. (cache) %u", cacheBins * sizeof(cl_uint));
 
-	//the global number of threads in each dimension has to be divisible
-	// by the local dimension numbers
-	size_t blockSizeX = localThreadsHistogram2a;
+	size_t blockSizeX = 256;
 	size_t blockSizeY = 1;
 
-	checkWorkgroupSize(histogramKernel2a, blockSizeX, blockSizeY);
-    
-    int roundedGlobalSize = ((globalThreadsHistogram2a + localThreadsHistogram2a - 1)/localThreadsHistogram2a) * localThreadsHistogram2a;
+	checkWorkgroupSize(histogramWideKernel, blockSizeX, blockSizeY);
 
-	size_t globalThreads[] = 
-	{
-		roundedGlobalSize //globalThreadsHistogram2a
-	};
-	size_t localThreads[] = {localThreadsHistogram2a};
+	//the groups together loop over the whole image once
+	size_t numGroups = MIN(computeUnits * 4, (numberOfPixels + blockSizeX - 1) / blockSizeX);
+
+	size_t globalThreadsHistogram[] = { numGroups * blockSizeX };
+	size_t localThreadsHistogram[] = { blockSizeX };
+
+	cl_event histogramWide_wait_events[] = { event_clearHistogram };
 
     status = clEnqueueNDRangeKernel(commandQueue,
-                                    histogramKernel2a,
-									1,
+                                    histogramWideKernel,
+                                    1, // Dimensions
                                     NULL, //offset
-                                    globalThreads,
-                                    localThreads,
-                                    0,
-                                    NULL,
-                                    &event_histogram2);
+                                    globalThreadsHistogram,
+                                    localThreadsHistogram,
+                                    1,
+                                    histogramWide_wait_events,
+                                    &event_histogramWide);
     CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
 
-    status = clWaitForEvents(1, &event_histogram2);
+    status = clWaitForEvents(1, &event_histogramWide);
     CheckOpenCLError(status, "clWaitForEvents.");
 
-   printTiming(event_histogram2, "GPU Histogram 2a: ");
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_wideHistogramBuffer,
+                                CL_TRUE,
+                                0,
+								numBins * sizeof(cl_uint),
+                                h_gpu_wideHistogramData,
+                                0,
+                                0,
+                                0);
+   CheckOpenCLError(status, "read wide histogram.");
 
-//////////////KERNEL 2B////////////////////////////////////////////////////////////////////////////////////////
+   printTiming(event_clearHistogram, "GPU Clear histogram: ");
+   printTiming(event_histogramWide, "GPU Histogram wide: ");
+}
 
-   /* Setup arguments to the kernel */
+void runCpuEqualizeWide() 
+{
+	printf("Running CPU wide equalization implementation.\n");
+	volatile double t1 = getTime();
+    equalizeWide(h_wideInputData, h_cpu_wideOutputData, h_gpu_wideHistogramData, width, height, bitDepth, numBins);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU equalize wide:  elapsedTime %.3lf ms\n", elapsedTime);
+}
 
-    /* subhistograms */
-    status = clSetKernelArg(histogramKernel2b, 
-                            0, 
-                            sizeof(cl_mem), 
-                            &d_subHistogramsBuffer);
-	CheckOpenCLError(status, "clSetKernelArg. (subHistograms)");
+void runGpuEqualizationWide()
+{
+	int status;
 
-    /* output histogram */
-    status = clSetKernelArg(histogramKernel2b, 
-                            1, 
-                            sizeof(cl_mem), 
-                            &d_histogramBuffer);
+	cl_uint numberOfPixels = width * height;
+	cl_uint shift = binShift(bitDepth, numBins);
+	cl_uint maxValue = (1u << bitDepth) - 1;
+
+	//one group, its scan works with any size
+	size_t groupSize = WIDE_GROUP_SIZE;
+	size_t groupSizeY = 1;
 
+	checkWorkgroupSize(equalizeWideKernel1, groupSize, groupSizeY);
+
+	status = clSetKernelArg(equalizeWideKernel1, 0, sizeof(cl_mem), &d_wideHistogramBuffer);
 	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
 
-	/* number of subhistograms */
-    status = clSetKernelArg(histogramKernel2b, 
-                            2, 
-                            sizeof(cl_uint), 
-                            &numSubHistograms);
+	status = clSetKernelArg(equalizeWideKernel1, 1, sizeof(cl_uint), &numBins);
+	CheckOpenCLError(status, "clSetKernelArg. (numBins)");
 
-	CheckOpenCLError(status, "clSetKernelArg. (numSubHistograms)");
+	status = clSetKernelArg(equalizeWideKernel1, 2, sizeof(cl_uint), &maxValue);
+	CheckOpenCLError(status, "clSetKernelArg. (maxValue)");
 
-	//the global number of threads in each dimension has to be divisible
-	// by the local dimension numbers
-	blockSizeX = 256;
-	blockSizeY = 1;
+	status = clSetKernelArg(equalizeWideKernel1, 3, sizeof(cl_mem), &d_wideNewValuesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (newValues)");
 
-	checkWorkgroupSize(histogramKernel2b, blockSizeX, blockSizeY);
+	status = clSetKernelArg(equalizeWideKernel1, 4, groupSize * sizeof(cl_ulong), 0);
+	CheckOpenCLError(status, "clSetKernelArg. (segmentSums)");
 
-	size_t globalThreadsHistogram2b[] = 
-	{
-		256
-	};
-	size_t localThreadsHistogram2b[] = {256};
+	size_t globalThreadsEqualize1[] = { groupSize };
+	size_t localThreadsEqualize1[] = { groupSize };
 
-	cl_event histogram2b_wait_events[] = { event_histogram2 };
+	cl_event equalize1_wait_events[] = { event_histogramWide };
 
-    status = clEnqueueNDRangeKernel(commandQueue,
-                                    histogramKernel2b,
+	status = clEnqueueNDRangeKernel(commandQueue,
+									equalizeWideKernel1,
+									1, // Dimensions
+									NULL, //offset
+									globalThreadsEqualize1,
+									localThreadsEqualize1,
 									1,
+									equalize1_wait_events,
+									&event_equalizeWide1);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+
+	status = clSetKernelArg(equalizeWideKernel2, 0, sizeof(cl_mem), &d_wideInputBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+
+	status = clSetKernelArg(equalizeWideKernel2, 1, sizeof(cl_mem), &d_wideOutputBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
+
+	status = clSetKernelArg(equalizeWideKernel2, 2, sizeof(cl_mem), &d_wideNewValuesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (newValues)");
+
+	status = clSetKernelArg(equalizeWideKernel2, 3, sizeof(cl_uint), &numberOfPixels);
+	CheckOpenCLError(status, "clSetKernelArg. (numberOfPixels)");
+
+	status = clSetKernelArg(equalizeWideKernel2, 4, sizeof(cl_uint), &shift);
+	CheckOpenCLError(status, "clSetKernelArg. (binShift)");
+
+	size_t blockSizeX = 256;
+	size_t blockSizeY = 1;
+
+	checkWorkgroupSize(equalizeWideKernel2, blockSizeX, blockSizeY);
+
+	size_t globalThreadsEqualize2[] = { ((numberOfPixels + blockSizeX - 1)/blockSizeX) * blockSizeX };
+	size_t localThreadsEqualize2[] = { blockSizeX };
+
+	cl_event equalize2_wait_events[] = { event_equalizeWide1 };
+
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    equalizeWideKernel2,
+                                    1, // Dimensions
                                     NULL, //offset
-                                    globalThreadsHistogram2b,
-                                    localThreadsHistogram2b,
+                                    globalThreadsEqualize2,
+                                    localThreadsEqualize2,
                                     1,
-                                    histogram2b_wait_events,
-                                    &event_histogram1);
+                                    equalize2_wait_events,
+                                    &event_equalizeWide2);
     CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
 
-    status = clWaitForEvents(1, &event_histogram1);
+    status = clWaitForEvents(1, &event_equalizeWide2);
     CheckOpenCLError(status, "clWaitForEvents.");
-	
-	//Read back the histogram
-	//blocking read
 
 	status = clEnqueueReadBuffer(commandQueue,
-                                d_histogramBuffer,
+                                d_wideOutputBuffer,
                                 CL_TRUE,
                                 0,
-								HISTOGRAM_SIZE * sizeof(cl_uint),
-                                h_gpu_histogramData,
+								width * height * sizeof(cl_ushort),
+                                h_gpu_wideOutputData,
                                 0,
                                 0,
                                 0);
-		
-   CheckOpenCLError(status, "read histogram.");
+   CheckOpenCLError(status, "read wide output.");
+
+   printTiming(event_equalizeWide1, "GPU Equalize wide 1: ");
+   printTiming(event_equalizeWide2, "GPU Equalize wide 2: ");
+}
+
+void runCpuOtsuWide() 
+{
+	printf("Running CPU wide otsu implementation.\n");
+	volatile double t1 = getTime();
+	cl_uint threshold = otsuWide(h_wideInputData, h_cpu_wideOutputData, h_gpu_wideHistogramData, width, height, bitDepth, numBins);
+	volatile double t2 = getTime();
+    double elapsedTime = (t2 - t1) * 1000.0f;
+    printf("CPU otsu wide (threshold bin %u):  elapsedTime %.3lf ms\n", threshold, elapsedTime);
+}
+
+void runGpuOtsuWide()
+{
+	int status;
+
+	cl_uint numberOfPixels = width * height;
+	cl_uint shift = binShift(bitDepth, numBins);
+	cl_uint maxValue = (1u << bitDepth) - 1;
+	cl_uint h_threshold = 0;
+
+	//one group, the reduction needs a power of two
+	size_t groupSize = WIDE_GROUP_SIZE;
+	size_t groupSizeY = 1;
+
+	checkWorkgroupSize(thresholdWideKernel, groupSize, groupSizeY);
+	while (groupSize & (groupSize - 1))
+		groupSize &= groupSize - 1;
+
+	status = clSetKernelArg(thresholdWideKernel, 0, sizeof(cl_mem), &d_wideHistogramBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+
+	status = clSetKernelArg(thresholdWideKernel, 1, sizeof(cl_uint), &numBins);
+	CheckOpenCLError(status, "clSetKernelArg. (numBins)");
+
+	status = clSetKernelArg(thresholdWideKernel, 2, sizeof(cl_mem), &d_threshold);
+	CheckOpenCLError(status, "clSetKernelArg. (threshold)");
+
+	status = clSetKernelArg(thresholdWideKernel, 3, groupSize * sizeof(cl_ulong), 0);
+	CheckOpenCLError(status, "clSetKernelArg. (counts)");
+
+	status = clSetKernelArg(thresholdWideKernel, 4, groupSize * sizeof(cl_ulong), 0);
+	CheckOpenCLError(status, "clSetKernelArg. (moments)");
+
+	status = clSetKernelArg(thresholdWideKernel, 5, groupSize * sizeof(cl_float), 0);
+	CheckOpenCLError(status, "clSetKernelArg. (bestVariance)");
+
+	status = clSetKernelArg(thresholdWideKernel, 6, groupSize * sizeof(cl_uint), 0);
+	CheckOpenCLError(status, "clSetKernelArg. (bestBin)");
 
-   printTiming(event_histogram1, "GPU Histogram 2b: ");
+	size_t globalThreadsThreshold[] = { groupSize };
+	size_t localThreadsThreshold[] = { groupSize };
+
+	cl_event threshold_wait_events[] = { event_histogramWide };
+
+	status = clEnqueueNDRangeKernel(commandQueue,
+									thresholdWideKernel,
+									1, // Dimensions
+									NULL, //offset
+									globalThreadsThreshold,
+									localThreadsThreshold,
+									1,
+									threshold_wait_events,
+									&event_thresholdWide);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
 
-   return;
-}
+	status = clSetKernelArg(thresholdingWideKernel, 0, sizeof(cl_mem), &d_wideInputBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
 
-void runCpuHistogram() 
-{
-	printf("Running CPU histogram implementation.\n");
-	volatile double t1 = getTime();
-	histogram(h_inputImageData, h_cpu_histogramData, width, height);
-	volatile double t2 = getTime();
-    double elapsedTime = (t2 - t1) * 1000.0f;
-    printf("CPU histogram:  elapsedTime %.3lf ms\n", elapsedTime);
-}
+	status = clSetKernelArg(thresholdingWideKernel, 1, sizeof(cl_mem), &d_wideOutputBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
 
-void runCpuEqualize() 
-{
-	printf("Running CPU equalization implementation.\n");
-	volatile double t1 = getTime();
-    equalize(h_inputImageData, h_cpu_outputImageData, h_gpu_histogramData, width * height);
-	volatile double t2 = getTime();
-    double elapsedTime = (t2 - t1) * 1000.0f;
-    printf("CPU equalize:  elapsedTime %.3lf ms\n", elapsedTime);
-}
+	status = clSetKernelArg(thresholdingWideKernel, 2, sizeof(cl_mem), &d_threshold);
+	CheckOpenCLError(status, "clSetKernelArg. (threshold)");
 
-void runGpuEqualization1() {
-	int status;
+	status = clSetKernelArg(thresholdingWideKernel, 3, sizeof(cl_uint), &numberOfPixels);
+	CheckOpenCLError(status, "clSetKernelArg. (numberOfPixels)");
 
-	/* histogram buffer */
-	status = clSetKernelArg(equalizeKernel1, 
-	                        0, 
-	                        sizeof(cl_mem), 
-	                        &d_histogramBuffer);
-	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+	status = clSetKernelArg(thresholdingWideKernel, 4, sizeof(cl_uint), &shift);
+	CheckOpenCLError(status, "clSetKernelArg. (binShift)");
 
-	/* output buffer */
-	status = clSetKernelArg(equalizeKernel1, 
-	                        1, 
-	                        sizeof(cl_mem), 
-	                        &d_newValuesBuffer);
-	CheckOpenCLError(status, "clSetKernelArg. (output)");
+	status = clSetKernelArg(thresholdingWideKernel, 5, sizeof(cl_uint), &maxValue);
+	CheckOpenCLError(status, "clSetKernelArg. (maxValue)");
 
-	//the global number of threads in each dimension has to be divisible
-	// by the local dimension numbers
-	size_t blockSizeX = 1;
+	size_t blockSizeX = 256;
 	size_t blockSizeY = 1;
 
-	checkWorkgroupSize(histogramKernel1, blockSizeX, blockSizeY);
-
-	size_t globalThreadsEqualize1[] = 
-	{
-		256
-	};
-	size_t localThreadsEqualize1[] = { 256 };
+	checkWorkgroupSize(thresholdingWideKernel, blockSizeX, blockSizeY);
 
-	cl_event equalize_wait_events[] = { event_histogram1 };
+	size_t globalThreadsThresholding[] = { ((numberOfPixels + blockSizeX - 1)/blockSizeX) * blockSizeX };
+	size_t localThreadsThresholding[] = { blockSizeX };
 
-	status = clEnqueueNDRangeKernel(commandQueue,
-		equalizeKernel1,
-		1, // Dimensions
-		NULL, //offset
-		globalThreadsEqualize1,
-		localThreadsEqualize1,
-		1, //num events in wait list
-		equalize_wait_events,
-		&event_equalize1);
+	cl_event thresholding_wait_events[] = { event_thresholdWide };
 
-	CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+    status = clEnqueueNDRangeKernel(commandQueue,
+                                    thresholdingWideKernel,
+                                    1, // Dimensions
+                                    NULL, //offset
+                                    globalThreadsThresholding,
+                                    localThreadsThresholding,
+                                    1,
+                                    thresholding_wait_events,
+                                    &event_thresholdingWide);
+    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
 
-	status = clWaitForEvents(1, &event_equalize1);
-	CheckOpenCLError(status, "clWaitForEvents.");
+    status = clWaitForEvents(1, &event_thresholdingWide);
+    CheckOpenCLError(status, "clWaitForEvents.");
 
-	//Read back the image - if textures were used for showing this wouldn't be necessary
-	//blocking read
 	status = clEnqueueReadBuffer(commandQueue,
-	                            d_newValuesBuffer,
+                                d_threshold,
                                 CL_TRUE,
                                 0,
-                                HISTOGRAM_SIZE * sizeof(cl_uint),
-                                h_newValuesData,
+                                sizeof(cl_uint),
+                                &h_threshold,
                                 0,
                                 0,
                                 0);
-	
-    CheckOpenCLError(status, "read equalize1 output.");
+    CheckOpenCLError(status, "read wide threshold.");
 
-	printTiming(event_equalize1, "GPU Equalize1: ");
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_wideOutputBuffer,
+                                CL_TRUE,
+                                0,
+								width * height * sizeof(cl_ushort),
+                                h_gpu_wideOutputData,
+                                0,
+                                0,
+                                0);
+   CheckOpenCLError(status, "read wide output.");
 
-	return;
+   printf("GPU threshold bin %u\n", h_threshold);
+   printTiming(event_thresholdWide, "GPU threshold wide: ");
+   printTiming(event_thresholdingWide, "GPU thresholding wide: ");
 }
 
-void runGpuEqualization2() {
+/**
+ * Updates the histogram of the frame in the input buffer from the tile histograms of the previous frame
+ * @param firstFrame true to count all tiles
+ * @return number of tiles counted again
+ */
+cl_uint runGpuTileHistogram(bool firstFrame)
+{
 	int status;
 
-	/* Setup arguments to the kernel */
+	cl_uint h_changedTiles = 0;
+	cl_uint tileSize = HISTOGRAM_TILE_SIZE;
+	cl_uint forceUpdate = firstFrame ? 1 : 0;
 
-    /* input buffer */
-    status = clSetKernelArg(equalizeKernel2, 
-                            0, 
-                            sizeof(cl_mem), 
-                            &d_inputImageBuffer);
+	runGpuClearHistogram(d_changedTilesBuffer, 1, &event_clearHistogram);
+
+	status = clSetKernelArg(tileHistogramUpdateKernel, 0, sizeof(cl_mem), &d_inputImageBuffer);
 	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
 
-	/* output buffer */
-	status = clSetKernelArg(equalizeKernel2, 
-	                        1, 
-	                        sizeof(cl_mem), 
-	                        &d_outputImageBuffer);
-	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
+	status = clSetKernelArg(tileHistogramUpdateKernel, 1, sizeof(cl_uint), &width);
+	CheckOpenCLError(status, "clSetKernelArg. (width)");
 
-	/* histogram buffer */
-	status = clSetKernelArg(equalizeKernel2, 
-                            2, 
-                            sizeof(cl_mem), 
-                            &d_newValuesBuffer);
-	
-	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+	status = clSetKernelArg(tileHistogramUpdateKernel, 2, sizeof(cl_uint), &height);
+	CheckOpenCLError(status, "clSetKernelArg. (height)");
 
-    /* image width */
-    status = clSetKernelArg(equalizeKernel2, 
-                            3, 
-                            sizeof(cl_uint), 
-                            &width);
+	status = clSetKernelArg(tileHistogramUpdateKernel, 3, sizeof(cl_uint), &tileSize);
+	CheckOpenCLError(status, "clSetKernelArg. (tileSize)");
 
-	CheckOpenCLError(status, "clSetKernelArg. (width)");
+	status = clSetKernelArg(tileHistogramUpdateKernel, 4, sizeof(cl_uint), &forceUpdate);
+	CheckOpenCLError(status, "clSetKernelArg. (forceUpdate)");
 
-	/* image height */
-    status = clSetKernelArg(equalizeKernel2, 
-                            4, 
-                            sizeof(cl_uint), 
-                            &height);
+	status = clSetKernelArg(tileHistogramUpdateKernel, 5, sizeof(cl_mem), &d_tileChecksumsBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (checksums)");
 
-	CheckOpenCLError(status, "clSetKernelArg. (height)");
+	status = clSetKernelArg(tileHistogramUpdateKernel, 6, sizeof(cl_mem), &d_tileHistogramsBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (tileHistograms)");
 
-	//the global number of threads in each dimension has to be divisible
-	// by the local dimension numbers
-	size_t blockSizeX = 16;
-	size_t blockSizeY = 16;
+	status = clSetKernelArg(tileHistogramUpdateKernel, 7, sizeof(cl_mem), &d_frameHistogramBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
 
-	checkWorkgroupSize(histogramKernel1, blockSizeX, blockSizeY);
+	status = clSetKernelArg(tileHistogramUpdateKernel, 8, sizeof(cl_mem), &d_changedTilesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (changedTiles)");
 
-	size_t globalThreadsEqualize2[] = 
+	status = clSetKernelArg(tileHistogramUpdateKernel, 9, HISTOGRAM_SIZE * sizeof(cl_uint), 0);
+	CheckOpenCLError(status, "clSetKernelArg. (cache)");
+
+	//one row of the tile per work item row
+	size_t blockSizeX = HISTOGRAM_TILE_SIZE;
+	size_t blockSizeY = 8;
+
+	checkWorkgroupSize(tileHistogramUpdateKernel, blockSizeX, blockSizeY);
+
+	status = clSetKernelArg(tileHistogramUpdateKernel, 10, blockSizeX * blockSizeY * sizeof(cl_uint), 0);
+	CheckOpenCLError(status, "clSetKernelArg. (partialChecksums)");
+
+	//one work group per tile
+	size_t globalThreads[] = 
 	{
-		((width + blockSizeX - 1)/blockSizeX) * blockSizeX,
-		((height + blockSizeY - 1)/blockSizeY) * blockSizeY
+		((width + HISTOGRAM_TILE_SIZE - 1) / HISTOGRAM_TILE_SIZE) * blockSizeX,
+		((height + HISTOGRAM_TILE_SIZE - 1) / HISTOGRAM_TILE_SIZE) * blockSizeY
 	};
-	size_t localThreadsEqualize2[] = {blockSizeX, blockSizeY};
+	size_t localThreads[] = {blockSizeX, blockSizeY};
 
-	cl_event equalize2_wait_events[] = { event_equalize1 };
+	cl_event tileHistogram_wait_events[] = { event_clearHistogram };
 
     status = clEnqueueNDRangeKernel(commandQueue,
-                                    equalizeKernel2,
+                                    tileHistogramUpdateKernel,
                                     2, // Dimensions
                                     NULL, //offset
-                                    globalThreadsEqualize2,
-                                    localThreadsEqualize2,
+                                    globalThreads,
+                                    localThreads,
                                     1,
-                                    equalize2_wait_events,
-                                    &event_equalize2);
+                                    tileHistogram_wait_events,
+                                    &event_tileHistogram);
     CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
 
-    status = clWaitForEvents(1, &event_equalize2);
+    status = clWaitForEvents(1, &event_tileHistogram);
     CheckOpenCLError(status, "clWaitForEvents.");
 
-	//Read back the histogram
-	//blocking read
+	status = clEnqueueReadBuffer(commandQueue,
+                                d_frameHistogramBuffer,
+                                CL_TRUE,
+                                0,
+								HISTOGRAM_SIZE * sizeof(cl_uint),
+                                h_gpu_histogramData,
+                                0,
+                                0,
+                                0);
+	CheckOpenCLError(status, "read frame histogram.");
 
 	status = clEnqueueReadBuffer(commandQueue,
-                                d_outputImageBuffer,
+                                d_changedTilesBuffer,
                                 CL_TRUE,
                                 0,
-								width * height * sizeof(cl_uchar4),
-                                h_gpu_outputImageData,
+								sizeof(cl_uint),
+                                &h_changedTiles,
                                 0,
                                 0,
                                 0);
-		
-   CheckOpenCLError(status, "read output.");
+	CheckOpenCLError(status, "read changed tiles.");
 
-   printTiming(event_equalize2, "GPU Equalize2: ");
+	printTiming(event_tileHistogram, "GPU Tile histogram update: ");
 
-   return;
+	return h_changedTiles;
 }
 
-void runCpuOtsu() 
+/**
+ * Reads the next frame named in the list file
+ * @param list opened list file, one image name per line
+ * @param frame gray values of the frame
+ * @return 0 if a frame was read, 1 at the end of the list, -1 on error
+ */
+int readNextFrame(FILE* list, cl_uchar* frame)
 {
-	printf("Running CPU otsu implementation.\n");
-	volatile double t1 = getTime();
-	otsu(h_inputImageData, h_cpu_outputImageData, h_gpu_histogramData, width, height);
-	volatile double t2 = getTime();
-    double elapsedTime = (t2 - t1) * 1000.0f;
-    printf("CPU otsu:  elapsedTime %.3lf ms\n", elapsedTime);
+	char frameName[1024];
+
+	while (fgets(frameName, sizeof(frameName), list) != NULL)
+	{
+		frameName[strcspn(frameName, "\r\n")] = '\0';
+
+		if (frameName[0] == '\0')
+			continue;
+
+		SDL_Surface *frameImage;
+
+		if (readImage(frameName, &frameImage) < 0)
+		{
+			return -1;
+		}
+
+		if (frameImage->w != width || frameImage->h != height)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Frame %s has to be as large as the image.", frameName);
+			SDL_FreeSurface(frameImage);
+			return -1;
+		}
+
+		toGrayScale((cl_uchar4*) frameImage->pixels, frame, width * height);
+		SDL_FreeSurface(frameImage);
+
+		printf("Frame %s\n", frameName);
+		return 0;
+	}
+
+	return 1;
 }
 
-void runGpuOtsu() 
+/**
+ * Computes histograms of the input image and the listed frames incrementally,
+ * only tiles which changed since the previous frame are counted again
+ */
+void runTileFrames()
 {
-	int status;
+	FILE* list = fopen(framesName, "r");
 
-	cl_ulong h_threshold[1];
+	if (list == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Unable to open frame list %s.", framesName);
+		return;
+	}
 
-	/* Setup arguments to the kernel */
+	tileHistogram_t tiles;
+	cl_uchar* frame = (cl_uchar*) malloc(width * height * sizeof(cl_uchar));
 
-	/* histogram buffer */
-	status = clSetKernelArg(thresholdKernel, 
-                            0, 
-                            sizeof(cl_mem), 
-                            &d_histogramBuffer);
-	
-	CheckOpenCLError(status, "clSetKernelArg. (histogram)");
+	if (frame == NULL || tileHistogramInit(&tiles, width, height, HISTOGRAM_TILE_SIZE) != 0)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for tile histograms.");
+		free(frame);
+		fclose(list);
+		return;
+	}
 
+	int numTiles = tiles.tilesX * tiles.tilesY;
+	cl_uint fullHistogram[HISTOGRAM_SIZE];
 
-	/* output buffer */
-	status = clSetKernelArg(thresholdKernel, 
-	                        1, 
-	                        sizeof(cl_mem), 
-	                        &d_threshold);
-	CheckOpenCLError(status, "clSetKernelArg. (threshold)");
-	
+	//tile histograms on the device start empty, the first frame counts all tiles
+	cl_event clearEvents[2];
+	runGpuClearHistogram(d_tileHistogramsBuffer, numTiles * HISTOGRAM_SIZE, &clearEvents[0]);
+	runGpuClearHistogram(d_frameHistogramBuffer, HISTOGRAM_SIZE, &clearEvents[1]);
 
-	//the global number of threads in each dimension has to be divisible
-	// by the local dimension numbers
+	cl_int status = clWaitForEvents(2, clearEvents);
+	CheckOpenCLError(status, "clWaitForEvents.");
 
-	size_t blockSizeX = 1;
-	size_t blockSizeY = 1;
+	memcpy(frame, h_inputImageData, width * height * sizeof(cl_uchar));
 
+	int result = 0;
+	for (int frameIndex = 0; result == 0; frameIndex++)
+	{
+		volatile double t1 = getTime();
+		int changedTiles = tileHistogramUpdate(&tiles, frame);
+		volatile double t2 = getTime();
+		double elapsedTime = (t2 - t1) * 1000.0f;
+		printf("CPU tile histogram update (%d of %d tiles):  elapsedTime %.3lf ms\n", changedTiles, numTiles, elapsedTime);
+
+		t1 = getTime();
+		histogramUnrolled(frame, fullHistogram, width, height);
+		t2 = getTime();
+		elapsedTime = (t2 - t1) * 1000.0f;
+		printf("CPU histogram unrolled:  elapsedTime %.3lf ms\n", elapsedTime);
+
+		status = clEnqueueWriteBuffer(commandQueue,
+                                  d_inputImageBuffer,
+                                  CL_TRUE, //blocking write
+                                  0,
+                                  width * height * sizeof(cl_uchar),
+                                  frame,
+                                  0,
+                                  0,
+                                  0);
+		CheckOpenCLError(status, "Copy frame data");
 
-	checkWorkgroupSize(thresholdKernel, blockSizeX, blockSizeY);
+		cl_uint gpuChangedTiles = runGpuTileHistogram(frameIndex == 0);
 
-	size_t globalThreadsThreshold[] = { 16 };
-	size_t localThreadsThreshold[] = { 16 };
+		bool cpuSame = memcmp(tiles.histogram, fullHistogram, sizeof(fullHistogram)) == 0;
+		bool gpuSame = memcmp(h_gpu_histogramData, fullHistogram, sizeof(fullHistogram)) == 0;
+		printf("Frame %d: %u tiles counted on gpu, cpu histogram is %s, gpu histogram is %s\n", frameIndex, gpuChangedTiles,
+			cpuSame ? "right" : "wrong", gpuSame ? "right" : "wrong");
 
-	cl_event threshold_wait_events[] = { event_histogram1 };
+		result = readNextFrame(list, frame);
+	}
 
-	status = clEnqueueNDRangeKernel(commandQueue,
-									thresholdKernel,
-									1, // Dimensions
-									NULL, //offset
-									globalThreadsThreshold,
-									localThreadsThreshold,
-									1, //num events in wait list
-									threshold_wait_events,
-									&event_threshold);
+	tileHistogramFree(&tiles);
+	free(frame);
+	fclose(list);
+}
 
-	CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+/**
+ * Grows the batch buffers on the device, they are kept for the following batches
+ * @param numPixels number of pixels of all images of the batch
+ * @param count number of images of the batch
+ */
+void reserveBatchBuffers(size_t numPixels, cl_uint count)
+{
+	cl_int status;
 
-	status = clWaitForEvents(1, &event_threshold);
-	CheckOpenCLError(status, "clWaitForEvents.");
+	if (numPixels > batchImagesSize)
+	{
+		if (d_batchImagesBuffer)
+		{
+			status = clReleaseMemObject(d_batchImagesBuffer);
+			CheckOpenCLError(status, "clReleaseMemObject batch images");
+			status = clReleaseMemObject(d_batchOutputBuffer);
+			CheckOpenCLError(status, "clReleaseMemObject batch output");
+		}
 
-	//Read back the image - if textures were used for showing this wouldn't be necessary
-	//blocking read
-	status = clEnqueueReadBuffer(commandQueue,
-	                            d_threshold,
-                                CL_TRUE,
-                                0,
-                                sizeof(cl_ulong),
-                                h_threshold,
-                                0,
-                                0,
-                                0);
-	
-    CheckOpenCLError(status, "read threshold output.");
+		batchImagesSize = numPixels;
+		d_batchImagesBuffer = clCreateBuffer(context,
+											 CL_MEM_READ_ONLY,
+											 batchImagesSize * sizeof(cl_uchar),
+											 0, &status);
+		CheckOpenCLError(status, "Allocate batch images buffer");
+
+		d_batchOutputBuffer = clCreateBuffer(context,
+											 CL_MEM_WRITE_ONLY,
+											 batchImagesSize * sizeof(cl_uchar),
+											 0, &status);
+		CheckOpenCLError(status, "Allocate batch output buffer");
+	}
+
+	if (count > batchTableSize)
+	{
+		if (d_batchTableBuffer)
+		{
+			status = clReleaseMemObject(d_batchTableBuffer);
+			CheckOpenCLError(status, "clReleaseMemObject batch table");
+			status = clReleaseMemObject(d_batchHistogramsBuffer);
+			CheckOpenCLError(status, "clReleaseMemObject batch histograms");
+			status = clReleaseMemObject(d_batchNewValuesBuffer);
+			CheckOpenCLError(status, "clReleaseMemObject batch new values");
+		}
+
+		batchTableSize = count;
+		d_batchTableBuffer = clCreateBuffer(context,
+											CL_MEM_READ_ONLY,
+											batchTableSize * sizeof(cl_uint4),
+											0, &status);
+		CheckOpenCLError(status, "Allocate batch table buffer");
+
+		d_batchHistogramsBuffer = clCreateBuffer(context,
+												 CL_MEM_READ_WRITE,
+												 batchTableSize * HISTOGRAM_SIZE * sizeof(cl_uint),
+												 0, &status);
+		CheckOpenCLError(status, "Allocate batch histograms buffer");
+
+		d_batchNewValuesBuffer = clCreateBuffer(context,
+												CL_MEM_READ_WRITE,
+												batchTableSize * HISTOGRAM_SIZE * sizeof(cl_uint),
+												0, &status);
+		CheckOpenCLError(status, "Allocate batch new values buffer");
+	}
+}
+
+/**
+ * Runs the selected method on one batch of images on cpu and gpu, on gpu with one launch per stage
+ * @param images gray values of all images packed one after another
+ * @param numPixels number of pixels of all images
+ * @param table offset of the first pixel, width and height of every image
+ * @param count number of images
+ * @return 0 if the outputs are the same, 1 if they differ, -1 on error
+ */
+int runBatch(const cl_uchar* images, size_t numPixels, const cl_uint4* table, cl_uint count)
+{
+	cl_int status;
+	size_t imagesSize = numPixels * sizeof(cl_uchar);
+
+	cl_uchar* cpuOutput = (cl_uchar*) malloc(imagesSize);
+	cl_uchar* gpuOutput = (cl_uchar*) malloc(imagesSize);
+	cl_uint* cpuHistograms = (cl_uint*) malloc(count * HISTOGRAM_SIZE * sizeof(cl_uint));
+
+	if (cpuOutput == NULL || gpuOutput == NULL || cpuHistograms == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for the batch outputs.");
+		free(cpuOutput);
+		free(gpuOutput);
+		free(cpuHistograms);
+		return -1;
+	}
 
-	printTiming(event_threshold, "GPU threshold: ");
+	volatile double t1 = getTime();
+	if (method == EQUALIZE)
+		equalizeBatch(images, table, count, cpuOutput, cpuHistograms);
+	else
+		otsuBatch(images, table, count, cpuOutput, cpuHistograms);
+	volatile double t2 = getTime();
+	printf("CPU batch of %u images:  elapsedTime %.3lf ms\n", count, (t2 - t1) * 1000.0f);
 
-	// thresholding 
+	t1 = getTime();
 
-	/* Setup arguments to the kernel */
+	reserveBatchBuffers(numPixels, count);
 
-    /* input buffer */
-    status = clSetKernelArg(thresholdingKernel, 
-                            0, 
-                            sizeof(cl_mem), 
-                            &d_inputImageBuffer);
-	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+	status = clEnqueueWriteBuffer(commandQueue, d_batchImagesBuffer, CL_FALSE, 0, imagesSize, images, 0, 0, 0);
+	CheckOpenCLError(status, "Copy batch images");
+	status = clEnqueueWriteBuffer(commandQueue, d_batchTableBuffer, CL_TRUE, 0, count * sizeof(cl_uint4), table, 0, 0, 0);
+	CheckOpenCLError(status, "Copy batch table");
 
-	/* output buffer */
-	status = clSetKernelArg(thresholdingKernel, 
-	                        1, 
-	                        sizeof(cl_mem), 
-	                        &d_outputImageBuffer);
-	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
+	//histograms, one work-group per image
+	cl_event event_batchHistogram, event_batchNewValues, event_batchApply;
 
-	/* image threshold */
-    status = clSetKernelArg(thresholdingKernel, 
-                            2, 
-                            sizeof(cl_mem), 
-                            &d_threshold);
+	status = clSetKernelArg(histogramBatchKernel, 0, sizeof(cl_mem), &d_batchImagesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (images)");
+	status = clSetKernelArg(histogramBatchKernel, 1, sizeof(cl_mem), &d_batchTableBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (table)");
+	status = clSetKernelArg(histogramBatchKernel, 2, sizeof(cl_mem), &d_batchHistogramsBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (histograms)");
 
-	CheckOpenCLError(status, "clSetKernelArg. (threshold)");
+	size_t localHistogram[] = { HISTOGRAM_SIZE };
+	size_t globalHistogram[] = { (size_t) count * HISTOGRAM_SIZE };
 
-    /* image width */
-    status = clSetKernelArg(thresholdingKernel, 
-                            3, 
-                            sizeof(cl_uint), 
-                            &width);
+	status = clEnqueueNDRangeKernel(commandQueue,
+									histogramBatchKernel,
+									1,
+									NULL, //offset
+									globalHistogram,
+									localHistogram,
+									0,
+									NULL,
+									&event_batchHistogram);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
 
-	CheckOpenCLError(status, "clSetKernelArg. (width)");
+	//new values or thresholds, one work-group of HISTOGRAM_SIZE / 2 work items per image
+	cl_kernel newValuesKernel = (method == EQUALIZE) ? equalizeBatchKernel1 : thresholdBatchKernel;
 
-	/* image height */
-    status = clSetKernelArg(thresholdingKernel, 
-                            4, 
-                            sizeof(cl_uint), 
-                            &height);
+	status = clSetKernelArg(newValuesKernel, 0, sizeof(cl_mem), &d_batchHistogramsBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (histograms)");
+	status = clSetKernelArg(newValuesKernel, 1, sizeof(cl_mem), &d_batchNewValuesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (newValues)");
 
-	CheckOpenCLError(status, "clSetKernelArg. (height)");
+	size_t localNewValues[] = { HISTOGRAM_SIZE / 2 };
+	size_t globalNewValues[] = { (size_t) count * HISTOGRAM_SIZE / 2 };
 
-	//the global number of threads in each dimension has to be divisible
-	// by the local dimension numbers
-	blockSizeX = 16;
-	blockSizeY = 16;
+	status = clEnqueueNDRangeKernel(commandQueue,
+									newValuesKernel,
+									1,
+									NULL, //offset
+									globalNewValues,
+									localNewValues,
+									1,
+									&event_batchHistogram,
+									&event_batchNewValues);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
 
-	checkWorkgroupSize(thresholdingKernel, blockSizeX, blockSizeY);
+	//outputs, the grid has one row of tiles of the largest image per image
+	cl_uint maxPixels = 0;
+	for (cl_uint i = 0; i < count; i++)
+	{
+		if (table[i].s[1] * table[i].s[2] > maxPixels)
+			maxPixels = table[i].s[1] * table[i].s[2];
+	}
 
-	size_t globalThreadsthresholding[] = 
+	status = clSetKernelArg(applyBatchKernel, 0, sizeof(cl_mem), &d_batchImagesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (images)");
+	status = clSetKernelArg(applyBatchKernel, 1, sizeof(cl_mem), &d_batchTableBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (table)");
+	status = clSetKernelArg(applyBatchKernel, 2, sizeof(cl_mem), &d_batchNewValuesBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (newValues)");
+	status = clSetKernelArg(applyBatchKernel, 3, sizeof(cl_mem), &d_batchOutputBuffer);
+	CheckOpenCLError(status, "clSetKernelArg. (outputImages)");
+
+	size_t localApply[] = { HISTOGRAM_SIZE, 1 };
+	size_t globalApply[] = 
 	{
-		((width + blockSizeX - 1)/blockSizeX) * blockSizeX,
-		((height + blockSizeY - 1)/blockSizeY) * blockSizeY
+		((size_t) (maxPixels + BATCH_TILE_PIXELS - 1) / BATCH_TILE_PIXELS) * HISTOGRAM_SIZE,
+		count
 	};
-	size_t localThreadsthresholding[] = {blockSizeX, blockSizeY};
 
-	cl_event thresholding_wait_events[] = { event_threshold };
+	status = clEnqueueNDRangeKernel(commandQueue,
+									applyBatchKernel,
+									2,
+									NULL, //offset
+									globalApply,
+									localApply,
+									1,
+									&event_batchNewValues,
+									&event_batchApply);
+	CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
 
-    status = clEnqueueNDRangeKernel(commandQueue,
-                                    thresholdingKernel,
-                                    2, // Dimensions
-                                    NULL, //offset
-                                    globalThreadsthresholding,
-                                    localThreadsthresholding,
-                                    1,
-                                    thresholding_wait_events,
-                                    &event_thresholding);
-    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+	status = clEnqueueReadBuffer(commandQueue, d_batchOutputBuffer, CL_TRUE, 0, imagesSize, gpuOutput, 1, &event_batchApply, 0);
+	CheckOpenCLError(status, "read batch output.");
 
-    status = clWaitForEvents(1, &event_thresholding);
-    CheckOpenCLError(status, "clWaitForEvents.");
+	t2 = getTime();
 
-	//Read back the histogram
-	//blocking read
+	cl_ulong startTime, endTime;
+	status = clGetEventProfilingInfo(event_batchHistogram, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &startTime, 0);
+	CheckOpenCLError(status, "clGetEventProfilingInfo.(startTime)");
+	status = clGetEventProfilingInfo(event_batchApply, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &endTime, 0);
+	CheckOpenCLError(status, "clGetEventProfilingInfo.(stopTime)");
 
-	status = clEnqueueReadBuffer(commandQueue,
-                                d_outputImageBuffer,
-                                CL_TRUE,
-                                0,
-								width * height * sizeof(cl_uchar4),
-                                h_gpu_outputImageData,
-                                0,
-                                0,
-                                0);
-		
-   CheckOpenCLError(status, "read output.");
+	printTiming(event_batchHistogram, "GPU Histogram batch: ");
+	printTiming(event_batchNewValues, (method == EQUALIZE) ? "GPU Equalize batch: " : "GPU threshold batch: ");
+	printTiming(event_batchApply, "GPU Apply batch: ");
+	printf("GPU batch of %u images kernels: elapsedTime %.3lf ms\n", count, (endTime - startTime) * 1e-6);
+	printf("GPU batch of %u images with transfers: elapsedTime %.3lf ms\n", count, (t2 - t1) * 1000.0f);
 
-   printTiming(event_thresholding, "GPU thresholding: ");
+	status = clReleaseEvent(event_batchHistogram);
+	CheckOpenCLError(status, "clReleaseEvent. (batchHistogram)");
+	status = clReleaseEvent(event_batchNewValues);
+	CheckOpenCLError(status, "clReleaseEvent. (batchNewValues)");
+	status = clReleaseEvent(event_batchApply);
+	CheckOpenCLError(status, "clReleaseEvent. (batchApply)");
 
-   return;
-}
+	bool same = memcmp(cpuOutput, gpuOutput, imagesSize) == 0;
+	printf("Batch outputs are %s\n", same ? "the same" : "different");
 
-void runCpuSeg() 
-{
-	printf("Running CPU segmentation implementation.\n");
-	volatile double t1 = getTime();
-    segmentation(h_inputImageData, h_cpu_outputImageData, width, height);
-	volatile double t2 = getTime();
-    double elapsedTime = (t2 - t1) * 1000.0f;
-    printf("CPU segmentation:  elapsedTime %.3lf ms\n", elapsedTime);
+	free(cpuOutput);
+	free(gpuOutput);
+	free(cpuHistograms);
+
+	return same ? 0 : 1;
 }
 
-void runGpuSeg() 
+/**
+ * Reads the images named in the batch list file and runs them in batches of at most BATCH_MAX_PIXELS pixels
+ * @return 0 on success, -1 if the list or one of its images can't be read
+ */
+int runBatches()
 {
-	int status;
-    
-	/* Setup arguments to the kernel */
+	FILE* list = fopen(batchName, "r");
 
-    /* input buffer */
-    status = clSetKernelArg(segKernel, 
-                            0, 
-                            sizeof(cl_mem), 
-                            &d_inputImageBuffer);
-	CheckOpenCLError(status, "clSetKernelArg. (inputImage)");
+	if (list == NULL)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Unable to open batch list %s.", batchName);
+		return -1;
+	}
 
-	/* output buffer */
-	status = clSetKernelArg(segKernel, 
-	                        1, 
-	                        sizeof(cl_mem), 
-	                        &d_outputImageBuffer);
-	CheckOpenCLError(status, "clSetKernelArg. (outputImage)");
-    
-    /* image width */
-    status = clSetKernelArg(segKernel, 
-                            2, 
-                            sizeof(cl_uint), 
-                            &width);
+	//host buffers grow to the largest batch and are reused
+	cl_uchar* images = NULL;
+	cl_uint4* table = NULL;
+	size_t numPixels = 0, imagesCapacity = 0;
+	cl_uint count = 0, tableCapacity = 0;
+	char imageName[1024];
+	int batches = 0, differentBatches = 0, result = 0;
 
-	CheckOpenCLError(status, "clSetKernelArg. (width)");
+	printf("Running %s on batches of images.\n", (method == EQUALIZE) ? "equalize" : "otsu");
 
-	/* image height */
-    status = clSetKernelArg(segKernel, 
-                            3, 
-                            sizeof(cl_uint), 
-                            &height);
+	while (fgets(imageName, sizeof(imageName), list) != NULL)
+	{
+		imageName[strcspn(imageName, "\r\n")] = '\0';
 
-	CheckOpenCLError(status, "clSetKernelArg. (height)");
+		if (imageName[0] == '\0')
+			continue;
 
-	//the global number of threads in each dimension has to be divisible
-	// by the local dimension numbers
-	size_t blockSizeX = 16;
-	size_t blockSizeY = 32;
+		SDL_Surface *image;
 
-	checkWorkgroupSize(segKernel, blockSizeX, blockSizeY);
+		if (readImage(imageName, &image) < 0)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Unable to read batch image %s.", imageName);
+			result = -1;
+			break;
+		}
 
-	size_t globalSize[] = 
-	{
-		((width + blockSizeX - 1)/blockSizeX) * blockSizeX,
-		((height + blockSizeY - 1)/blockSizeY) * blockSizeY
-	};
-	size_t localSize[] = {blockSizeX, blockSizeY};
+		size_t pixels = (size_t) image->w * image->h;
 
-	cl_event wait_events[] = { event_seg };
+		if (count > 0 && numPixels + pixels > BATCH_MAX_PIXELS)
+		{
+			int different = runBatch(images, numPixels, table, count);
+			if (different < 0)
+			{
+				SDL_FreeSurface(image);
+				result = -1;
+				break;
+			}
+
+			differentBatches += different;
+			batches++;
+			numPixels = 0;
+			count = 0;
+		}
 
-    status = clEnqueueNDRangeKernel(commandQueue,
-                                    segKernel,
-                                    2, // Dimensions
-                                    NULL, //offset
-                                    globalSize,
-                                    localSize,
-                                    0,
-                                    NULL,
-                                    &event_seg);
-    CheckOpenCLError(status, "clEnqueueNDRangeKernel.");
+		if (numPixels + pixels > imagesCapacity)
+		{
+			imagesCapacity = (numPixels + pixels > BATCH_MAX_PIXELS) ? numPixels + pixels : BATCH_MAX_PIXELS;
+			cl_uchar* grown = (cl_uchar*) realloc(images, imagesCapacity * sizeof(cl_uchar));
+			if (grown == NULL)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for batch images.");
+				SDL_FreeSurface(image);
+				result = -1;
+				break;
+			}
+			images = grown;
+		}
 
-    status = clWaitForEvents(1, &event_seg);
-    CheckOpenCLError(status, "clWaitForEvents.");
+		if (count == tableCapacity)
+		{
+			tableCapacity = (tableCapacity > 0) ? tableCapacity * 2 : 64;
+			cl_uint4* grown = (cl_uint4*) realloc(table, tableCapacity * sizeof(cl_uint4));
+			if (grown == NULL)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Failed to allocate memory for batch table.");
+				SDL_FreeSurface(image);
+				result = -1;
+				break;
+			}
+			table = grown;
+		}
 
-	//Read back the histogram
-	//blocking read
+		table[count].s[0] = (cl_uint) numPixels;
+		table[count].s[1] = image->w;
+		table[count].s[2] = image->h;
+		table[count].s[3] = 0;
+		count++;
 
-	status = clEnqueueReadBuffer(commandQueue,
-                                d_outputImageBuffer,
-                                CL_TRUE,
-                                0,
-								width * height * sizeof(cl_uchar4),
-                                h_gpu_outputImageData,
-                                0,
-                                0,
-                                0);
-		
-   CheckOpenCLError(status, "read output.");
+		toGrayScale((cl_uchar4*) image->pixels, &images[numPixels], (int) pixels);
+		numPixels += pixels;
+		SDL_FreeSurface(image);
+	}
 
-   printTiming(event_seg, "GPU segmentation: ");
+	//the batch with the unreadable image is not run, the error ends the list
+	if (result == 0 && count > 0)
+	{
+		int different = runBatch(images, numPixels, table, count);
+		if (different < 0)
+		{
+			result = -1;
+		}
+		else
+		{
+			differentBatches += different;
+			batches++;
+		}
+	}
 
-   return;
+	if (result == 0)
+		printf("%d batches, %d with different outputs\n", batches, differentBatches);
+
+	free(images);
+	free(table);
+	fclose(list);
+
+	return result;
 }
 
 int cleanup()
@@ -1270,8 +4320,17 @@ int cleanup()
 	status = clReleaseKernel(histogramKernel2a);
     CheckOpenCLError(status, "clReleaseKernel histogram2a.");
 
-	status = clReleaseKernel(histogramKernel2b);
-    CheckOpenCLError(status, "clReleaseKernel histogram2b.");
+	status = clReleaseKernel(reduceHistogramsKernel);
+    CheckOpenCLError(status, "clReleaseKernel reduceHistograms.");
+
+	status = clReleaseKernel(histogramKernel3);
+    CheckOpenCLError(status, "clReleaseKernel histogram3.");
+
+	status = clReleaseKernel(clearHistogramKernel);
+    CheckOpenCLError(status, "clReleaseKernel clearHistogram.");
+
+	status = clReleaseKernel(histogramRGBLKernel);
+    CheckOpenCLError(status, "clReleaseKernel histogramRGBL.");
 
 	status = clReleaseKernel(equalizeKernel1);
 	CheckOpenCLError(status, "clReleaseKernel equalize1.");
@@ -1282,27 +4341,193 @@ int cleanup()
 	status = clReleaseKernel(thresholdKernel);
 	CheckOpenCLError(status, "clReleaseKernel threshold.");
 
-	status = clReleaseKernel(thresholdingKernel);
-	CheckOpenCLError(status, "clReleaseKernel thresholding.");
+	status = clReleaseKernel(thresholdMultiKernel);
+	CheckOpenCLError(status, "clReleaseKernel thresholdMulti.");
+
+	status = clReleaseKernel(thresholdingKernel);
+	CheckOpenCLError(status, "clReleaseKernel thresholding.");
+
+	status = clReleaseKernel(thresholdingPackedKernel);
+	CheckOpenCLError(status, "clReleaseKernel thresholdingPacked.");
+
+	status = clReleaseKernel(segPackedKernel);
+	CheckOpenCLError(status, "clReleaseKernel segmentationPacked.");
+
+	status = clReleaseKernel(segGridKernel);
+	CheckOpenCLError(status, "clReleaseKernel segmentationGrid.");
+
+	status = clReleaseKernel(segInterpolateKernel);
+	CheckOpenCLError(status, "clReleaseKernel segmentationInterpolate.");
+
+	status = clReleaseKernel(histogramBatchKernel);
+	CheckOpenCLError(status, "clReleaseKernel histogramBatch.");
+
+	status = clReleaseKernel(equalizeBatchKernel1);
+	CheckOpenCLError(status, "clReleaseKernel equalizeBatch1.");
+
+	status = clReleaseKernel(thresholdBatchKernel);
+	CheckOpenCLError(status, "clReleaseKernel thresholdBatch.");
+
+	status = clReleaseKernel(applyBatchKernel);
+	CheckOpenCLError(status, "clReleaseKernel applyBatch.");
+
+	status = clReleaseKernel(histogramWideKernel);
+	CheckOpenCLError(status, "clReleaseKernel histogramWide.");
+
+	status = clReleaseKernel(equalizeWideKernel1);
+	CheckOpenCLError(status, "clReleaseKernel equalizeWide1.");
+
+	status = clReleaseKernel(equalizeWideKernel2);
+	CheckOpenCLError(status, "clReleaseKernel equalizeWide2.");
+
+	status = clReleaseKernel(thresholdWideKernel);
+	CheckOpenCLError(status, "clReleaseKernel thresholdWide.");
+
+	status = clReleaseKernel(thresholdingWideKernel);
+	CheckOpenCLError(status, "clReleaseKernel thresholdingWide.");
+
+	status = clReleaseKernel(histogramROIKernel);
+	CheckOpenCLError(status, "clReleaseKernel histogramROI.");
+
+	status = clReleaseKernel(tileHistogramUpdateKernel);
+	CheckOpenCLError(status, "clReleaseKernel tileHistogramUpdate.");
+
+	status = clReleaseKernel(claheTilesKernel);
+	CheckOpenCLError(status, "clReleaseKernel claheTiles.");
+
+	status = clReleaseKernel(claheApplyKernel);
+	CheckOpenCLError(status, "clReleaseKernel claheApply.");
+
+	status = clReleaseKernel(histogramLumaKernel);
+	CheckOpenCLError(status, "clReleaseKernel histogramLuma.");
+
+	status = clReleaseKernel(equalizeColorKernel);
+	CheckOpenCLError(status, "clReleaseKernel equalizeColor.");
+
+
+	status = clReleaseKernel(matchKernel1);
+	CheckOpenCLError(status, "clReleaseKernel match1.");
+
+    status = clReleaseProgram(program);
+    CheckOpenCLError(status, "clReleaseProgram.");
+
+    status = clReleaseMemObject(d_inputImageBuffer);
+    CheckOpenCLError(status, "clReleaseMemObject input");
+    
+    status = clReleaseMemObject(d_histogramBuffer);
+    CheckOpenCLError(status, "clReleaseMemObject histogram");
+
+	if (histogramMethod == 2)
+	{
+	    status = clReleaseMemObject(d_subHistogramsBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject histogram 2");
+	}
+
+	if (d_colorImageBuffer)
+	{
+	    status = clReleaseMemObject(d_colorImageBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject color input");
+	}
+
+	if (d_channelHistogramBuffer)
+	{
+	    status = clReleaseMemObject(d_channelHistogramBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject channel histogram");
+	}
+
+	if (d_referenceCumulativeBuffer)
+	{
+	    status = clReleaseMemObject(d_referenceCumulativeBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject reference cumulative histogram");
+	}
+
+	if (d_colorOutputBuffer)
+	{
+	    status = clReleaseMemObject(d_colorOutputBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject color output");
+	}
+
+	if (d_reduceBuffer)
+	{
+	    status = clReleaseMemObject(d_reduceBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject reduce");
+	}
+
+	if (d_batchImagesBuffer)
+	{
+	    status = clReleaseMemObject(d_batchImagesBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject batch images");
+	    status = clReleaseMemObject(d_batchOutputBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject batch output");
+	}
+
+	if (d_batchTableBuffer)
+	{
+	    status = clReleaseMemObject(d_batchTableBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject batch table");
+	    status = clReleaseMemObject(d_batchHistogramsBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject batch histograms");
+	    status = clReleaseMemObject(d_batchNewValuesBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject batch new values");
+	}
+
+	if (wideMode)
+	{
+	    status = clReleaseMemObject(d_wideInputBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject wide input");
+
+	    status = clReleaseMemObject(d_wideOutputBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject wide output");
+
+	    status = clReleaseMemObject(d_wideHistogramBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject wide histogram");
+
+	    status = clReleaseMemObject(d_wideNewValuesBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject wide new values");
+	}
+
+	if (d_maskBuffer)
+	{
+	    status = clReleaseMemObject(d_maskBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject mask");
+	}
+
+	if (d_claheNewValuesBuffer)
+	{
+	    status = clReleaseMemObject(d_claheNewValuesBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject clahe new values");
+	}
+
+	if (framesName != NULL)
+	{
+	    status = clReleaseMemObject(d_tileHistogramsBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject tile histograms");
 
-    status = clReleaseProgram(program);
-    CheckOpenCLError(status, "clReleaseProgram.");
+	    status = clReleaseMemObject(d_tileChecksumsBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject tile checksums");
 
-    status = clReleaseMemObject(d_inputImageBuffer);
-    CheckOpenCLError(status, "clReleaseMemObject input");
-    
-    status = clReleaseMemObject(d_histogramBuffer);
-    CheckOpenCLError(status, "clReleaseMemObject histogram");
+	    status = clReleaseMemObject(d_frameHistogramBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject frame histogram");
 
-	if (histogramMethod == 2)
-	{
-	    status = clReleaseMemObject(d_subHistogramsBuffer);
-        CheckOpenCLError(status, "clReleaseMemObject histogram 2");
+	    status = clReleaseMemObject(d_changedTilesBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject changed tiles");
 	}
 	
     status = clReleaseMemObject(d_outputImageBuffer);
     CheckOpenCLError(status, "clReleaseMemObject output");
 
+	if (d_outputMaskBuffer)
+	{
+	    status = clReleaseMemObject(d_outputMaskBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject output mask");
+	}
+
+	if (d_segGridBuffer)
+	{
+	    status = clReleaseMemObject(d_segGridBuffer);
+        CheckOpenCLError(status, "clReleaseMemObject segmentation grid");
+	}
+
 	status = clReleaseMemObject(d_threshold);
     CheckOpenCLError(status, "clReleaseMemObject threshold");
 
@@ -1322,6 +4547,12 @@ int cleanup()
 	if(h_cpu_outputImageData)
         free(h_cpu_outputImageData);
 
+	if(h_cpu_outputMaskData)
+        free(h_cpu_outputMaskData);
+
+	if(h_gpu_outputMaskData)
+        free(h_gpu_outputMaskData);
+
 	if(h_cpu_histogramData)
         free(h_cpu_histogramData);
 
@@ -1334,15 +4565,207 @@ int cleanup()
 	if(h_newValuesData)
         free(h_newValuesData);
 
+	if(h_colorImageData)
+        free(h_colorImageData);
+
+	if(h_cpu_colorOutputData)
+        free(h_cpu_colorOutputData);
+
+	if(h_referenceCumulativeData)
+        free(h_referenceCumulativeData);
+
+	if(h_gpu_colorOutputData)
+        free(h_gpu_colorOutputData);
+
+	if(h_cpu_channelHistogramData)
+        free(h_cpu_channelHistogramData);
+
+	if(h_gpu_channelHistogramData)
+        free(h_gpu_channelHistogramData);
+
+	if(h_wideInputData)
+        free(h_wideInputData);
+
+	if(h_cpu_wideOutputData)
+        free(h_cpu_wideOutputData);
+
+	if(h_gpu_wideOutputData)
+        free(h_gpu_wideOutputData);
+
+	if(h_cpu_wideHistogramData)
+        free(h_cpu_wideHistogramData);
+
+	if(h_gpu_wideHistogramData)
+        free(h_gpu_wideHistogramData);
+
+	if(h_maskData)
+        free(h_maskData);
+
     return 0;
 }
 
+void printUsage()
+{
+	cout << "Usage: gmu.exe <metoda histogramu> <metoda> <cesta k obrazku> [volby]\n";
+	cout << "  <metoda histogramu> - Moznosti: hist1, hist2, hist3\n";
+	cout << "  <metoda> - Moznosti: equalize, otsu, segmentation, rgbhist, clahe, colorequalize, match\n";
+	cout << "  <cesta k obrazku> - obrazek .pgm muze mit az 16 bitu na pixel\n";
+	cout << "  [volby] - Moznosti:\n";
+	cout << "    bins=<n> - pocet binu histogramu, mocnina dvou od 2 do 65536 (equalize, otsu)\n";
+	cout << "    roi=<x>,<y>,<sirka>,<vyska> - histogram jen z obdelniku obrazku (equalize, otsu, match)\n";
+	cout << "    mask=<cesta k masce> - histogram jen z pixelu s nenulovou maskou (equalize, otsu, match)\n";
+	cout << "    frames=<seznam snimku> - inkrementalni histogramy dalsich snimku, jeden obrazek na radek\n";
+	cout << "    integral=<n> - segmentace i z integralniho histogramu s n biny, mocnina dvou do 256 (segmentation)\n";
+	cout << "    grid=<n> - priblizna segmentace, prahy jen v uzlech mrizky po n pixelech, od 1 do 16, mezi nimi interpolace (segmentation)\n";
+	cout << "    stream=<vystupni .pgm> - zpracovani .pgm obrazku po pasech bez nacteni celeho obrazku (equalize, otsu)\n";
+	cout << "    band=<n> - pocet radku jednoho pasu pri stream, vychozi 256\n";
+	cout << "    ref=<obrazek nebo .hist> - reference pro match, soubor .hist obsahuje 256 cetnosti\n";
+	cout << "    tile=<n> - sirka a vyska dlazdice, vychozi 64 (clahe)\n";
+	cout << "    clip=<n> - nejvyssi sloupec histogramu dlazdice jako nasobek prumeru, vychozi 3 (clahe)\n";
+	cout << "    classes=<n> - pocet trid od 2 do 4, vystupem je obrazek s rovnomerne rozlozenymi urovnemi trid (otsu)\n";
+	cout << "    pipeline - kernely bez cekani a cteni mezivysledku, cte se jen vystupni obrazek (equalize, otsu)\n";
+	cout << "    pipeline=taps - jako pipeline, ale mezivysledky se pro ladeni ctou\n";
+	cout << "    batch=<seznam obrazku> - dalsi male obrazky zpracovane po davkach, jedno spusteni kernelu na krok, jeden obrazek na radek (equalize, otsu)\n";
+	cout << "    packed - vystupem je binarni maska, 32 pixelu v jednom slove, rozbali se jen pro zobrazeni (otsu, segmentation)\n";
+}
+
+/**
+ * Parse the options following the image name, every option has the form name=value
+ * @return 0 on success, -1 on unknown or invalid option
+ */
+int parseOptions(int argc, char* argv[])
+{
+	for (int i = 4; i < argc; i++)
+	{
+		if (!strncmp(argv[i], "bins=", 5))
+		{
+			numBins = (cl_uint) strtoul(argv[i] + 5, NULL, 10);
+
+			if (numBins < 2 || numBins > WIDE_MAX_BINS || (numBins & (numBins - 1)) != 0)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Number of bins has to be a power of two from 2 to %u.", WIDE_MAX_BINS);
+				return -1;
+			}
+		}
+		else if (!strncmp(argv[i], "roi=", 4))
+		{
+			if (sscanf(argv[i] + 4, "%d,%d,%d,%d", &roi.x, &roi.y, &roi.width, &roi.height) != 4)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Rectangle has to be given as roi=x,y,width,height.");
+				return -1;
+			}
+
+			roiGiven = true;
+		}
+		else if (!strncmp(argv[i], "mask=", 5))
+		{
+			maskName = argv[i] + 5;
+		}
+		else if (!strncmp(argv[i], "frames=", 7))
+		{
+			framesName = argv[i] + 7;
+		}
+		else if (!strncmp(argv[i], "stream=", 7))
+		{
+			streamName = argv[i] + 7;
+		}
+		else if (!strncmp(argv[i], "band=", 5))
+		{
+			streamBandRows = atoi(argv[i] + 5);
+
+			if (streamBandRows < 1)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Band has to have at least one row.");
+				return -1;
+			}
+		}
+		else if (!strncmp(argv[i], "ref=", 4))
+		{
+			referenceName = argv[i] + 4;
+		}
+		else if (!strncmp(argv[i], "tile=", 5))
+		{
+			claheTileSize = atoi(argv[i] + 5);
+
+			if (claheTileSize < 2 || claheTileSize > 1024)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Tile size has to be from 2 to 1024.");
+				return -1;
+			}
+		}
+		else if (!strncmp(argv[i], "clip=", 5))
+		{
+			double clip = atof(argv[i] + 5);
+
+			if (clip < 1.0 || clip > 256.0)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Clip limit has to be from 1 to 256.");
+				return -1;
+			}
+
+			claheClipLimit = (cl_uint) (clip * CLAHE_CLIP_SCALE + 0.5);
+		}
+		else if (!strncmp(argv[i], "classes=", 8))
+		{
+			otsuClasses = atoi(argv[i] + 8);
+
+			if (otsuClasses < 2 || otsuClasses > (int) OTSU_MAX_CLASSES)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Number of otsu classes has to be from 2 to %u.", OTSU_MAX_CLASSES);
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i], "pipeline"))
+		{
+			pipelineMode = true;
+		}
+		else if (!strncmp(argv[i], "batch=", 6))
+		{
+			batchName = argv[i] + 6;
+		}
+		else if (!strcmp(argv[i], "packed"))
+		{
+			packedMode = true;
+		}
+		else if (!strcmp(argv[i], "pipeline=taps"))
+		{
+			pipelineMode = true;
+			pipelineTaps = true;
+		}
+		else if (!strncmp(argv[i], "integral=", 9))
+		{
+			integralBins = atoi(argv[i] + 9);
+
+			if (integralBins < 1 || integralBins > (int) HISTOGRAM_SIZE || (integralBins & (integralBins - 1)) != 0)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Number of integral histogram bins has to be a power of two up to %u.", HISTOGRAM_SIZE);
+				return -1;
+			}
+		}
+		else if (!strncmp(argv[i], "grid=", 5))
+		{
+			segGridStride = atoi(argv[i] + 5);
+
+			if (segGridStride < 1 || segGridStride > SEG_GRID_MAX_STRIDE)
+			{
+				logMessage(DEBUG_LEVEL_ERROR, "Grid stride has to be from 1 to %d.", SEG_GRID_MAX_STRIDE);
+				return -1;
+			}
+		}
+		else
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Unknown option %s.", argv[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 int main(int argc, char* argv[])
 {
-	if(argc != 4) {
-		cout << "Usage: gmu.exe <metoda histogramu> <metoda> <cesta k obrazku>\n";
-		cout << "  <metoda histogramu> - Moznosti: hist1, hist2\n";
-		cout << "  <metoda> - Moznosti: equalize, otsu, segmentation\n";
+	if(argc < 4) {
+		printUsage();
 
 		return 1;
 	}
@@ -1355,11 +4778,13 @@ int main(int argc, char* argv[])
 	{
         histogramMethod = 2;
 	}
+    else if(!strcmp(argv[1], "hist3"))
+	{
+        histogramMethod = 3;
+	}
 	else
 	{
-		cout << "Usage: gmu.exe <metoda histogramu> <metoda> <cesta k obrazku>\n";
-		cout << "  <metoda histogramu> - Moznosti: hist1, hist2\n";
-		cout << "  <metoda> - Moznosti: equalize, otsu, segmentation\n";
+		printUsage();
 
 		return 1;
 	}
@@ -1376,12 +4801,81 @@ int main(int argc, char* argv[])
 	{
         method = SEGMENTATION;
 	}
+    else if(!strcmp(argv[2], "rgbhist"))
+	{
+        method = CHANNEL_HISTOGRAM;
+	}
+	else if(!strcmp(argv[2], "clahe"))
+	{
+		method = CLAHE;
+	}
+	else if(!strcmp(argv[2], "colorequalize"))
+	{
+		method = COLOR_EQUALIZE;
+	}
+	else if(!strcmp(argv[2], "match"))
+	{
+		method = MATCH;
+	}
 	else
 	{
-		cout << "Usage: gmu.exe <metoda histogramu> <metoda> <cesta k obrazku>\n";
-		cout << "  <metoda histogramu> - Moznosti: hist1, hist2\n";
-		cout << "  <metoda> - Moznosti: equalize, otsu, segmentation\n";
+		printUsage();
+
+		return 1;
+	}
+
+	if (parseOptions(argc, argv) != 0)
+	{
+		printUsage();
+
+		return 1;
+	}
+
+	if (packedMode && ((method != OTSU && method != SEGMENTATION) || otsuClasses > 2))
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Packed mask is supported only by otsu with two classes and segmentation.");
+		return 1;
+	}
+
+	if (segGridStride > 0 && (method != SEGMENTATION || packedMode))
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Grid is supported only by segmentation without the packed mask.");
+		return 1;
+	}
+
+	if (batchName != NULL && ((method != EQUALIZE && method != OTSU) || otsuClasses > 2))
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Batch supports only equalize and otsu with two classes.");
+		return 1;
+	}
+
+	if (otsuClasses > 2 && method != OTSU)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Classes are supported only by otsu.");
+		return 1;
+	}
+
+	//streaming works only with files, there is no window
+	if (streamName != NULL)
+	{
+		if (otsuClasses > 2 || packedMode || batchName != NULL)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Streaming supports neither more otsu classes, packed mask nor batch.");
+			return 1;
+		}
 
+		if (method != EQUALIZE && method != OTSU)
+		{
+			logMessage(DEBUG_LEVEL_ERROR, "Streaming supports only equalize and otsu.");
+			return 1;
+		}
+
+		return (runStreaming(argv[3]) == 0) ? 0 : 1;
+	}
+
+	if (pipelineMode && method != EQUALIZE && method != OTSU)
+	{
+		logMessage(DEBUG_LEVEL_ERROR, "Pipeline supports only equalize and otsu.");
 		return 1;
 	}
 
@@ -1418,23 +4912,12 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
-void compareResults()
+void compareOutputs()
 {
-	printf("Comparing gpu and cpu histogram:\n");
-	for (int i = 0; i < HISTOGRAM_SIZE; i++) 
-	{
-        if (h_cpu_histogramData[i] != h_gpu_histogramData[i]) 
-		{
-            printf("GPU and CPU histogams are different!\n");
-            break;
-        }
-		if (i == HISTOGRAM_SIZE - 1) printf("GPU and CPU histograms are the same!\n");
-    }
-
 	printf("Comparing gpu and cpu output:\n");
 	for (int i = 0; i < width * height; i++) 
 	{
-        if (h_cpu_outputImageData[i].s[0] != h_gpu_outputImageData[i].s[0]) 
+        if (h_cpu_outputImageData[i] != h_gpu_outputImageData[i]) 
 		{
             printf("GPU and CPU outputs are different!\n");
             break;
@@ -1443,48 +4926,268 @@ void compareResults()
     }
 }
 
+void compareResults()
+{
+	//the gpu histogram is not read back in the pipeline mode
+	if (readIntermediate())
+	{
+		printf("Comparing gpu and cpu histogram:\n");
+		for (int i = 0; i < HISTOGRAM_SIZE; i++) 
+		{
+			if (h_cpu_histogramData[i] != h_gpu_histogramData[i]) 
+			{
+				printf("GPU and CPU histogams are different!\n");
+				break;
+			}
+			if (i == HISTOGRAM_SIZE - 1) printf("GPU and CPU histograms are the same!\n");
+		}
+	}
+
+	compareOutputs();
+}
+
+void compareColorResults()
+{
+	bool same = memcmp(h_cpu_histogramData, h_gpu_histogramData, HISTOGRAM_SIZE * sizeof(cl_uint)) == 0;
+	printf("GPU and CPU luma histograms are %s!\n", same ? "the same" : "different");
+
+	same = memcmp(h_cpu_colorOutputData, h_gpu_colorOutputData, width * height * sizeof(cl_uchar4)) == 0;
+	printf("GPU and CPU colour outputs are %s!\n", same ? "the same" : "different");
+}
+
+void compareChannelHistograms()
+{
+	const char* channelNames[] = { "red", "green", "blue", "luma" };
+
+	printf("Comparing gpu and cpu multi-channel histograms:\n");
+	for (cl_uint channel = 0; channel < HISTOGRAM_CHANNELS; channel++)
+	{
+		bool same = memcmp(h_cpu_channelHistogramData + channel * HISTOGRAM_SIZE,
+						   h_gpu_channelHistogramData + channel * HISTOGRAM_SIZE,
+						   HISTOGRAM_SIZE * sizeof(cl_uint)) == 0;
+
+		printf("GPU and CPU %s histograms are %s\n", channelNames[channel], same ? "the same!" : "different!");
+	}
+}
+
+void compareWideResults()
+{
+	printf("Comparing gpu and cpu wide histogram:\n");
+	bool same = memcmp(h_cpu_wideHistogramData, h_gpu_wideHistogramData, numBins * sizeof(cl_uint)) == 0;
+	printf("GPU and CPU histograms are %s\n", same ? "the same!" : "different!");
+
+	printf("Comparing gpu and cpu wide output:\n");
+	same = memcmp(h_cpu_wideOutputData, h_gpu_wideOutputData, width * height * sizeof(cl_ushort)) == 0;
+	printf("GPU and CPU outputs are %s\n", same ? "the same!" : "different!");
+}
+
 /**
- * Called after context was created
+ * Runs the selected method on the wide input, the output is scaled to 8 bits for display
  */
-void onInit()
+void runWideMethod()
 {
-	if(setupCL() != 0)
-		return;
-  
-	
+	runCpuHistogramWide();
+	runGpuHistogramWide();
+
+	if (method == EQUALIZE)
+	{
+		runCpuEqualizeWide();
+		runGpuEqualizationWide();
+	}
+	else
+	{
+		runCpuOtsuWide();
+		runGpuOtsuWide();
+	}
+
+	compareWideResults();
+
+	wideToGray(h_gpu_wideOutputData, h_gpu_outputImageData, width * height);
+}
+
+/**
+ * Enqueues the gpu histogram by the selected histogram method, or of the rectangle and mask if they were given
+ */
+void runGpuHistograms()
+{
+	if (roiMode)
+		runGpuHistogramROI();
+	else if (histogramMethod == 1)
+		runGpuHistogram1();
+	else if (histogramMethod == 2)
+		runGpuHistogram2();
+	else if (histogramMethod == 3)
+		runGpuHistogram3();
+}
+
+/**
+ * Computes the histogram on cpu and gpu by the selected histogram method, or of the rectangle and mask if they were given
+ */
+void runHistograms()
+{
+	if (roiMode)
+		runCpuHistogramROI();
+	else
+		runCpuHistogram();
+
+	runGpuHistograms();
+}
 
+/**
+ * Returns the event of the first kernel of the selected gpu histogram
+ */
+cl_event firstHistogramEvent()
+{
+	if (roiMode || histogramMethod == 3)
+		return event_clearHistogram;
+	if (histogramMethod == 2)
+		return event_histogram2;
+	return event_histogram1;
+}
+
+/**
+ * Runs equalize or otsu on gpu as one chain of kernels, histogram -> new values or threshold -> output image.
+ * The stages do not wait for each other on the host, only the output image is read back.
+ */
+void runPipeline()
+{
+	if (roiMode)
+		runCpuHistogramROI();
+	else
+		runCpuHistogram();
+
+	if (method == EQUALIZE)
+		runCpuEqualize();
+	else
+		runCpuOtsu();
+
+	printf("Running GPU %s pipeline%s.\n", (method == EQUALIZE) ? "equalize" : "otsu", pipelineTaps ? " with intermediate readbacks" : "");
+
+	volatile double t1 = getTime();
+	runGpuHistograms();
+	if (method == EQUALIZE)
+	{
+		runGpuEqualization1();
+		runGpuEqualization2(event_equalize1);
+	}
+	else
+	{
+		runGpuOtsu();
+	}
+	volatile double t2 = getTime();
+
+	//profiling info of the stages is available only now
+	cl_event lastEvent = (method == EQUALIZE) ? event_equalize2 : event_thresholding;
+	if (!pipelineTaps)
+	{
+		//the histogram stage can be several kernels, from clearing or the partial histograms to the last reduce pass
+		printTimingSpan(firstHistogramEvent(), event_histogram1, "GPU Histogram: ");
+		printTiming((method == EQUALIZE) ? event_equalize1 : event_threshold, (method == EQUALIZE) ? "GPU Equalize1: " : "GPU threshold: ");
+	}
+
+	cl_ulong startTime, endTime;
+	cl_int status = clGetEventProfilingInfo(firstHistogramEvent(), CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &startTime, 0);
+	CheckOpenCLError(status, "clGetEventProfilingInfo.(startTime)");
+	status = clGetEventProfilingInfo(lastEvent, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &endTime, 0);
+	CheckOpenCLError(status, "clGetEventProfilingInfo.(stopTime)");
+
+	printf("GPU pipeline kernels: elapsedTime %.3lf ms\n", (endTime - startTime) * 1e-6);
+	printf("GPU pipeline with readback: elapsedTime %.3lf ms\n", (t2 - t1) * 1000.0f);
+
+	compareResults();
+}
+
+/**
+ * Runs the selected method on the 8-bit input
+ */
+void runMethod()
+{
 	switch (method)
 	{
 	case EQUALIZE:
-        runCpuHistogram();
-		if (histogramMethod == 1)
-	        runGpuHistogram1();
-		else if (histogramMethod == 2)
-			runGpuHistogram2();
+		if (pipelineMode)
+		{
+			runPipeline();
+			break;
+		}
+		runHistograms();
 		runCpuEqualize();
 	    runGpuEqualization1();
-	    runGpuEqualization2();
+	    runGpuEqualization2(event_equalize1);
         compareResults();
 		break;
 	case OTSU:
-        runCpuHistogram();
-	    if (histogramMethod == 1)
-	        runGpuHistogram1();
-		else if (histogramMethod == 2)
-			runGpuHistogram2();
+		if (pipelineMode)
+		{
+			runPipeline();
+			break;
+		}
+		runHistograms();
 		runCpuOtsu();
 		runGpuOtsu();
         compareResults();
 		break;
     case SEGMENTATION:
 		runCpuSeg();
+		if (integralBins > 0)
+			runCpuSegIntegral();
+		if (segGridStride > 0)
+			runCpuSegGrid();
 		runGpuSeg();
 		break;
+	case CHANNEL_HISTOGRAM:
+		runCpuHistogramRGBL();
+		runGpuHistogramRGBL();
+		compareChannelHistograms();
+		memcpy(h_gpu_outputImageData, h_inputImageData, width * height * sizeof(cl_uchar)); //show the luma image
+		break;
+	case MATCH:
+		runHistograms();
+		runCpuMatch();
+		runGpuMatch();
+		compareResults();
+		break;
+	case COLOR_EQUALIZE:
+		runCpuEqualizeColor();
+		runGpuEqualizeColor();
+		compareColorResults();
+		break;
+	case CLAHE:
+		runCpuClahe();
+		runGpuClahe();
+		compareOutputs();
+		break;
 	default:
 		break;
 	}
+}
 
-	
+/**
+ * Called after context was created
+ */
+void onInit()
+{
+	if(setupCL() != 0)
+		return;
+  
+	if (wideMode)
+	{
+		runWideMethod();
+	}
+	else
+	{
+		runMethod();
+	}
+
+	if (framesName != NULL)
+	{
+		runTileFrames();
+	}
+
+	if (batchName != NULL)
+	{
+		runBatches();
+	}
 }
 
 /**
@@ -0,0 +1,170 @@
+#include "pgm.h"
+#include <ctype.h>
+#include <stdlib.h>
+
+/*! Reads one number from the header, skipping white space and comments.
+ */
+static int readHeaderValue(FILE* file, int* value)
+{
+	int c = fgetc(file);
+
+	while (c != EOF && (isspace(c) || c == '#'))
+	{
+		if (c == '#')
+		{
+			while (c != EOF && c != '\n')
+				c = fgetc(file);
+		}
+		c = fgetc(file);
+	}
+
+	if (c == EOF || !isdigit(c))
+		return -1;
+
+	*value = 0;
+	while (c != EOF && isdigit(c))
+	{
+		*value = *value * 10 + (c - '0');
+		c = fgetc(file);
+	}
+
+	//exactly one white space character follows the last header value
+	return isspace(c) ? 0 : -1;
+}
+
+int openPGM(const char* name, pgm_t* pgm)
+{
+	pgm->file = fopen(name, "rb");
+	if (pgm->file == NULL)
+	{
+		printf("Unable to open image %s.\n", name);
+		return -1;
+	}
+
+	if (fgetc(pgm->file) != 'P' || fgetc(pgm->file) != '5' ||
+		readHeaderValue(pgm->file, &pgm->width) != 0 ||
+		readHeaderValue(pgm->file, &pgm->height) != 0 ||
+		readHeaderValue(pgm->file, &pgm->maxValue) != 0 ||
+		pgm->width <= 0 || pgm->height <= 0 || pgm->maxValue <= 0 || pgm->maxValue > 65535)
+	{
+		printf("Image %s is not a binary pgm.\n", name);
+		fclose(pgm->file);
+		pgm->file = NULL;
+		return -1;
+	}
+
+	pgm->bitDepth = 1;
+	while ((1 << pgm->bitDepth) <= pgm->maxValue)
+		pgm->bitDepth++;
+
+	return 0;
+}
+
+int readPGMRows(pgm_t* pgm, cl_ushort* samples, int count)
+{
+	size_t numberOfSamples = (size_t) pgm->width * count;
+
+	if (pgm->maxValue < 256)
+	{
+		//one byte per sample, read to the upper half of the buffer and widen in place from the start
+		cl_uchar* bytes = (cl_uchar*) (samples + numberOfSamples) - numberOfSamples;
+
+		if (fread(bytes, 1, numberOfSamples, pgm->file) != numberOfSamples)
+			return -1;
+
+		for (size_t i = 0; i < numberOfSamples; i++)
+			samples[i] = bytes[i];
+	}
+	else
+	{
+		//two bytes per sample, most significant byte first
+		if (fread(samples, 2, numberOfSamples, pgm->file) != numberOfSamples)
+			return -1;
+
+		cl_uchar* bytes = (cl_uchar*) samples;
+		for (size_t i = 0; i < numberOfSamples; i++)
+			samples[i] = (cl_ushort) ((bytes[2 * i] << 8) | bytes[2 * i + 1]);
+	}
+
+	//the histograms are sized by bitDepth, a larger sample would index past their end
+	for (size_t i = 0; i < numberOfSamples; i++)
+	{
+		if (samples[i] > pgm->maxValue)
+			return -2;
+	}
+
+	return 0;
+}
+
+int createPGM(const char* name, int width, int height, int maxValue, pgm_t* pgm)
+{
+	pgm->file = fopen(name, "wb");
+	if (pgm->file == NULL)
+	{
+		printf("Unable to create image %s.\n", name);
+		return -1;
+	}
+
+	pgm->width = width;
+	pgm->height = height;
+	pgm->maxValue = maxValue;
+
+	pgm->bitDepth = 1;
+	while ((1 << pgm->bitDepth) <= pgm->maxValue)
+		pgm->bitDepth++;
+
+	if (fprintf(pgm->file, "P5\n%d %d\n%d\n", width, height, maxValue) < 0)
+	{
+		closePGM(pgm);
+		return -1;
+	}
+
+	return 0;
+}
+
+int writePGMRows(pgm_t* pgm, const cl_ushort* samples, int count)
+{
+	size_t numberOfSamples = (size_t) pgm->width * count;
+	size_t bytesPerSample = (pgm->maxValue < 256) ? 1 : 2;
+
+	//samples are converted to the file format in small chunks, the caller's buffer stays unchanged
+	cl_uchar bytes[4096];
+	size_t chunkSamples = sizeof(bytes) / bytesPerSample;
+
+	for (size_t first = 0; first < numberOfSamples; first += chunkSamples)
+	{
+		size_t chunk = numberOfSamples - first;
+		if (chunk > chunkSamples)
+			chunk = chunkSamples;
+
+		for (size_t i = 0; i < chunk; i++)
+		{
+			cl_ushort sample = samples[first + i];
+
+			if (bytesPerSample == 1)
+			{
+				bytes[i] = (cl_uchar) sample;
+			}
+			else
+			{
+				//most significant byte first
+				bytes[2 * i] = (cl_uchar) (sample >> 8);
+				bytes[2 * i + 1] = (cl_uchar) sample;
+			}
+		}
+
+		if (fwrite(bytes, bytesPerSample, chunk, pgm->file) != chunk)
+			return -1;
+	}
+
+	return 0;
+}
+
+void closePGM(pgm_t* pgm)
+{
+	if (pgm->file)
+	{
+		fclose(pgm->file);
+		pgm->file = NULL;
+	}
+}
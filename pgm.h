@@ -0,0 +1,58 @@
+#ifndef PGM_H
+#define PGM_H
+
+#include <CL/opencl.h>
+#include <stdio.h>
+
+/*! Binary portable graymap (P5) opened for reading or writing, samples up to 16 bits.
+ */
+struct pgm_t {
+	FILE* file;
+	int width;
+	int height;
+	int maxValue; //largest sample value given in the header
+	int bitDepth; //number of bits needed for maxValue
+};
+
+/*! Opens a binary pgm file and reads its header.
+ *
+ * \param[in] name file name
+ * \param[out] pgm opened image
+ * \return 0 on success, -1 if the file can not be opened or is not a binary pgm
+ */
+int openPGM(const char* name, pgm_t* pgm);
+
+/*! Reads following rows of the image.
+ *
+ * \param[in] pgm opened image
+ * \param[out] samples count rows of samples, width values each
+ * \param[in] count number of rows to read
+ * \return 0 on success, -1 if the file ends too early, -2 if a sample is above maxValue
+ */
+int readPGMRows(pgm_t* pgm, cl_ushort* samples, int count);
+
+/*! Creates a binary pgm file and writes its header.
+ *
+ * \param[in] name file name
+ * \param[in] width image width
+ * \param[in] height image height
+ * \param[in] maxValue largest sample value, up to 65535
+ * \param[out] pgm created image
+ * \return 0 on success, -1 if the file can not be created
+ */
+int createPGM(const char* name, int width, int height, int maxValue, pgm_t* pgm);
+
+/*! Writes following rows of the image.
+ *
+ * \param[in] pgm created image
+ * \param[in] samples count rows of samples, width values each
+ * \param[in] count number of rows to write
+ * \return 0 on success, -1 if the file can not be written
+ */
+int writePGMRows(pgm_t* pgm, const cl_ushort* samples, int count);
+
+/*! Closes the image.
+ */
+void closePGM(pgm_t* pgm);
+
+#endif